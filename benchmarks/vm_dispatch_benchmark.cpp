@@ -0,0 +1,165 @@
+/**
+ * VM dispatch benchmark
+ *
+ * Compares the original switch-based interpreter, which re-decodes the raw
+ * bytecode every block, against VM::process running the pre-decoded,
+ * direct-threaded instruction stream built by load_program.
+ *
+ * Usage: vm_dispatch_benchmark [patch.json] [num_blocks]
+ */
+#include "parser/parser.h"
+#include "compiler/compiler.h"
+#include "compiler/module_registry.h"
+#include "vm/vm.h"
+#include "vm/opcodes.h"
+#include "dsp/module_factory.h"
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#ifndef TEST_DATA_DIR
+#define TEST_DATA_DIR "examples"
+#endif
+#ifndef MODULE_DEFS_PATH
+#define MODULE_DEFS_PATH "data/modules.json"
+#endif
+using namespace madronavm;
+namespace {
+// The VM::process loop as it was before instructions were pre-decoded: a
+// switch per opcode, a std::map lookup per PROC and per-block pointer vectors.
+class LegacyInterpreter {
+public:
+  LegacyInterpreter(std::vector<uint32_t> bytecode, float sampleRate)
+    : m_bytecode(std::move(bytecode)), m_sampleRate(sampleRate) {
+    BytecodeHeader header;
+    std::memcpy(&header, m_bytecode.data(), sizeof(header));
+    m_registers.resize(header.num_registers);
+  }
+  void process(float** outputs, int num_frames) {
+    size_t pc = sizeof(BytecodeHeader) / sizeof(uint32_t);
+    while (pc < m_bytecode.size()) {
+      switch (static_cast<OpCode>(m_bytecode[pc])) {
+      case OpCode::LOAD_K: {
+        float value;
+        std::memcpy(&value, &m_bytecode[pc + 2], sizeof(float));
+        m_registers[m_bytecode[pc + 1]] = value;
+        pc += 3;
+        break;
+      }
+      case OpCode::PROC: {
+        uint32_t node_id = m_bytecode[pc + 1];
+        uint32_t num_inputs = m_bytecode[pc + 4];
+        uint32_t num_outputs = m_bytecode[pc + 5];
+        if (m_modules.find(node_id) == m_modules.end()) {
+          m_modules[node_id] = dsp::create_module(m_bytecode[pc + 2], m_sampleRate);
+        }
+        std::vector<const float*> input_ptrs(num_inputs);
+        for (uint32_t i = 0; i < num_inputs; ++i) {
+          uint32_t reg_idx = m_bytecode[pc + 6 + i];
+          input_ptrs[i] = reg_idx == std::numeric_limits<uint32_t>::max()
+                              ? nullptr : m_registers[reg_idx].getConstBuffer();
+        }
+        std::vector<float*> output_ptrs(num_outputs);
+        for (uint32_t i = 0; i < num_outputs; ++i) {
+          output_ptrs[i] = m_registers[m_bytecode[pc + 6 + num_inputs + i]].getBuffer();
+        }
+        m_modules[node_id]->process(input_ptrs.data(), num_inputs, output_ptrs.data(), num_outputs);
+        pc += 6 + num_inputs + num_outputs;
+        break;
+      }
+      case OpCode::ADD:
+      case OpCode::MUL:
+      case OpCode::CMP_GT:
+      case OpCode::SPLAT:
+      case OpCode::SPLAT_INT: {
+        // Before native opcodes these were PROCs of the same module.
+        const OpCode opcode = static_cast<OpCode>(m_bytecode[pc]);
+        const uint32_t num_inputs =
+            opcode == OpCode::SPLAT || opcode == OpCode::SPLAT_INT ? 1 : 2;
+        uint32_t node_id = m_bytecode[pc + 1];
+        if (m_modules.find(node_id) == m_modules.end()) {
+          m_modules[node_id] = dsp::create_module(m_bytecode[pc + 2], m_sampleRate);
+        }
+        std::vector<const float*> input_ptrs(num_inputs);
+        for (uint32_t i = 0; i < num_inputs; ++i) {
+          input_ptrs[i] = m_registers[m_bytecode[pc + 3 + i]].getConstBuffer();
+        }
+        std::vector<float*> output_ptrs = { m_registers[m_bytecode[pc + 3 + num_inputs]].getBuffer() };
+        m_modules[node_id]->process(input_ptrs.data(), num_inputs, output_ptrs.data(), 1);
+        pc += 4 + num_inputs;
+        break;
+      }
+      case OpCode::AUDIO_OUT: {
+        uint32_t num_inputs = m_bytecode[pc + 1];
+        for (uint32_t i = 0; i < num_inputs; ++i) {
+          std::memcpy(outputs[i], m_registers[m_bytecode[pc + 2 + i]].getConstBuffer(),
+                      num_frames * sizeof(float));
+        }
+        pc += 2 + num_inputs;
+        break;
+      }
+      default:
+        return;
+      }
+    }
+  }
+private:
+  std::vector<uint32_t> m_bytecode;
+  std::vector<ml::DSPVector> m_registers;
+  std::map<uint32_t, std::unique_ptr<dsp::DSPModule>> m_modules;
+  float m_sampleRate;
+};
+template <typename ProcessFn>
+double time_blocks(int num_blocks, ProcessFn&& fn) {
+  auto start = std::chrono::steady_clock::now();
+  for (int block = 0; block < num_blocks; ++block) {
+    fn();
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / num_blocks;
+}
+} // namespace
+int main(int argc, char* argv[]) {
+  std::string patch_path = (argc > 1) ? argv[1] : std::string(TEST_DATA_DIR) + "/subtractive_synth.json";
+  int num_blocks = (argc > 2) ? std::stoi(argv[2]) : 20000;
+  constexpr float kSampleRate = 48000.0f;
+  std::ifstream patch_file(patch_path);
+  if (!patch_file.is_open()) {
+    std::cerr << "Error: Could not open patch file: " << patch_path << std::endl;
+    return 1;
+  }
+  std::string json_content((std::istreambuf_iterator<char>(patch_file)),
+                           std::istreambuf_iterator<char>());
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  // The legacy interpreter predates EXPR, the superinstructions and the
+  // fixed-arity PROC forms, so both sides run one counted instruction per
+  // node.
+  CompileOptions options;
+  options.fuse_expressions = false;
+  options.superinstructions = false;
+  options.arity_forms = false;
+  auto bytecode = Compiler::compile(parse_json(json_content), registry, {}, nullptr, options);
+  std::vector<float> out_l(kFloatsPerDSPVector), out_r(kFloatsPerDSPVector);
+  float* outputs[] = { out_l.data(), out_r.data() };
+  LegacyInterpreter legacy(bytecode, kSampleRate);
+  VM vm(registry, kSampleRate, true);
+  vm.load_program(bytecode);
+  // Warm up both paths so module construction is not timed.
+  for (int i = 0; i < 100; ++i) {
+    legacy.process(outputs, kFloatsPerDSPVector);
+    vm.process(nullptr, outputs, kFloatsPerDSPVector);
+  }
+  double legacy_ns = time_blocks(num_blocks, [&] { legacy.process(outputs, kFloatsPerDSPVector); });
+  double vm_ns = time_blocks(num_blocks, [&] { vm.process(nullptr, outputs, kFloatsPerDSPVector); });
+  std::cout << "Patch: " << patch_path << " (" << bytecode.size() << " words), "
+            << num_blocks << " blocks" << std::endl;
+  std::cout << "  switch interpreter:  " << legacy_ns << " ns/block" << std::endl;
+  std::cout << "  pre-decoded VM:      " << vm_ns << " ns/block" << std::endl;
+  std::cout << "  speedup:             " << legacy_ns / vm_ns << "x" << std::endl;
+  return 0;
+}
@@ -0,0 +1,81 @@
+/**
+ * VM expression fusion benchmark
+ *
+ * Compiles a patch twice, with and without fusing arithmetic trees into
+ * EXPR instructions, checks that both render the same samples, and reports
+ * the time per 64-frame block of each.
+ *
+ * Usage: vm_fusion_benchmark [patch.json] [num_blocks]
+ */
+#include "parser/parser.h"
+#include "compiler/compiler.h"
+#include "compiler/module_registry.h"
+#include "vm/vm.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#ifndef TEST_DATA_DIR
+#define TEST_DATA_DIR "examples"
+#endif
+#ifndef MODULE_DEFS_PATH
+#define MODULE_DEFS_PATH "data/modules.json"
+#endif
+using namespace madronavm;
+namespace {
+constexpr float kSampleRate = 48000.0f;
+struct Run {
+  double ns_per_block;
+  std::vector<float> first_blocks;
+};
+Run run(const ModuleRegistry& registry, const std::vector<uint32_t>& bytecode, int num_blocks) {
+  VM vm(registry, kSampleRate, true);
+  vm.load_program(bytecode);
+  std::vector<float> out_l(kFloatsPerDSPVector), out_r(kFloatsPerDSPVector);
+  float* outputs[] = { out_l.data(), out_r.data() };
+  Run result{};
+  for (int i = 0; i < 100; ++i) {
+    vm.process(nullptr, outputs, kFloatsPerDSPVector);
+    result.first_blocks.insert(result.first_blocks.end(), out_l.begin(), out_l.end());
+    result.first_blocks.insert(result.first_blocks.end(), out_r.begin(), out_r.end());
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (int block = 0; block < num_blocks; ++block) {
+    vm.process(nullptr, outputs, kFloatsPerDSPVector);
+  }
+  auto end = std::chrono::steady_clock::now();
+  result.ns_per_block = std::chrono::duration<double, std::nano>(end - start).count() / num_blocks;
+  return result;
+}
+} // namespace
+int main(int argc, char* argv[]) {
+  std::string patch_path = (argc > 1) ? argv[1] : std::string(TEST_DATA_DIR) + "/phasor_to_trigger_to_adsr.json";
+  int num_blocks = (argc > 2) ? std::stoi(argv[2]) : 20000;
+  std::ifstream patch_file(patch_path);
+  if (!patch_file.is_open()) {
+    std::cerr << "Error: Could not open patch file: " << patch_path << std::endl;
+    return 1;
+  }
+  std::string json_content((std::istreambuf_iterator<char>(patch_file)),
+                           std::istreambuf_iterator<char>());
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  const PatchGraph graph = parse_json(json_content);
+  CompileOptions unfused_options;
+  unfused_options.fuse_expressions = false;
+  const auto fused = Compiler::compile(graph, registry);
+  const auto unfused = Compiler::compile(graph, registry, {}, nullptr, unfused_options);
+  const Run fused_run = run(registry, fused, num_blocks);
+  const Run unfused_run = run(registry, unfused, num_blocks);
+  std::cout << "Patch: " << patch_path << ", " << num_blocks << " blocks" << std::endl;
+  std::cout << "  unfused: " << unfused_run.ns_per_block << " ns/block (" << unfused.size()
+            << " words)" << std::endl;
+  std::cout << "  fused:   " << fused_run.ns_per_block << " ns/block (" << fused.size()
+            << " words)" << std::endl;
+  std::cout << "  speedup: " << unfused_run.ns_per_block / fused_run.ns_per_block << "x" << std::endl;
+  if (fused_run.first_blocks != unfused_run.first_blocks) {
+    std::cerr << "Error: fused and unfused output differ" << std::endl;
+    return 1;
+  }
+  return 0;
+}
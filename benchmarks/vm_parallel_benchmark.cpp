@@ -0,0 +1,147 @@
+/**
+ * VM parallel scheduling benchmark
+ *
+ * Renders synthetic patches serially, level by level (Schedule::kLevels) and
+ * as a work-stealing task graph (Schedule::kTaskGraph), and reports the time
+ * per 64-frame block of each.
+ *
+ *   wide:    many short oscillator -> filter chains, summed
+ *   deep:    one long filter chain; nothing to parallelise
+ *   uneven:  one long chain beside many short ones, so levels are ragged
+ *            and the critical path decides the block time
+ *
+ * Usage: vm_parallel_benchmark [num_workers] [num_blocks]
+ */
+#include "parser/parser.h"
+#include "compiler/compiler.h"
+#include "compiler/module_registry.h"
+#include "vm/vm.h"
+#include "vm/worker_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef MODULE_DEFS_PATH
+#define MODULE_DEFS_PATH "data/modules.json"
+#endif
+using namespace madronavm;
+namespace {
+constexpr float kSampleRate = 48000.0f;
+// Builds patch JSON node by node; node IDs are assigned in order from 1.
+class PatchBuilder {
+public:
+  int add(const std::string& name, const std::string& data = "{}") {
+    const int id = ++m_last_id;
+    m_modules += (m_modules.empty() ? "" : ",\n") + std::string(R"({"id": )") +
+                 std::to_string(id) + R"(, "name": ")" + name + R"(", "data": )" + data + "}";
+    return id;
+  }
+  void connect(int from, const char* from_port, int to, const char* to_port) {
+    m_connections += (m_connections.empty() ? "" : ",\n") + std::string(R"({"from": ")") +
+                     std::to_string(from) + ":" + from_port + R"(", "to": ")" +
+                     std::to_string(to) + ":" + to_port + R"("})";
+  }
+  // An oscillator followed by `length` filters; returns the last node.
+  int chain(int length) {
+    int node = add("saw_gen", R"({"freq": )" + std::to_string(55 * (m_last_id % 7 + 1)) + "}");
+    for (int i = 0; i < length; ++i) {
+      const int filter = add("lopass", R"({"cutoff": 1500.0, "q": 0.7})");
+      connect(node, "out", filter, "in");
+      node = filter;
+    }
+    return node;
+  }
+  // Sums the nodes pairwise into one and sends it to both channels.
+  std::string finish(std::vector<int> nodes) {
+    while (nodes.size() > 1) {
+      std::vector<int> sums;
+      for (size_t i = 0; i + 1 < nodes.size(); i += 2) {
+        const int sum = add("add");
+        connect(nodes[i], "out", sum, "in1");
+        connect(nodes[i + 1], "out", sum, "in2");
+        sums.push_back(sum);
+      }
+      if (nodes.size() % 2) {
+        sums.push_back(nodes.back());
+      }
+      nodes = sums;
+    }
+    const int out = add("audio_out");
+    connect(nodes[0], "out", out, "in_l");
+    connect(nodes[0], "out", out, "in_r");
+    return "{\"modules\": [" + m_modules + "], \"connections\": [" + m_connections + "]}";
+  }
+private:
+  std::string m_modules;
+  std::string m_connections;
+  int m_last_id = 0;
+};
+std::string wide_patch() {
+  PatchBuilder patch;
+  std::vector<int> ends;
+  for (int i = 0; i < 32; ++i) {
+    ends.push_back(patch.chain(2));
+  }
+  return patch.finish(ends);
+}
+std::string deep_patch() {
+  PatchBuilder patch;
+  return patch.finish({patch.chain(64)});
+}
+std::string uneven_patch() {
+  PatchBuilder patch;
+  std::vector<int> ends{patch.chain(24)};
+  for (int i = 0; i < 24; ++i) {
+    ends.push_back(patch.chain(1));
+  }
+  return patch.finish(ends);
+}
+double ns_per_block(VM& vm, int num_blocks) {
+  std::vector<float> out_l(kFloatsPerDSPVector), out_r(kFloatsPerDSPVector);
+  float* outputs[] = { out_l.data(), out_r.data() };
+  // Warm up, and give the task graph time to profile its costs.
+  for (int i = 0; i < 500; ++i) {
+    vm.process(nullptr, outputs, kFloatsPerDSPVector);
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (int block = 0; block < num_blocks; ++block) {
+    vm.process(nullptr, outputs, kFloatsPerDSPVector);
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / num_blocks;
+}
+} // namespace
+int main(int argc, char* argv[]) {
+  const size_t default_workers = std::max(1u, std::thread::hardware_concurrency()) - 1;
+  const size_t num_workers = (argc > 1) ? std::stoul(argv[1]) : std::min<size_t>(default_workers, 7);
+  const int num_blocks = (argc > 2) ? std::stoi(argv[2]) : 20000;
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  WorkerPool pool(num_workers);
+  std::cout << num_workers << " workers + audio thread, " << num_blocks << " blocks" << std::endl;
+  const std::pair<const char*, std::string> patches[] = {
+    {"wide", wide_patch()}, {"deep", deep_patch()}, {"uneven", uneven_patch()},
+  };
+  for (const auto& [name, json] : patches) {
+    const auto bytecode = Compiler::compile(parse_json(json), registry);
+    VM serial(registry, kSampleRate, true);
+    VM levels(registry, kSampleRate, true);
+    VM task_graph(registry, kSampleRate, true);
+    serial.load_program(bytecode);
+    levels.load_program(bytecode);
+    task_graph.load_program(bytecode);
+    levels.set_worker_pool(&pool, Schedule::kLevels);
+    task_graph.set_worker_pool(&pool, Schedule::kTaskGraph);
+    const double serial_ns = ns_per_block(serial, num_blocks);
+    const double levels_ns = ns_per_block(levels, num_blocks);
+    const double task_graph_ns = ns_per_block(task_graph, num_blocks);
+    std::cout << name << " (" << bytecode.size() << " words)" << std::endl;
+    std::cout << "  serial:      " << serial_ns << " ns/block" << std::endl;
+    std::cout << "  levels:      " << levels_ns << " ns/block ("
+              << serial_ns / levels_ns << "x)" << std::endl;
+    std::cout << "  task graph:  " << task_graph_ns << " ns/block ("
+              << serial_ns / task_graph_ns << "x)" << std::endl;
+  }
+  return 0;
+}
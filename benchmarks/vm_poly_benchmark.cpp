@@ -0,0 +1,115 @@
+/**
+ * VM polyphony benchmark
+ *
+ * Renders a saw -> lopass -> gain voice with an ADSR on the gain, at several
+ * voice counts, once on polyphonic cables (one PROC_POLY per module, mixed
+ * by voice_mix) and once as that many mono copies summed by add modules,
+ * and reports the time per 64-frame block of each.
+ *
+ * Usage: vm_poly_benchmark [num_blocks]
+ */
+#include "parser/parser.h"
+#include "compiler/compiler.h"
+#include "compiler/module_registry.h"
+#include "vm/vm.h"
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#ifndef MODULE_DEFS_PATH
+#define MODULE_DEFS_PATH "data/modules.json"
+#endif
+using namespace madronavm;
+namespace {
+constexpr float kSampleRate = 48000.0f;
+const char* kEnvelope = R"("attack": 0.01, "decay": 0.2, "sustain": 0.6, "release": 0.3)";
+std::string voice_freq(int voice) {
+  return std::to_string(55.0f * (voice % 24 + 1));
+}
+std::string poly_patch(int voices) {
+  std::string freqs;
+  for (int v = 0; v < voices; ++v) {
+    freqs += (v ? ", " : "") + voice_freq(v);
+  }
+  return R"({"modules": [
+    {"id": 1, "name": "saw_gen", "data": {"freq": [)" + freqs + R"(]}},
+    {"id": 2, "name": "lopass", "data": {"cutoff": 1500.0, "q": 0.7}},
+    {"id": 3, "name": "adsr", "voices": )" + std::to_string(voices) +
+         R"(, "data": {"gate": 1.0, )" + kEnvelope + R"(}},
+    {"id": 4, "name": "gain", "data": {}},
+    {"id": 5, "name": "voice_mix", "data": {}},
+    {"id": 6, "name": "audio_out", "data": {}}
+  ], "connections": [
+    {"from": "1:out", "to": "2:in"}, {"from": "2:out", "to": "4:in"},
+    {"from": "3:out", "to": "4:gain"}, {"from": "4:out", "to": "5:in"},
+    {"from": "5:out", "to": "6:in_l"}, {"from": "5:out", "to": "6:in_r"}
+  ]})";
+}
+std::string mono_patch(int voices) {
+  std::string modules, connections;
+  auto module = [&](int id, const std::string& name, const std::string& data) {
+    modules += (modules.empty() ? "" : ",\n") + std::string(R"({"id": )") + std::to_string(id) +
+               R"(, "name": ")" + name + R"(", "data": {)" + data + "}}";
+  };
+  auto connect = [&](int from, const char* from_port, int to, const char* to_port) {
+    connections += (connections.empty() ? "" : ",\n") + std::string(R"({"from": ")") +
+                   std::to_string(from) + ":" + from_port + R"(", "to": ")" +
+                   std::to_string(to) + ":" + to_port + R"("})";
+  };
+  int mix = 0;
+  for (int v = 0; v < voices; ++v) {
+    const int base = 10 * (v + 1);
+    module(base + 1, "saw_gen", R"("freq": )" + voice_freq(v));
+    module(base + 2, "lopass", R"("cutoff": 1500.0, "q": 0.7)");
+    module(base + 3, "adsr", std::string(R"("gate": 1.0, )") + kEnvelope);
+    module(base + 4, "gain", "");
+    connect(base + 1, "out", base + 2, "in");
+    connect(base + 2, "out", base + 4, "in");
+    connect(base + 3, "out", base + 4, "gain");
+    if (v == 0) {
+      mix = base + 4;
+    } else {
+      const int add = 100000 + v;
+      module(add, "add", "");
+      connect(mix, "out", add, "in1");
+      connect(base + 4, "out", add, "in2");
+      mix = add;
+    }
+  }
+  module(200000, "audio_out", "");
+  connect(mix, "out", 200000, "in_l");
+  connect(mix, "out", 200000, "in_r");
+  return "{\"modules\": [" + modules + "], \"connections\": [" + connections + "]}";
+}
+double ns_per_block(VM& vm, int num_blocks) {
+  std::vector<float> out_l(kFloatsPerDSPVector), out_r(kFloatsPerDSPVector);
+  float* outputs[] = { out_l.data(), out_r.data() };
+  for (int i = 0; i < 100; ++i) {
+    vm.process(nullptr, outputs, kFloatsPerDSPVector);
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (int block = 0; block < num_blocks; ++block) {
+    vm.process(nullptr, outputs, kFloatsPerDSPVector);
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / num_blocks;
+}
+} // namespace
+int main(int argc, char* argv[]) {
+  const int num_blocks = (argc > 1) ? std::stoi(argv[1]) : 10000;
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  std::cout << num_blocks << " blocks" << std::endl;
+  for (int voices : {8, 16, 32, 64, 128}) {
+    VM poly(registry, kSampleRate, true);
+    VM mono(registry, kSampleRate, true);
+    poly.load_program(Compiler::compile(parse_json(poly_patch(voices)), registry));
+    mono.load_program(Compiler::compile(parse_json(mono_patch(voices)), registry));
+    const double poly_ns = ns_per_block(poly, num_blocks);
+    const double mono_ns = ns_per_block(mono, num_blocks);
+    std::cout << voices << " voices" << std::endl;
+    std::cout << "  mono copies: " << mono_ns << " ns/block" << std::endl;
+    std::cout << "  poly cables: " << poly_ns << " ns/block ("
+              << mono_ns / poly_ns << "x)" << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,82 @@
+/**
+ * VM superinstruction benchmark
+ *
+ * Compiles a patch twice, with and without pairing modules with the MUL or
+ * EXPR reading them into PROC_MUL and PROC_EXPR superinstructions, checks
+ * that both render the same samples, and reports the time per 64-frame
+ * block of each.
+ *
+ * Usage: vm_superinstruction_benchmark [patch.json] [num_blocks]
+ */
+#include "parser/parser.h"
+#include "compiler/compiler.h"
+#include "compiler/module_registry.h"
+#include "vm/vm.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#ifndef TEST_DATA_DIR
+#define TEST_DATA_DIR "examples"
+#endif
+#ifndef MODULE_DEFS_PATH
+#define MODULE_DEFS_PATH "data/modules.json"
+#endif
+using namespace madronavm;
+namespace {
+constexpr float kSampleRate = 48000.0f;
+struct Run {
+  double ns_per_block;
+  std::vector<float> first_blocks;
+};
+Run run(const ModuleRegistry& registry, const std::vector<uint32_t>& bytecode, int num_blocks) {
+  VM vm(registry, kSampleRate, true);
+  vm.load_program(bytecode);
+  std::vector<float> out_l(kFloatsPerDSPVector), out_r(kFloatsPerDSPVector);
+  float* outputs[] = { out_l.data(), out_r.data() };
+  Run result{};
+  for (int i = 0; i < 100; ++i) {
+    vm.process(nullptr, outputs, kFloatsPerDSPVector);
+    result.first_blocks.insert(result.first_blocks.end(), out_l.begin(), out_l.end());
+    result.first_blocks.insert(result.first_blocks.end(), out_r.begin(), out_r.end());
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (int block = 0; block < num_blocks; ++block) {
+    vm.process(nullptr, outputs, kFloatsPerDSPVector);
+  }
+  auto end = std::chrono::steady_clock::now();
+  result.ns_per_block = std::chrono::duration<double, std::nano>(end - start).count() / num_blocks;
+  return result;
+}
+} // namespace
+int main(int argc, char* argv[]) {
+  std::string patch_path = (argc > 1) ? argv[1] : std::string(TEST_DATA_DIR) + "/binaural.json";
+  int num_blocks = (argc > 2) ? std::stoi(argv[2]) : 20000;
+  std::ifstream patch_file(patch_path);
+  if (!patch_file.is_open()) {
+    std::cerr << "Error: Could not open patch file: " << patch_path << std::endl;
+    return 1;
+  }
+  std::string json_content((std::istreambuf_iterator<char>(patch_file)),
+                           std::istreambuf_iterator<char>());
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  const PatchGraph graph = parse_json(json_content);
+  CompileOptions separate_options;
+  separate_options.superinstructions = false;
+  const auto paired = Compiler::compile(graph, registry);
+  const auto separate = Compiler::compile(graph, registry, {}, nullptr, separate_options);
+  const Run paired_run = run(registry, paired, num_blocks);
+  const Run separate_run = run(registry, separate, num_blocks);
+  std::cout << "Patch: " << patch_path << ", " << num_blocks << " blocks" << std::endl;
+  std::cout << "  separate: " << separate_run.ns_per_block << " ns/block (" << separate.size()
+            << " words)" << std::endl;
+  std::cout << "  paired:   " << paired_run.ns_per_block << " ns/block (" << paired.size()
+            << " words)" << std::endl;
+  std::cout << "  speedup:  " << separate_run.ns_per_block / paired_run.ns_per_block << "x" << std::endl;
+  if (paired_run.first_blocks != separate_run.first_blocks) {
+    std::cerr << "Error: paired and separate output differ" << std::endl;
+    return 1;
+  }
+  return 0;
+}
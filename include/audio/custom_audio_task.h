@@ -17,7 +17,13 @@ namespace ml {
 class CustomAudioTask {
 public:
   using AudioCallback = std::function<void(ml::AudioContext*)>;
+  // Receives the device's own non-interleaved output buffers and frame count,
+  // which need not be a multiple of kFloatsPerDSPVector. Used by processors
+  // that block internally (such as the VM), so the SignalProcessBuffer copy
+  // and its added latency are skipped.
+  using DirectCallback = std::function<void(float** outputs, int num_frames)>;
   CustomAudioTask(ml::AudioContext* ctx, AudioCallback callback, unsigned int deviceId = 0);
+  CustomAudioTask(ml::AudioContext* ctx, DirectCallback callback, unsigned int deviceId = 0);
   ~CustomAudioTask();
   // Start audio processing with the specified device
   int startAudio();
@@ -33,6 +39,7 @@ private:
   std::unique_ptr<RtAudio> mRtAudio;
   ml::AudioContext* mContext;
   AudioCallback mCallback;
+  DirectCallback mDirectCallback;
   std::unique_ptr<ml::SignalProcessBuffer> mBuffer;
   unsigned int mDeviceId;
   // Constants
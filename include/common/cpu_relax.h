@@ -0,0 +1,15 @@
+#pragma once
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+namespace madronavm {
+// Tells the core we are spinning, so a hyperthread sibling gets the
+// pipeline and the spin costs less power.
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  asm volatile("yield");
+#endif
+}
+} // namespace madronavm
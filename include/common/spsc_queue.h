@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+namespace madronavm {
+// Bounded single-producer / single-consumer queue. Storage is inline and
+// fixed at compile time, push and pop are wait-free and never allocate, so
+// either end may live on the audio thread. Capacity must be a power of two;
+// one element is always left free to tell full from empty.
+template <typename T, size_t Capacity>
+class SpscQueue {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                "SpscQueue capacity must be a power of two");
+  static_assert(std::is_trivially_copyable<T>::value,
+                "SpscQueue elements are copied without constructors");
+public:
+  static constexpr size_t kCacheLineSize = 64;
+  // Producer side. Returns false and drops nothing if the queue is full.
+  bool try_push(const T& value) {
+    const size_t tail = m_tail.load(std::memory_order_relaxed);
+    const size_t next = (tail + 1) & kMask;
+    if (next == m_head.load(std::memory_order_acquire)) return false;
+    m_items[tail] = value;
+    m_tail.store(next, std::memory_order_release);
+    return true;
+  }
+  // Producer side. True if the next try_push is guaranteed to succeed.
+  bool can_push() const {
+    const size_t next = (m_tail.load(std::memory_order_relaxed) + 1) & kMask;
+    return next != m_head.load(std::memory_order_acquire);
+  }
+  // Consumer side. Returns false if the queue is empty.
+  bool try_pop(T& value) {
+    const size_t head = m_head.load(std::memory_order_relaxed);
+    if (head == m_tail.load(std::memory_order_acquire)) return false;
+    value = m_items[head];
+    m_head.store((head + 1) & kMask, std::memory_order_release);
+    return true;
+  }
+  bool empty() const {
+    return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+  }
+  static constexpr size_t capacity() { return Capacity - 1; }
+private:
+  static constexpr size_t kMask = Capacity - 1;
+  // Head and tail sit on separate cache lines so the two threads do not
+  // false-share.
+  alignas(kCacheLineSize) std::atomic<size_t> m_head{0};
+  alignas(kCacheLineSize) std::atomic<size_t> m_tail{0};
+  alignas(kCacheLineSize) T m_items[Capacity];
+};
+} // namespace madronavm
@@ -0,0 +1,76 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+namespace madronavm {
+// Chase-Lev work-stealing deque of task indices (Le et al., "Correct and
+// Efficient Work-Stealing for Weak Memory Models", PPoPP 2013). The owner
+// pushes and pops at the bottom; any other thread may steal from the top.
+// The buffer is sized once by reset_capacity() and never grows, so push,
+// pop and steal never allocate; the caller guarantees that no more than
+// capacity items are pushed between two clear() calls.
+class WorkStealingDeque {
+public:
+  static constexpr size_t kCacheLineSize = 64;
+  static constexpr uint32_t kEmpty = UINT32_MAX;
+  // Not thread safe; allocates.
+  void reset_capacity(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+    m_items = std::make_unique<std::atomic<uint32_t>[]>(size);
+    m_mask = size - 1;
+    clear();
+  }
+  // Not thread safe: only between runs.
+  void clear() {
+    m_top.store(0, std::memory_order_relaxed);
+    m_bottom.store(0, std::memory_order_relaxed);
+  }
+  // Owner only.
+  void push(uint32_t item) {
+    const int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+    m_items[bottom & m_mask].store(item, std::memory_order_relaxed);
+    m_bottom.store(bottom + 1, std::memory_order_release);
+  }
+  // Owner only. Returns kEmpty if there is nothing left.
+  uint32_t pop() {
+    const int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+    m_bottom.store(bottom, std::memory_order_seq_cst);
+    int64_t top = m_top.load(std::memory_order_seq_cst);
+    if (top > bottom) {
+      m_bottom.store(bottom + 1, std::memory_order_relaxed);
+      return kEmpty;
+    }
+    uint32_t item = m_items[bottom & m_mask].load(std::memory_order_relaxed);
+    if (top == bottom) {
+      // Last item: race the thieves for it.
+      if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                         std::memory_order_relaxed)) {
+        item = kEmpty;
+      }
+      m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return item;
+  }
+  // Any thread. Returns kEmpty if empty or if another thread won the item.
+  uint32_t steal() {
+    int64_t top = m_top.load(std::memory_order_seq_cst);
+    const int64_t bottom = m_bottom.load(std::memory_order_seq_cst);
+    if (top >= bottom) {
+      return kEmpty;
+    }
+    const uint32_t item = m_items[top & m_mask].load(std::memory_order_relaxed);
+    if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed)) {
+      return kEmpty;
+    }
+    return item;
+  }
+private:
+  alignas(kCacheLineSize) std::atomic<int64_t> m_top{0};
+  alignas(kCacheLineSize) std::atomic<int64_t> m_bottom{0};
+  alignas(kCacheLineSize) std::unique_ptr<std::atomic<uint32_t>[]> m_items;
+  size_t m_mask = 0;
+};
+} // namespace madronavm
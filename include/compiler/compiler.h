@@ -1,13 +1,104 @@
 #pragma once
 #include "parser/patch_graph.h"
+#include <map>
 #include <vector>
 namespace madronavm {
 class ModuleRegistry; // Forward declaration
+// Optional passes of compile(). Each one removes nodes, which can then no
+// longer be addressed by node ID, e.g. by VM::set_parameter.
+struct CompileOptions {
+  // Evaluate stateless nodes whose inputs are all constant at compile time
+  // (see Compiler::fold_constants).
+  bool fold_constants = true;
+  // Run one of several identical stateless nodes for all of them (see
+  // Compiler::merge_duplicates).
+  bool merge_duplicates = true;
+  // Run each tree of mono add, mul, gain and threshold nodes whose inner
+  // values have a single reader as one fused EXPR instruction. Fused nodes
+  // stay addressable.
+  bool fuse_expressions = true;
+  // Run a mono module and the MUL or EXPR reading its output as one
+  // PROC_MUL or PROC_EXPR instruction where the reader's other inputs are
+  // ready in time.
+  bool superinstructions = true;
+  // Emit a mono PROC with 1, 2, 3 or 5 inputs and one output as the
+  // PROC_Nx1 form of its shape.
+  bool arity_forms = true;
+};
+// What compile() changed about the patch on the way to bytecode.
+struct CompileReport {
+  // Nodes removed because no path leads from them to an audio_out, in
+  // ascending ID order.
+  std::vector<uint32_t> removed_nodes;
+  // Nodes replaced by the constants they compute, in ascending ID order.
+  std::vector<uint32_t> folded_nodes;
+  // Nodes dropped because an identical node computes the same outputs, in
+  // ascending ID order.
+  std::vector<uint32_t> merged_nodes;
+};
 class Compiler {
 public:
   // Performs a topological sort on the graph and returns the sorted node IDs.
   static std::vector<uint32_t> topological_sort(const PatchGraph& graph);
-  // Compiles the patch graph into a bytecode buffer.
-  static std::vector<uint32_t> compile(const PatchGraph& graph, const ModuleRegistry& registry);
+  // Returns the graph without the nodes none of whose outputs reach an
+  // audio_out, directly or through other nodes, and without their
+  // connections; their IDs are appended to removed, if given. A graph
+  // with no audio_out has nothing to measure reachability from and is
+  // returned whole.
+  static PatchGraph eliminate_dead_nodes(const PatchGraph& graph,
+                                         std::vector<uint32_t>* removed = nullptr);
+  // Evaluates every stateless node (see ModuleInfo::stateless) whose inputs
+  // are all mono constants, unconnected, or fed by nodes folded before it,
+  // by running its own module code once. A node whose inputs are all given
+  // by its own data is a parameter source and is never folded, so
+  // VM::set_parameter can still reach it. When each output is the same in
+  // every sample, the node is removed and the ports it fed take the value
+  // as a constant instead, so whole constant subgraphs collapse into
+  // LOAD_Ks. Folded node IDs are appended to folded, if given. As with
+  // eliminate_dead_nodes, a graph with no audio_out is returned whole: its
+  // registers are the only output there is.
+  static PatchGraph fold_constants(const PatchGraph& graph, const ModuleRegistry& registry,
+                                   std::vector<uint32_t>* folded = nullptr);
+  // Common subexpression elimination: of the stateless nodes that run the
+  // same module on the same voices with the same constants and the same
+  // input connections, only the first in execution order is kept, and the
+  // readers of the others read it instead. Merging runs to a fixed point in
+  // one topological pass, since a node's inputs are matched through the
+  // nodes already merged. Merged node IDs are appended to merged, if given.
+  // A graph with no audio_out is returned whole.
+  static PatchGraph merge_duplicates(const PatchGraph& graph, const ModuleRegistry& registry,
+                                     std::vector<uint32_t>* merged = nullptr);
+  // Groups the nodes into dependency levels: level 0 holds the nodes with no
+  // inputs, and every other node sits one level after its deepest input.
+  // Nodes within a level are independent and keep their topological order.
+  static std::vector<std::vector<uint32_t>> dependency_levels(const PatchGraph& graph);
+  // Splits the patch into independent partitions that can run on separate
+  // VMs. The final mix -- audio_out and the plain two-input add nodes that
+  // feed only it -- is removed, and the remaining nodes are grouped into
+  // weakly connected components. Each partition holds one component plus
+  // its own audio_out, fed directly by the component's share of the mix, so
+  // summing the partitions' outputs reproduces the original patch. A patch
+  // that does not split is returned whole.
+  static std::vector<PatchGraph> partition(const PatchGraph& graph);
+  // Cuts the execution order compile() uses into num_stages contiguous
+  // pipeline stages, minimising the cost of the most expensive stage.
+  // node_costs maps node IDs to measured cost (see
+  // Program::measure_node_costs); unmeasured nodes count as 1. Returns the
+  // first node of every stage after the first.
+  static std::vector<uint32_t> pipeline_cuts(const PatchGraph& graph, size_t num_stages,
+                                             const std::map<uint32_t, float>& node_costs);
+  // Compiles the patch graph into a bytecode buffer. Dead nodes are removed
+  // first (see eliminate_dead_nodes), then the passes enabled in options
+  // run; report, if given, lists what they removed. Levels are emitted in
+  // order, separated by BARRIER instructions. A STAGE instruction is
+  // emitted before each node listed in stage_starts, which makes the
+  // program run as a pipeline; starts naming a removed node are dropped.
+  // Output registers are reused once their last reader's level is over,
+  // so the register file tracks the widest point of the patch rather than
+  // its size; constants keep their own registers.
+  static std::vector<uint32_t> compile(const PatchGraph& graph, const ModuleRegistry& registry,
+                                       const std::vector<uint32_t>& stage_starts = {},
+                                       CompileReport* report = nullptr,
+                                       const CompileOptions& options = {});
 };
 } // namespace madronavm 
\ No newline at end of file
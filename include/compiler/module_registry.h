@@ -10,6 +10,17 @@ namespace madronavm {
 struct ModuleInfo {
     std::vector<std::string> inputs;
     std::vector<std::string> outputs;
+    // Has a variant that processes every voice of a polyphonic cable in one
+    // call ("poly": true in data/modules.json).
+    bool poly = false;
+    // Rewrites only the output samples that change, relying on its output
+    // registers keeping their contents between blocks, so the compiler
+    // never shares them ("retains_outputs": true).
+    bool retains_outputs = false;
+    // Output depends only on the current inputs: no state carried between
+    // blocks and no sample rate, so the compiler may evaluate it itself
+    // ("stateless": true).
+    bool stateless = false;
 };
 // A registry to map module names to stable IDs and provide metadata.
 class ModuleRegistry {
@@ -19,6 +30,10 @@ public:
     uint32_t get_id(const std::string& name) const;
     // Gets the port information for a given module name. Throws if not found.
     const ModuleInfo& get_info(const std::string& name) const;
+    // Gets the module name for a stable ID. Throws if not found.
+    const std::string& get_name(uint32_t id) const;
+    // Gets the names of every registered module, in alphabetical order.
+    std::vector<std::string> get_names() const;
 private:
     std::map<std::string, uint32_t> name_to_id;
     std::map<std::string, ModuleInfo> name_to_info;
@@ -31,7 +31,7 @@ public:
   }
   unsigned int getCurrentDevice() const { return mDeviceId; }
 private:
-  void audioCallback(ml::AudioContext* ctx);
+  void audioCallback(float** outputs, int num_frames);
   std::unique_ptr<ml::AudioContext> mContext;
   std::unique_ptr<ml::CustomAudioTask> mCustomAudioTask;
   std::function<void(float**, int)> vmCallback_;
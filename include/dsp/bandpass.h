@@ -1,13 +1,13 @@
 #pragma once
 #include "dsp/module.h"
+#include "MLDSPFilters.h"
 namespace madronavm::dsp {
 class Bandpass : public DSPModule {
 public:
   explicit Bandpass(float sampleRate);
-  ~Bandpass() override;
+  ~Bandpass() override = default;
   void process(const float **inputs, int num_inputs, float **outputs, int num_outputs) override;
 private:
-  struct impl;
-  impl* pImpl;
+  ml::Bandpass mFilter;
 };
 } // namespace madronavm::dsp 
\ No newline at end of file
@@ -1,14 +1,13 @@
 #pragma once
 #include "dsp/module.h"
-#include <memory>
+#include "MLDSPFilters.h"
 namespace madronavm::dsp {
 class Biquad : public DSPModule {
 public:
   explicit Biquad(float sampleRate);
-  ~Biquad() override;
+  ~Biquad() override = default;
   void process(const float** inputs, int num_inputs, float** outputs, int num_outputs) override;
 private:
-  struct Impl;
-  std::unique_ptr<Impl> pImpl;
+  ml::Lopass mFilter;
 };
 } // namespace madronavm::dsp 
\ No newline at end of file
@@ -1,13 +1,13 @@
 #pragma once
 #include "dsp/module.h"
+#include "MLDSPFilters.h"
 namespace madronavm::dsp {
 class Hipass : public DSPModule {
 public:
   explicit Hipass(float sampleRate);
-  ~Hipass() override;
+  ~Hipass() override = default;
   void process(const float **inputs, int num_inputs, float **outputs, int num_outputs) override;
 private:
-  struct impl;
-  impl* pImpl;
+  ml::Hipass mFilter;
 };
 } // namespace madronavm::dsp 
\ No newline at end of file
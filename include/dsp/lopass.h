@@ -1,13 +1,13 @@
 #pragma once
 #include "dsp/module.h"
+#include "MLDSPFilters.h"
 namespace madronavm::dsp {
 class Lopass : public DSPModule {
 public:
   explicit Lopass(float sampleRate);
-  ~Lopass() override;
+  ~Lopass() override = default;
   void process(const float **inputs, int num_inputs, float **outputs, int num_outputs) override;
 private:
-  struct impl;
-  impl* pImpl;
+  ml::Lopass mFilter;
 };
 } // namespace madronavm::dsp 
\ No newline at end of file
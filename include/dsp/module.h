@@ -1,7 +1,11 @@
 #pragma once
 #include <cstddef>
 #include "MLDSPGens.h"
+namespace ml {
+struct Event;
+}
 namespace madronavm::dsp {
+class ActiveLanes;
 class DSPModule {
 public:
   explicit DSPModule(float sampleRate);
@@ -10,6 +14,18 @@ public:
   // inputs: An array of pointers to input buffers.
   // outputs: An array of pointers to output buffers.
   virtual void process(const float** inputs, int num_inputs, float** outputs, int num_outputs) = 0;
+  // Receives an event posted to this module's node with VM::post_event.
+  // Called on the audio thread at the start of a block, before process();
+  // must not allocate. Modules without events ignore them.
+  virtual void handle_event(const ml::Event& /*event*/) {}
+  // The lanes of its polyphonic outputs that carry a voice in the latest
+  // block, for a module that allocates voices; null for every other module.
+  virtual const ActiveLanes* active_lanes() const { return nullptr; }
+  // Points a polyphonic module at the active_lanes() of the voice allocator
+  // upstream of it, or null to run every lane. The set is read in each
+  // process(), so the allocator must run first in the same block. Modules
+  // that always run every lane ignore it.
+  virtual void follow_lanes(const ActiveLanes* /*lanes*/) {}
 protected:
   float mSampleRate;
 };
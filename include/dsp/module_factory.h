@@ -0,0 +1,37 @@
+#pragma once
+#include "dsp/module.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+namespace madronavm::dsp {
+// Size and construction hooks for one module type, so callers can place
+// modules into their own storage (see vm/module_pool.h).
+struct ModuleDescriptor {
+  uint32_t id;
+  size_t size;
+  size_t alignment;
+  // A polyphonic variant keeps lane_size bytes of state per lane, from
+  // lane_offset bytes into its storage; 0 for modules without lane state.
+  size_t lane_offset;
+  size_t lane_size;
+  // Constructs the module in place, for `lanes` lanes. storage must hold
+  // storage_size(lanes) bytes at alignment.
+  DSPModule* (*construct)(void* storage, float sampleRate, size_t lanes);
+  // Move-constructs a module in place from source, which must be of this
+  // same type and, with lane state, run as many lanes, carrying over its
+  // signal state. Does not allocate, so it may run on the audio thread.
+  // Null for types that cannot be moved.
+  DSPModule* (*relocate)(void* storage, DSPModule& source);
+  size_t storage_size(size_t lanes) const { return lane_size ? lane_offset + lanes * lane_size : size; }
+};
+// Added to a module ID to name the module's polyphonic variant, which
+// PROC_POLY runs: one instance processes every lane of its cables.
+constexpr uint32_t kPolyVariant = 0x10000;
+// Looks up the descriptor for a stable module ID from data/modules.json.
+// Throws std::runtime_error for unknown IDs.
+const ModuleDescriptor& get_module_descriptor(uint32_t module_id);
+// Creates the DSPModule implementation for a stable module ID on the heap.
+// Throws std::runtime_error for unknown IDs and for modules with lane
+// state, which only a ModulePool places.
+std::unique_ptr<DSPModule> create_module(uint32_t module_id, float sampleRate);
+} // namespace madronavm::dsp
@@ -1,13 +1,13 @@
 #pragma once
 #include "dsp/module.h"
+#include "MLDSPGens.h"
 namespace madronavm::dsp {
 class PhasorGen : public DSPModule {
 public:
   explicit PhasorGen(float sampleRate);
-  ~PhasorGen() override;
+  ~PhasorGen() override = default;
   void process(const float **inputs, int num_inputs, float **outputs, int num_outputs) override;
 private:
-  struct impl;
-  impl* pImpl;
+  ml::PhasorGen mPhasor;
 };
 } // namespace madronavm::dsp 
\ No newline at end of file
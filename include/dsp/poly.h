@@ -0,0 +1,112 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <new>
+#include <utility>
+#include "common/embedded_logging.h"
+#include "dsp/module.h"
+#include "dsp/validation.h"
+namespace madronavm::dsp {
+// Most voices one polyphonic cable can carry.
+constexpr size_t kMaxPolyLanes = 128;
+// A set of lanes, as a voice allocator publishes the voices it is using.
+class ActiveLanes {
+public:
+  void clear() { mWords = {}; }
+  void insert(size_t lane) { mWords[lane / 64] |= uint64_t(1) << (lane % 64); }
+  bool contains(size_t lane) const { return (mWords[lane / 64] >> (lane % 64)) & 1; }
+private:
+  std::array<uint64_t, kMaxPolyLanes / 64> mWords{};
+};
+// One State per lane of a poly module, in storage the module pool places
+// right after the module (see ModuleDescriptor::lane_size), so a module
+// holds state for the lanes its program runs rather than for
+// kMaxPolyLanes. Does not own the storage.
+template <typename State>
+class LaneStates {
+public:
+  // Default-constructs `lanes` states in storage, which must hold that many
+  // States and be aligned for them.
+  LaneStates(void* storage, size_t lanes) : mStates(static_cast<State*>(storage)), mSize(lanes) {
+    for (size_t lane = 0; lane < mSize; ++lane) {
+      new (&mStates[lane]) State();
+    }
+  }
+  // Moves other's states into storage, sized as above, for relocation.
+  LaneStates(LaneStates&& other, void* storage) : mStates(static_cast<State*>(storage)), mSize(other.mSize) {
+    for (size_t lane = 0; lane < mSize; ++lane) {
+      new (&mStates[lane]) State(std::move(other.mStates[lane]));
+    }
+  }
+  LaneStates(const LaneStates&) = delete;
+  LaneStates& operator=(const LaneStates&) = delete;
+  ~LaneStates() {
+    for (size_t lane = 0; lane < mSize; ++lane) {
+      mStates[lane].~State();
+    }
+  }
+  State& operator[](size_t lane) { return mStates[lane]; }
+  size_t size() const { return mSize; }
+  State* begin() { return mStates; }
+  State* end() { return mStates + mSize; }
+private:
+  State* mStates;
+  size_t mSize;
+};
+// Base of the polyphonic module variants. Downstream of a voice allocator
+// a poly module follows its ActiveLanes and skips the idle voices' lanes.
+class PolyModule : public DSPModule {
+public:
+  using DSPModule::DSPModule;
+  void follow_lanes(const ActiveLanes* lanes) override { mFollowed = lanes; }
+protected:
+  // Whether to process lane this block. A skipped lane's output is zeroed
+  // instead, since the compiler may have let another node write its
+  // register earlier in the block. Every poly module has one output port,
+  // so its lane is outputs[lane].
+  bool run_lane(int lane, float** outputs) const {
+    if (!mFollowed || mFollowed->contains(lane)) {
+      return true;
+    }
+    for (int i = 0; i < kFloatsPerDSPVector; ++i) {
+      outputs[lane][i] = 0.0f;
+    }
+    return false;
+  }
+private:
+  const ActiveLanes* mFollowed = nullptr;
+};
+// Checks the ports of a polyphonic module, which PROC_POLY hands one
+// pointer per port and lane, lane-major: inputs[port * lanes + lane].
+// Every poly module has a single output port, so the output count is the
+// lane count, which must not exceed max_lanes, the lanes the module keeps
+// state for. Returns the lanes, or 0 if the ports are unusable, in which
+// case the outputs are silenced. Like validate_ports, it must not allocate.
+inline int validate_poly_ports(int num_inputs, const float** inputs, std::initializer_list<int> required_inputs,
+                               int num_outputs, float** outputs, size_t max_lanes = kMaxPolyLanes) {
+    const int lanes = num_outputs;
+    if (lanes < 1 || lanes > static_cast<int>(max_lanes)) {
+        MADRONA_DSP_LOG_ERROR("Poly lanes out of range: got=%u max=%u",
+                              (uint32_t)num_outputs, (uint32_t)max_lanes);
+        silence_outputs(num_outputs, outputs);
+        return 0;
+    }
+    for (int idx : required_inputs) {
+        if ((idx + 1) * lanes > num_inputs) {
+            MADRONA_DSP_LOG_ERROR("Missing input connection: idx=%u", (uint32_t)idx);
+            silence_outputs(num_outputs, outputs);
+            return 0;
+        }
+        for (int lane = 0; lane < lanes; ++lane) {
+            if (inputs[idx * lanes + lane] == nullptr) {
+                MADRONA_DSP_LOG_ERROR("Missing input connection: idx=%u", (uint32_t)idx);
+                silence_outputs(num_outputs, outputs);
+                return 0;
+            }
+        }
+    }
+    return lanes;
+}
+} // namespace madronavm::dsp
@@ -0,0 +1,17 @@
+#pragma once
+#include "dsp/module.h"
+#include "dsp/poly.h"
+#include "MLDSPFilters.h"
+namespace madronavm::dsp {
+// Polyphonic variant of ADSR: one envelope per lane.
+class PolyADSR : public PolyModule {
+public:
+  using LaneState = ml::ADSR;
+  PolyADSR(float sampleRate, void* laneStorage, size_t lanes);
+  PolyADSR(PolyADSR&& other, void* laneStorage);
+  ~PolyADSR() override = default;
+  void process(const float** inputs, int num_inputs, float** outputs, int num_outputs) override;
+private:
+  LaneStates<LaneState> mADSRs;
+};
+} // namespace madronavm::dsp
@@ -0,0 +1,12 @@
+#pragma once
+#include "dsp/module.h"
+#include "dsp/poly.h"
+namespace madronavm::dsp {
+// Polyphonic variant of Gain. Stateless, so any lane count works.
+class PolyGain : public PolyModule {
+public:
+  explicit PolyGain(float sampleRate);
+  ~PolyGain() override = default;
+  void process(const float **inputs, int num_inputs, float **outputs, int num_outputs) override;
+};
+} // namespace madronavm::dsp
@@ -0,0 +1,17 @@
+#pragma once
+#include "dsp/module.h"
+#include "dsp/poly.h"
+#include "MLDSPFilters.h"
+namespace madronavm::dsp {
+// Polyphonic variant of Lopass: one filter state per lane.
+class PolyLopass : public PolyModule {
+public:
+  using LaneState = ml::Lopass;
+  PolyLopass(float sampleRate, void* laneStorage, size_t lanes);
+  PolyLopass(PolyLopass&& other, void* laneStorage);
+  ~PolyLopass() override = default;
+  void process(const float **inputs, int num_inputs, float **outputs, int num_outputs) override;
+private:
+  LaneStates<LaneState> mFilters;
+};
+} // namespace madronavm::dsp
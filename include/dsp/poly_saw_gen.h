@@ -0,0 +1,17 @@
+#pragma once
+#include "dsp/module.h"
+#include "dsp/poly.h"
+#include "MLDSPGens.h"
+namespace madronavm::dsp {
+// Polyphonic variant of SawGen: one oscillator per lane.
+class PolySawGen : public PolyModule {
+public:
+  using LaneState = ml::SawGen;
+  PolySawGen(float sampleRate, void* laneStorage, size_t lanes);
+  PolySawGen(PolySawGen&& other, void* laneStorage);
+  ~PolySawGen() override = default;
+  void process(const float** inputs, int num_inputs, float** outputs, int num_outputs) override;
+private:
+  LaneStates<LaneState> mOscs;
+};
+} // namespace madronavm::dsp
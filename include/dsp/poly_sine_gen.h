@@ -0,0 +1,17 @@
+#pragma once
+#include "dsp/module.h"
+#include "dsp/poly.h"
+#include "MLDSPGens.h"
+namespace madronavm::dsp {
+// Polyphonic variant of SineGen: one oscillator per lane.
+class PolySineGen : public PolyModule {
+public:
+  using LaneState = ml::SineGen;
+  PolySineGen(float sampleRate, void* laneStorage, size_t lanes);
+  PolySineGen(PolySineGen&& other, void* laneStorage);
+  ~PolySineGen() override = default;
+  void process(const float** inputs, int num_inputs, float** outputs, int num_outputs) override;
+private:
+  LaneStates<LaneState> mOscs;
+};
+} // namespace madronavm::dsp
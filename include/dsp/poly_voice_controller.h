@@ -0,0 +1,12 @@
+#pragma once
+#include "dsp/voice_controller.h"
+namespace madronavm::dsp {
+// VoiceController as a VM module: its outputs are the polyphonic cables
+// gate, pitch, velocity, ... of modules.json, one lane per voice, so its
+// polyphony is the node's voice count. Notes arrive through VM::post_event.
+class PolyVoiceController : public VoiceController {
+public:
+  explicit PolyVoiceController(float sampleRate) : VoiceController(sampleRate, true) {}
+  ~PolyVoiceController() override = default;
+};
+} // namespace madronavm::dsp
@@ -1,14 +1,13 @@
 #pragma once
 #include "dsp/module.h"
-#include <memory>
+#include "MLDSPGens.h"
 namespace madronavm::dsp {
 class SawGen : public DSPModule {
 public:
   explicit SawGen(float sampleRate);
-  ~SawGen() override;
+  ~SawGen() override = default;
   void process(const float** inputs, int num_inputs, float** outputs, int num_outputs) override;
 private:
-  struct Impl;
-  std::unique_ptr<Impl> pImpl;
+  ml::SawGen mOsc;
 };
 } // namespace madronavm::dsp 
\ No newline at end of file
@@ -5,10 +5,9 @@ namespace madronavm::dsp {
 class SineGen : public DSPModule {
 public:
   explicit SineGen(float sampleRate);
-  ~SineGen() override;
+  ~SineGen() override = default;
   void process(const float **inputs, int num_inputs, float **outputs, int num_outputs) override;
 private:
-  struct impl;
-  impl* pImpl;
+  ml::SineGen mOsc;
 };
 } // namespace madronavm::dsp
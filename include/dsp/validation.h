@@ -1,20 +1,38 @@
 #pragma once
-#include <vector>
+#include <initializer_list>
 #include "common/embedded_logging.h"
+#include "dsp/module.h"
 namespace madronavm::dsp {
+// Writes silence to every output. The compiler shares registers between
+// nodes whose values are not live at the same time, so a module that
+// cannot run must not leave an earlier node's samples in its outputs.
+inline void silence_outputs(int num_outputs, float** outputs) {
+    for (int port = 0; port < num_outputs; ++port) {
+        if (outputs[port]) {
+            for (int i = 0; i < kFloatsPerDSPVector; ++i) {
+                outputs[port][i] = 0.0f;
+            }
+        }
+    }
+}
 // A helper to verify that a module has the minimum required number
-// of output ports and that all required inputs are non-null.
+// of output ports and that all required inputs are non-null. On failure
+// the outputs are silenced.
+// Called from every DSPModule::process, so it must not allocate: the
+// required input indices are taken as an initializer_list, not a vector.
 inline bool validate_ports(const char* module_name,
-                           int num_inputs, const float** inputs, const std::vector<int>& required_inputs,
-                           int num_outputs, int required_outputs) {
+                           int num_inputs, const float** inputs, std::initializer_list<int> required_inputs,
+                           int num_outputs, float** outputs, int required_outputs) {
     if (num_outputs < required_outputs) {
         MADRONA_DSP_LOG_ERROR("Port mismatch: req=%u got=%u", 
                               (uint32_t)required_outputs, (uint32_t)num_outputs);
+        silence_outputs(num_outputs, outputs);
         return false;
     }
     for (int idx : required_inputs) {
         if (idx >= num_inputs || inputs[idx] == nullptr) {
             MADRONA_DSP_LOG_ERROR("Missing input connection: idx=%u", (uint32_t)idx);
+            silence_outputs(num_outputs, outputs);
             return false;
         }
     }
@@ -1,23 +1,137 @@
 #pragma once
 #include "dsp/module.h"
+#include "dsp/poly.h"
 #include "MLEventsToSignals.h"
-#include <vector>
 #include <array>
+#include <cstdint>
 namespace madronavm::dsp {
+// Turns note events into per-voice control signals, laid out like
+// ml::EventsToSignals voice outputs: voice v's row r is output
+// v * kNumOutputsPerVoice + r.
+//
+// Polyphony is set at run time, up to kMaxVoices. Voices that are sounding
+// or releasing sit in a compact active list, and process() only touches
+// those: an idle voice's outputs are zeroed once, when it goes idle, and
+// then left alone, so they must persist between blocks (VM registers do).
+//
+// The voices busy in each block are published as active_lanes(), so the
+// poly modules fed by the controller skip the idle voices too. A voice
+// stays busy for the release time after its note off; the optional input
+// sets that time in seconds, and should cover the release of the envelopes
+// downstream, which are cut off once their voice is idle.
+//
+// Besides notes it takes the performance events below, on any channel,
+// each from its sample in the block like a note:
+//   kPitchWheel       value1 bend in [-1, 1]: pitch moves by value1 times
+//                     the bend range, and the x row carries value1.
+//   kNotePressure     value1 pitch, value2 pressure in [0, 1], for the
+//                     voice playing that pitch: its aftertouch and z rows.
+//   kChannelPressure  value1 pressure, for every voice, as above.
+//   kController       value1 controller number, value2 value in [0, 1]:
+//                     1 (mod wheel) is the mod row, 74 (timbre) the y row
+//                     and 64 the sustain pedal.
+//   kSustainPedal     value1 >= 0.5 holds the pedal down: note offs keep
+//                     their gate open until it is released.
+// Other event types and controllers are dropped, and counted in
+// numIgnoredEvents().
+//
+// Everything here runs on the audio thread. Other threads send notes
+// through VM::post_event, which delivers them to handle_event().
 class VoiceController : public DSPModule {
 public:
-  static constexpr size_t kMaxVoices = 8;
+  static constexpr size_t kMaxVoices = 128;
+  static constexpr size_t kDefaultPolyphony = 8;
   static constexpr size_t kNumOutputsPerVoice = ml::kNumVoiceOutputRows;
+  // Events one block can apply at their own sample; beyond that, earlier
+  // ones take effect at the start of the block.
+  static constexpr size_t kMaxEventsPerBlock = 256;
   explicit VoiceController(float sampleRate);
   ~VoiceController() override = default;
   void process(const float **inputs, int num_inputs, float **outputs,
                int num_outputs) override;
-  // Control interface
+  // Queues an event for the next process(), which applies it at sample
+  // event.time of the block.
+  void handle_event(const ml::Event& event) override;
+  // The voices active in the latest block, including those that went idle
+  // part way through it.
+  const ActiveLanes* active_lanes() const override { return &mBusy; }
+  // Control interface; time is the sample offset in the next block.
   void noteOn(int pitch, int velocity, int voice = 0, int time = 0);
   void noteOff(int pitch, int velocity, int voice = 0, int time = 0);
-  ml::EventsToSignals &getEventProcessor() { return mEventProcessor; }
+  // Voices available to new notes, clamped to [1, kMaxVoices]. Voices above
+  // the new count are freed and silenced at the next process().
+  void setPolyphony(size_t voices);
+  size_t getPolyphony() const { return mPolyphony; }
+  // How long a voice stays active after its note off, to cover the release
+  // of the envelope it drives. 0 frees it at the note off. A connected
+  // release input overrides it every block.
+  void setReleaseTime(float seconds);
+  // Semitones the pitch moves at full pitch bend; 2 by default.
+  void setPitchBendRange(float semitones) { mBendRange = semitones; }
+  // Events of a type or controller this class does not handle.
+  size_t numIgnoredEvents() const { return mNumIgnored; }
+  // Indices of the active voices, in no particular order.
+  const uint8_t* activeVoices() const { return mActive.data(); }
+  size_t numActiveVoices() const { return mNumActive; }
+  bool isActive(size_t voice) const { return mVoices[voice].active; }
+protected:
+  // With laneMajor, voice v's row r is output r * voices + v instead, as
+  // PROC_POLY lays out a module's polyphonic output ports, and polyphony
+  // follows the number of outputs.
+  VoiceController(float sampleRate, bool laneMajor);
 private:
-  ml::EventsToSignals mEventProcessor;
-  std::vector<ml::Event> mEventQueue;
+  struct Voice {
+    int pitch = -1;
+    float velocity = 0.0f;
+    float pressure = 0.0f;
+    bool gate = false;
+    // Note off received while the sustain pedal was down.
+    bool sustained = false;
+    bool active = false;
+    // Listed in mStale: went idle and its outputs are yet to be zeroed.
+    bool stale = false;
+    // Sample of the current block at which it went idle.
+    int idle_from = 0;
+    // Sample clock at the note on, for elapsed time and voice stealing.
+    uint64_t start = 0;
+    // Samples of release left after the note off.
+    int64_t release_left = 0;
+  };
+  void applyEvent(const ml::Event& event, int offset);
+  void startNote(const ml::Event& e, int offset);
+  void endNote(const ml::Event& e, int offset);
+  void releaseVoice(size_t voice, int offset);
+  void setSustain(bool down, int offset);
+  size_t chooseVoice(int pitch) const;
+  void activate(size_t voice);
+  void deactivate(size_t voice, int offset = 0);
+  void render(float **outputs, int num_outputs, int begin, int end) const;
+  void writeVoice(size_t voice, float **outputs, int num_outputs, int begin, int end) const;
+  size_t outputIndex(size_t voice, size_t row, int num_outputs) const;
+  std::array<Voice, kMaxVoices> mVoices;
+  // mActive[0, mNumActive) lists the active voices; mActiveIndex maps a
+  // voice back to its position there, for O(1) removal.
+  std::array<uint8_t, kMaxVoices> mActive{};
+  std::array<uint8_t, kMaxVoices> mActiveIndex{};
+  size_t mNumActive = 0;
+  // Voices that went idle since the last process().
+  std::array<uint8_t, kMaxVoices> mStale{};
+  size_t mNumStale = 0;
+  ActiveLanes mBusy;
+  size_t mPolyphony = kDefaultPolyphony;
+  int64_t mReleaseSamples = 0;
+  // Controller-wide performance state.
+  float mBend = 0.0f;
+  float mBendRange = 2.0f;
+  float mModulation = 0.0f;
+  float mTimbre = 0.0f;
+  float mChannelPressure = 0.0f;
+  bool mSustain = false;
+  size_t mNumIgnored = 0;
+  uint64_t mClock = 0;
+  // Events for the next process(), in arrival order.
+  std::array<ml::Event, kMaxEventsPerBlock> mEvents{};
+  size_t mNumEvents = 0;
+  bool mLaneMajor = false;
 };
-} // namespace madronavm::dsp 
\ No newline at end of file
+} // namespace madronavm::dsp
@@ -0,0 +1,12 @@
+#pragma once
+#include "dsp/module.h"
+namespace madronavm::dsp {
+// Sums the lanes of a polyphonic cable into one mono signal. The compiler
+// passes one input per voice; null inputs are skipped.
+class VoiceMix : public DSPModule {
+public:
+  explicit VoiceMix(float sampleRate);
+  ~VoiceMix() override = default;
+  void process(const float **inputs, int num_inputs, float **outputs, int num_outputs) override;
+};
+} // namespace madronavm::dsp
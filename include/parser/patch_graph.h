@@ -8,12 +8,17 @@ namespace madronavm {
 struct ConstantInput {
   std::string port_name;
   float value;
+  // One value per voice for a polyphonic constant, written as a JSON array;
+  // empty for a plain constant.
+  std::vector<float> voice_values;
 };
 // Represents a single DSP module instance in the graph.
 struct Node {
   uint32_t id;
   std::string name; // e.g., "sine_gen"
   std::vector<ConstantInput> constants;
+  // Voices the node runs at least; polyphonic inputs may raise it.
+  uint32_t voices = 1;
 };
 // Represents a connection between two nodes.
 struct Connection {
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+namespace madronavm {
+// How a program's memory is obtained. Every arena is cache-line aligned and
+// prefaulted, so the first block after a load takes no page faults.
+struct MemoryOptions {
+  // Asks for transparent huge pages (Linux madvise); the arena is then
+  // aligned to a huge page and rounded up to whole ones.
+  bool huge_pages = false;
+  // Locks the arena into RAM with mlock, so it cannot be paged out while
+  // the program runs. Best effort: a low RLIMIT_MEMLOCK leaves it unlocked.
+  bool lock = false;
+};
+// One zeroed, cache-line aligned block of memory holding a program's
+// registers and module state, allocated and touched on the control thread.
+class MemoryArena {
+public:
+  static constexpr size_t kCacheLineSize = 64;
+  static constexpr size_t kHugePageSize = size_t(2) << 20;
+  MemoryArena() = default;
+  ~MemoryArena();
+  MemoryArena(const MemoryArena&) = delete;
+  MemoryArena& operator=(const MemoryArena&) = delete;
+  // Releases any current block, then allocates `bytes` and writes every
+  // page. Throws std::bad_alloc on failure, leaving the arena empty.
+  void allocate(size_t bytes, const MemoryOptions& options = {});
+  void release();
+  void* data() const { return m_data; }
+  size_t size() const { return m_size; }
+  // Whether huge pages were requested and granted the advice, and whether
+  // the lock succeeded.
+  bool huge_pages() const { return m_huge_pages; }
+  bool locked() const { return m_locked; }
+private:
+  void* m_data = nullptr;
+  size_t m_size = 0;
+  // The mapping m_data lies in, when it is wider for alignment.
+  void* m_mapping = nullptr;
+  size_t m_mapping_size = 0;
+  bool m_huge_pages = false;
+  bool m_locked = false;
+};
+} // namespace madronavm
@@ -0,0 +1,52 @@
+#pragma once
+#include "dsp/module.h"
+#include "dsp/module_factory.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+namespace madronavm {
+// Contiguous storage for the DSPModule instances of one program. Modules are
+// placed in slot order, which the compiler assigns in execution order, and
+// each starts on its own cache line, so a block walks module state front to
+// back instead of chasing unrelated heap objects. The pool does not own its
+// storage: the program places it in the same arena as its registers.
+class ModulePool {
+public:
+  static constexpr size_t kCacheLineSize = 64;
+  ModulePool() = default;
+  ~ModulePool();
+  ModulePool(const ModulePool&) = delete;
+  ModulePool& operator=(const ModulePool&) = delete;
+  // Destroys any current modules, then lays out one module per entry of
+  // module_ids, slot i holding module_ids[i] running lanes[i] lanes (1 if
+  // lanes is shorter), and returns the bytes of storage build() needs,
+  // aligned to alignment(). A polyphonic variant's per-lane state follows
+  // it in its slot. Throws std::runtime_error for unknown module IDs,
+  // leaving the pool empty.
+  size_t plan(const std::vector<uint32_t>& module_ids, const std::vector<uint32_t>& lanes = {});
+  size_t alignment() const { return m_alignment; }
+  // Constructs the planned modules in storage, which must stay valid until
+  // clear(). Every slot is constructed except those flagged in `deferred`,
+  // which only get storage and must be filled later with relocate() or
+  // construct(). On a constructor's exception the pool is cleared.
+  void build(void* storage, float sampleRate, const std::vector<bool>& deferred = {});
+  // Fills a deferred slot by moving source, a module of the slot's type,
+  // into it. Does not allocate.
+  void relocate(size_t slot, dsp::DSPModule& source);
+  // Fills a deferred slot with a freshly constructed module.
+  void construct(size_t slot, float sampleRate);
+  void clear();
+  size_t size() const { return m_modules.size(); }
+  // Null for a deferred slot that has not been filled yet.
+  dsp::DSPModule* get(size_t slot) const { return m_modules[slot]; }
+  const dsp::ModuleDescriptor& descriptor(size_t slot) const { return *m_descriptors[slot]; }
+private:
+  void* slot_storage(size_t slot) const { return static_cast<char*>(m_storage) + m_offsets[slot]; }
+  void* m_storage = nullptr;
+  size_t m_alignment = kCacheLineSize;
+  std::vector<const dsp::ModuleDescriptor*> m_descriptors;
+  std::vector<size_t> m_offsets;
+  std::vector<uint32_t> m_lanes;
+  std::vector<dsp::DSPModule*> m_modules;
+};
+} // namespace madronavm
@@ -4,14 +4,64 @@ namespace madronavm {
 // Using an enum class for type safety. The underlying type is uint32_t.
 enum class OpCode : uint32_t {
     NO_OP = 0x00,
-    LOAD_K = 0x01,      // dest_reg, value
-    PROC = 0x02,        // node_id, module_id, num_inputs, num_outputs, [in_regs...], [out_regs...]
+    LOAD_K = 0x01,      // dest_reg, value (applied once at load when nothing else writes dest_reg)
+    PROC = 0x02,        // node_id, module_id, slot, num_inputs, num_outputs, [in_regs...], [out_regs...]
     AUDIO_OUT = 0x03,   // num_inputs, [in_regs...]
+    BARRIER = 0x04,     // (none) ends a dependency level; nothing between two barriers depends on each other
+    STAGE = 0x05,       // (none) starts the next pipeline stage; stages run one block apart
+    PROC_POLY = 0x06,   // node_id, module_id, slot, lanes, num_inputs, num_outputs, [in_regs...], [out_regs...]
+    // Native arithmetic: run inline by the VM, with no module object. The
+    // node and module IDs only identify the node, e.g. for parameters.
+    ADD = 0x07,         // node_id, module_id, in_a, in_b, out: out = a + b
+    MUL = 0x08,         // node_id, module_id, in_a, in_b, out: out = a * b
+    CMP_GT = 0x09,      // node_id, module_id, in_a, in_b, out: out = a > b ? 1 : 0
+    SPLAT = 0x0A,       // node_id, module_id, in, out: every sample of out = in[0]
+    SPLAT_INT = 0x0B,   // node_id, module_id, in, out: like SPLAT, truncated to an integer
+    // A tree of arithmetic nodes fused into one pass over the block; see ExprOp.
+    EXPR = 0x0C,        // num_nodes, num_inputs, num_ops, out, [in_regs...], [ops...],
+                        // num_nodes x {node_id, module_id, num_ports, [port_regs...]}
+    // Superinstruction: a PROC followed by a MUL reading one of its outputs,
+    // dispatched once.
+    PROC_MUL = 0x0D,    // node_id, module_id, slot, num_inputs, num_outputs, [in_regs...], [out_regs...],
+                        // mul_node_id, mul_module_id, in_a, in_b, out
+    // A mono PROC of the most common shapes, N inputs and one output, with
+    // the counts implied by the opcode.
+    PROC_1x1 = 0x0E,    // node_id, module_id, slot, in, out
+    PROC_2x1 = 0x0F,    // node_id, module_id, slot, in_a, in_b, out
+    PROC_3x1 = 0x10,    // node_id, module_id, slot, [in_regs x 3], out
+    PROC_5x1 = 0x11,    // node_id, module_id, slot, [in_regs x 5], out
+    // Superinstruction: a PROC followed by an EXPR reading one of its
+    // outputs, dispatched once.
+    PROC_EXPR = 0x12,   // node_id, module_id, slot, num_inputs, num_outputs, [in_regs...], [out_regs...],
+                        // then the EXPR's words after its opcode
     END = 0xFF
 };
 // The magic number for identifying Madrona VM bytecode files.
 const uint32_t kMagicNumber = 0x41434142;
-const uint32_t kBytecodeVersion = 1;
+const uint32_t kBytecodeVersion = 9;
+// A polyphonic cable occupies `lanes` consecutive registers, one voice
+// each. In PROC_POLY, an input register with this bit set names the first
+// lane of such a cable; an input without it is a mono register shared by
+// every lane. Output registers always name the first lane.
+const uint32_t kPolyRegister = 0x80000000;
+// The program of an EXPR instruction, in postfix order, one word per
+// operation: the operation in the low bits and, for PUSH, the index of one
+// of the instruction's input registers above kExprOperandShift. Each binary
+// operation pops two values and pushes the result; the last one left is
+// the output. The node table after the program lists every node fused into
+// the instruction, with the input registers of its ports (null where a port
+// is fed from inside the tree), so the nodes stay addressable.
+enum class ExprOp : uint32_t {
+    PUSH = 0x00,
+    ADD = 0x01,
+    MUL = 0x02,
+    CMP_GT = 0x03,
+};
+const uint32_t kExprOperandShift = 8;
+const uint32_t kExprOpMask = (1u << kExprOperandShift) - 1;
+// EXPR evaluates on a fixed-size stack. The compiler fuses at most
+// kMaxExpressionDepth - 1 nodes into one, so it never needs more.
+const uint32_t kMaxExpressionDepth = 16;
 // The header at the beginning of every bytecode buffer.
 struct BytecodeHeader {
     uint32_t magic_number;
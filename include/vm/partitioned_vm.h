@@ -0,0 +1,96 @@
+#pragma once
+#include "vm/vm.h"
+#include "vm/worker_pool.h"
+#include "common/spsc_queue.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+namespace madronavm {
+// Runs a patch split by Compiler::partition as one VM per partition. Each
+// block, the partitions render side by side on a WorkerPool, one partition
+// per task with no synchronisation between them, and a final mix sums
+// their outputs into the host buffers.
+class PartitionedVM {
+public:
+  // Frames rendered per partition pass; longer host buffers take several.
+  static constexpr int kMaxFramesPerPass = 512;
+  PartitionedVM(const ModuleRegistry& registry, float sampleRate, bool testMode = false);
+  ~PartitionedVM();
+  // Loads one bytecode image per partition, the i-th into the VM of
+  // partition i, so nodes that stay in their partition keep their state as
+  // in VM::load_program. Everything is built on the calling thread; the
+  // audio thread switches every partition at the start of the same block,
+  // so no block mixes two patches. Safe to call while process() runs on
+  // another thread, but not concurrently with itself.
+  void load_partitions(const std::vector<std::vector<uint32_t>>& programs);
+  // Destroys what the audio thread has swapped out. load_partitions calls
+  // this itself; call it from the same thread.
+  void collect_retired_layouts();
+  // Partitions of the most recently loaded patch. Control thread only.
+  size_t num_partitions() const;
+  // Runs partitions on pool's workers and the calling thread; null (the
+  // default) renders them one after another. The pool is not owned. Takes
+  // effect at the next block.
+  void set_worker_pool(WorkerPool* pool);
+  // As VM::set_memory_options, for every partition loaded from now on.
+  void set_memory_options(const MemoryOptions& options) { m_memory_options = options; }
+  // As VM::post_event, to the partition that runs node node_id in the most
+  // recently loaded patch. Returns false if none does.
+  bool post_event(uint32_t node_id, const ml::Event& event);
+  // As VM::set_parameter, to the partition that runs node node_id.
+  bool set_parameter(uint32_t node_id, const std::string& port, float value, uint32_t ramp_blocks = 0);
+  // As VM::process: any num_frames; outputs holds one pointer per channel
+  // any partition writes, and a null entry ends the list.
+  void process(const float** inputs, float** outputs, int num_frames);
+private:
+  struct Partition {
+    VM* vm;
+    // The program this layout switches vm to, until the audio thread has
+    // handed it over.
+    Program* program;
+    // kMaxOutputChannels channels of kMaxFramesPerPass frames each.
+    std::vector<float> scratch;
+  };
+  // The partitions of one loaded patch. Swapped like VM's programs:
+  // load_partitions publishes a complete layout through m_pending_layout,
+  // the audio thread takes it at a block boundary and passes the one it
+  // replaced back through m_retired_layouts.
+  struct Layout {
+    std::vector<Partition> partitions;
+    // Widest output of any partition.
+    size_t num_output_channels = 0;
+    const Layout* replaced = nullptr;
+  };
+  struct PassContext {
+    Layout* layout;
+    size_t num_channels;
+    int num_frames;
+  };
+  // Takes the most recently published layout, if any, at the start of a
+  // block, and hands its programs to their VMs. Audio thread only; never
+  // allocates or frees.
+  void adopt_pending_layout();
+  // Destroys a layout that never reached the audio thread, with the
+  // programs it carries.
+  void discard_layout(Layout* layout);
+  static void render_partition(void* context, uint32_t index);
+  static float* scratch_channel(Partition& partition, size_t channel) {
+    return partition.scratch.data() + channel * kMaxFramesPerPass;
+  }
+  const ModuleRegistry& m_registry;
+  float m_sampleRate;
+  bool m_testMode;
+  MemoryOptions m_memory_options;
+  // One VM per partition index, kept across loads. Control thread only;
+  // layouts point into it.
+  std::vector<std::unique_ptr<VM>> m_vms;
+  std::atomic<Layout*> m_pending_layout{nullptr};
+  const Layout* m_published_layout = nullptr; // control thread only
+  Layout* m_active_layout = nullptr; // audio thread only
+  SpscQueue<Layout*, 8> m_retired_layouts;
+  std::atomic<WorkerPool*> m_worker_pool{nullptr};
+};
+} // namespace madronavm
@@ -0,0 +1,271 @@
+#pragma once
+#include "vm/memory_arena.h"
+#include "vm/module_pool.h"
+#include "vm/task_graph.h"
+#include "vm/worker_pool.h"
+#include "dsp/module.h"
+#include "DSP/MLDSPOps.h"
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+namespace madronavm {
+// How Program::run spreads a block over a WorkerPool.
+enum class Schedule {
+  // One dependency level at a time, with a barrier between levels.
+  kLevels,
+  // Each instruction as soon as its inputs are ready, on work-stealing
+  // deques, longest remaining path first.
+  kTaskGraph,
+};
+// Everything one loaded patch needs to run: the bytecode, its decoded
+// instruction stream, the registers and the module instances. A Program is
+// built completely on the control thread and handed to the audio thread
+// whole, so the VM can switch patches by exchanging a single pointer.
+class Program {
+public:
+  static constexpr size_t kMaxOutputChannels = 16;
+  // Validates and decodes the bytecode and constructs every module. On
+  // malformed bytecode the error is logged and the program is left empty;
+  // an empty program renders silence.
+  //
+  // If `previous` is given, modules whose node ID and module ID both match a
+  // module of `previous` are not constructed; take_state_from() moves the
+  // running instances over instead. previous is only read, so it may be
+  // running on the audio thread meanwhile.
+  //
+  // Registers and module state share one arena, allocated, zeroed and
+  // optionally locked here as `memory` asks, so the audio thread never
+  // faults a page of the program in.
+  Program(std::vector<uint32_t> bytecode, float sampleRate, const Program* previous = nullptr,
+          const MemoryOptions& memory = {});
+  Program(const Program&) = delete;
+  Program& operator=(const Program&) = delete;
+  bool empty() const { return m_bytecode.empty(); }
+  // Completes construction on the audio thread, at the swap, once `previous`
+  // has stopped running: moves each matched module out of previous so that
+  // oscillator phases, filter and envelope state carry across the reload.
+  // Must be called once before the first run(). Does not allocate when
+  // previous is the program this one was planned against.
+  void take_state_from(Program* previous);
+  // The `previous` program this one was built to replace.
+  const Program* replaced_program() const { return m_replaced; }
+  size_t num_migrated_modules() const { return m_num_migrated; }
+  // Constant registers are filled once at load rather than by a LOAD_K in
+  // every block. set_constant rewrites one, e.g. for a parameter change,
+  // taking effect from the next block. Returns false if reg does not hold a
+  // load-time constant. Audio thread only once the program is running.
+  bool set_constant(uint32_t reg, float value);
+  // Like set_constant, but moves linearly from the current value to value
+  // over the next ramp_blocks blocks, sample by sample, to avoid zipper
+  // noise. A new change replaces a ramp in progress, starting from where
+  // it has got to. ramp_blocks 0 jumps. Audio thread only; no allocation.
+  bool ramp_constant(uint32_t reg, float value, uint32_t ramp_blocks);
+  // Sets input `port` (its index in modules.json) of node node_id, on
+  // every lane of a polyphonic node, with ramp_constant. Returns false
+  // unless the port is fed by a load-time constant. Audio thread only.
+  bool set_parameter(uint32_t node_id, uint32_t port, float value, uint32_t ramp_blocks = 0);
+  size_t num_constants() const { return m_constants.size(); }
+  // The module running node node_id, or null if the program has none.
+  // Allocation free, for routing events on the audio thread; valid once
+  // take_state_from() has run.
+  dsp::DSPModule* module_for_node(uint32_t node_id) const;
+  // The module ID the bytecode gives node node_id, or UINT32_MAX if the
+  // program has no such node.
+  uint32_t module_id_for_node(uint32_t node_id) const;
+  // Runs every instruction once, producing one kFloatsPerDSPVector-frame
+  // vector. AUDIO_OUT channel i goes to outputs[i] unless that is null;
+  // outputs must hold num_output_channels() entries. Audio thread only.
+  // With a pool, instructions are spread over its workers as `schedule`
+  // says. A program compiled with pipeline stages ignores `schedule`: its
+  // stages always run side by side, each on a different block.
+  void run(float** outputs, WorkerPool* pool = nullptr, Schedule schedule = Schedule::kLevels);
+  // Pipeline stages, as delimited by STAGE in the bytecode; 1 for a program
+  // compiled without stages.
+  size_t num_stages() const { return m_stage_starts.empty() ? 1 : m_stage_starts.size() - 1; }
+  // Blocks by which the pipeline delays the output: the stage of the last
+  // AUDIO_OUT.
+  size_t latency_blocks() const { return m_latency_blocks; }
+  // Runs the program num_blocks times serially, timing each PROC, and
+  // returns the mean time per block of every node in nanoseconds, for
+  // Compiler::pipeline_cuts. Advances module state; meant for a scratch
+  // program built without `previous`, never one the audio thread runs.
+  std::map<uint32_t, float> measure_node_costs(int num_blocks);
+  // Dependency levels, as delimited by BARRIER in the bytecode.
+  size_t num_levels() const { return m_level_starts.empty() ? 0 : m_level_starts.size() - 1; }
+  // Widest AUDIO_OUT in the program; at most kMaxOutputChannels.
+  size_t num_output_channels() const { return m_num_output_channels; }
+  const std::vector<uint32_t>& bytecode() const { return m_bytecode; }
+  size_t num_registers() const { return m_num_registers; }
+  const ml::DSPVector& get_register(size_t index) const { return m_registers[index]; }
+  // Instruction dependencies for Schedule::kTaskGraph; task i is the i-th
+  // instruction run per block.
+  const TaskGraph& task_graph() const { return m_task_graph; }
+  const MemoryArena& arena() const { return m_arena; }
+private:
+  // A bytecode instruction decoded once at load. Register indices are
+  // resolved to buffer pointers and each instruction carries its own
+  // handler, so run() is a straight walk over this array.
+  struct Instruction;
+  using Handler = void (*)(const Instruction& instr, float** outputs);
+  struct Instruction {
+    Handler handler;
+    dsp::DSPModule* module; // PROC only, owned by m_module_pool; null for native opcodes
+    const float** inputs;   // points into m_input_ptrs
+    float** outputs;        // points into m_output_ptrs
+    uint32_t num_inputs;
+    uint32_t num_outputs;
+    float constant;         // LOAD_K only
+    uint32_t num_module_inputs; // PROC_EXPR only
+    const uint32_t* ops;    // EXPR and PROC_EXPR only: the program, in m_bytecode
+    uint32_t num_ops;
+  };
+  static void op_load_k(const Instruction& instr, float** outputs);
+  static void op_proc(const Instruction& instr, float** outputs);
+  // PROC_Nx1: the port counts are constants of the call.
+  template <uint32_t N>
+  static void op_proc_fixed(const Instruction& instr, float** outputs);
+  // The handler of a PROC with `arity` inputs and one output; op_proc for
+  // 0, the forms that carry their counts.
+  static Handler arity_handler(uint32_t arity);
+  // PROC_MUL: the module sees all but the last two inputs and the last
+  // output, which belong to the MUL that runs after it.
+  static void op_proc_mul(const Instruction& instr, float** outputs);
+  // PROC_EXPR: the module sees its first num_module_inputs inputs and all
+  // but the last output; the EXPR that runs after it sees the rest.
+  static void op_proc_expr(const Instruction& instr, float** outputs);
+  static void op_audio_out(const Instruction& instr, float** outputs);
+  // Native arithmetic: fixed-length loops straight over the registers,
+  // which the compiler vectorises.
+  static void op_add(const Instruction& instr, float** outputs);
+  static void op_mul(const Instruction& instr, float** outputs);
+  static void op_cmp_gt(const Instruction& instr, float** outputs);
+  static void op_splat(const Instruction& instr, float** outputs);
+  static void op_splat_int(const Instruction& instr, float** outputs);
+  // Evaluates the fused tree with a small value stack of vectors; the
+  // intermediates live in per-call scratch that stays in L1 instead of in
+  // the program's registers.
+  static void op_expression(const Instruction& instr, float** outputs);
+  // A run of instructions, handed to WorkerPool::parallel_for or
+  // TaskGraph::run, which execute them by index.
+  struct InstructionTask {
+    const Instruction* first;
+    float** outputs;
+  };
+  static void run_instruction_task(void* context, uint32_t index);
+  struct StageTask {
+    const Program* program;
+    float** outputs;
+  };
+  static void run_stage_task(void* context, uint32_t stage);
+  void run_pipeline(float** outputs, WorkerPool* pool);
+  bool decode(const Program* previous, const MemoryOptions& memory);
+  void fill_register(uint32_t reg, float value);
+  // Slot running node node_id, or UINT32_MAX.
+  uint32_t slot_for_node(uint32_t node_id) const;
+  struct NativeNode;
+  // The native opcode running node node_id, or null.
+  const NativeNode* native_node(uint32_t node_id) const;
+  // Writes the next block of every ramp in progress, and refills the
+  // register with the target in the block after a ramp ends.
+  void advance_ramps();
+  void build_task_graph(const std::vector<uint32_t>& input_regs,
+                        const std::vector<uint32_t>& output_regs);
+  bool build_pipeline(const std::vector<uint32_t>& input_regs,
+                      const std::vector<uint32_t>& output_regs);
+  std::vector<bool> plan_migration(const Program& previous);
+  void follow_voice_allocators();
+  void clear();
+  std::vector<uint32_t> m_bytecode;
+  // The arena holds the registers, then the module pool's storage.
+  MemoryArena m_arena;
+  ml::DSPVector* m_registers = nullptr;
+  size_t m_num_registers = 0;
+  // One module per PROC slot, constructed at load so the audio thread never
+  // allocates.
+  ModulePool m_module_pool;
+  std::vector<Instruction> m_instructions;
+  std::vector<const float*> m_input_ptrs;
+  std::vector<float*> m_output_ptrs;
+  // Registers holding load-time constants, and their current values.
+  struct Constant {
+    uint32_t reg;
+    float value;
+    // Ramp in progress: value moves by step per sample for ramp_samples
+    // more samples, ending at target.
+    float target = 0.0f;
+    float step = 0.0f;
+    uint32_t ramp_samples = 0;
+  };
+  std::vector<Constant> m_constants;
+  // Indices into m_constants of the ramps in progress; capacity for all,
+  // reserved at load.
+  std::vector<uint32_t> m_ramps;
+  // Per PROC slot: the node it runs, its module ID and its instruction.
+  std::vector<uint32_t> m_slot_node_ids;
+  std::vector<uint32_t> m_slot_module_ids;
+  std::vector<uint32_t> m_slot_instructions;
+  // {node ID, slot} of every PROC, sorted for module_for_node.
+  std::vector<std::pair<uint32_t, uint32_t>> m_node_slots;
+  // Per PROC slot, its input register words as in the bytecode (poly flag
+  // included): m_port_registers[first, first + count), and its lane count.
+  struct SlotPorts {
+    uint32_t first;
+    uint32_t count;
+    uint32_t lanes;
+  };
+  std::vector<SlotPorts> m_slot_ports;
+  std::vector<uint32_t> m_port_registers;
+  // Nodes run by a native opcode, fused into an EXPR or riding along in a
+  // PROC_MUL or PROC_EXPR, which have no slot:
+  // their IDs, their instruction and their ports as above (one lane),
+  // sorted by node ID.
+  struct NativeNode {
+    uint32_t node_id;
+    uint32_t module_id;
+    uint32_t instruction;
+    SlotPorts ports;
+  };
+  std::vector<NativeNode> m_native_nodes;
+  // Every PROC_POLY in program order, with the earlier entries that write
+  // its polyphonic inputs in its stage: m_lane_feeders[first, first + n).
+  // `lanes` is the ActiveLanes its module follows, or null for all lanes.
+  struct LaneFollower {
+    uint32_t slot;
+    uint32_t stage;
+    uint32_t first_feeder;
+    uint32_t num_feeders;
+    const dsp::ActiveLanes* lanes;
+  };
+  std::vector<LaneFollower> m_lane_followers;
+  std::vector<uint32_t> m_lane_feeders;
+  // Slots left unconstructed at load, to be filled from the same node's
+  // module in m_replaced.
+  struct Migration {
+    uint32_t slot;
+    uint32_t source_slot;
+  };
+  std::vector<Migration> m_migrations;
+  const Program* m_replaced = nullptr;
+  size_t m_num_migrated = 0;
+  size_t m_num_output_channels = 0;
+  // Index of the first instruction of each level, plus one past the last.
+  std::vector<uint32_t> m_level_starts;
+  TaskGraph m_task_graph;
+  // Index of the first instruction of each pipeline stage, plus one past
+  // the last; empty without stages.
+  std::vector<uint32_t> m_stage_starts;
+  // A register read by later stages is copied into a delay line after each
+  // block; a reader h stages later reads entry h - 1, which holds the value
+  // from h blocks ago. This is what lets all stages run at once.
+  struct DelayLine {
+    uint32_t reg;
+    uint32_t first;  // into m_delay_registers
+    uint32_t length; // the furthest reader's distance in stages
+  };
+  std::vector<DelayLine> m_delay_lines;
+  std::vector<ml::DSPVector> m_delay_registers;
+  size_t m_latency_blocks = 0;
+  float m_sampleRate;
+};
+} // namespace madronavm
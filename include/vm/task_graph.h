@@ -0,0 +1,69 @@
+#pragma once
+#include "common/work_stealing_deque.h"
+#include "vm/worker_pool.h"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+namespace madronavm {
+// A dependency graph of tasks run once per block on a WorkerPool. Instead of
+// waiting for a whole level, a task is started the moment its last
+// predecessor finishes: each participant pops its own work-stealing deque
+// and steals from the others when it runs dry. Ready tasks are queued
+// critical path first, using each task's cost as measured every
+// kProfileInterval blocks. Nothing allocates after build().
+class TaskGraph {
+public:
+  static constexpr size_t kCacheLineSize = 64;
+  // Deques, and therefore threads, taking part in one run.
+  static constexpr size_t kMaxParticipants = 16;
+  // Every this many blocks, run() times each task to refresh its cost.
+  static constexpr uint32_t kProfileInterval = 64;
+  using Execute = void (*)(void* context, uint32_t task);
+  // Tasks are numbered in a valid serial order, so every edge in
+  // successors runs from a lower to a higher number. Allocates; call before
+  // handing the graph to the audio thread.
+  void build(const std::vector<std::vector<uint32_t>>& successors);
+  size_t size() const { return m_num_tasks; }
+  // Runs execute(context, task) for every task, each after all of its
+  // predecessors, spread over the pool's workers and the calling thread.
+  void run(WorkerPool& pool, Execute execute, void* context);
+  // Smoothed time of one run of the task, in nanoseconds; 1 until measured.
+  float cost(uint32_t task) const { return m_cost[task]; }
+  // Cost of the longest path from the start of the task to the end of the
+  // block: the task's own cost plus that of its most expensive successor.
+  float priority(uint32_t task) const { return m_priority[task]; }
+private:
+  struct RunContext {
+    TaskGraph* graph;
+    Execute execute;
+    void* context;
+    uint32_t num_participants;
+    bool profile;
+  };
+  static void participate(void* context, uint32_t participant);
+  void participate(const RunContext& run, uint32_t participant);
+  // Recomputes priorities from costs and reorders the roots and each task's
+  // successors by ascending priority, in place.
+  void update_priorities();
+  void sort_by_priority(uint32_t* first, uint32_t* last);
+  size_t m_num_tasks = 0;
+  // Successors of task i are m_successors[m_successor_starts[i] ..
+  // m_successor_starts[i + 1]).
+  std::vector<uint32_t> m_successor_starts;
+  std::vector<uint32_t> m_successors;
+  std::vector<uint32_t> m_num_predecessors;
+  std::vector<uint32_t> m_roots;
+  std::vector<float> m_cost;
+  std::vector<float> m_priority;
+  // Last measured time per task, written by whichever thread ran it.
+  std::vector<float> m_sample;
+  // Predecessors still running, per task, counted down during a run.
+  std::unique_ptr<std::atomic<uint32_t>[]> m_pending;
+  std::array<WorkStealingDeque, kMaxParticipants> m_deques;
+  alignas(kCacheLineSize) std::atomic<uint32_t> m_remaining{0};
+  uint32_t m_blocks = 0;
+};
+} // namespace madronavm
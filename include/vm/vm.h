@@ -1,9 +1,14 @@
 #pragma once
 #include <vector>
+#include <array>
+#include <atomic>
 #include <cstdint>
 #include <memory>
-#include <map>
+#include <string>
 #include "compiler/module_registry.h"
+#include "vm/program.h"
+#include "common/spsc_queue.h"
+#include "MLEventsToSignals.h"
 #include "parser/patch_graph.h"
 #include "dsp/module.h"
 #include "DSP/MLDSPOps.h"
@@ -15,24 +20,143 @@ namespace dsp {
 }
 class VM {
 public:
+    // Events waiting for the next block; see post_event.
+    static constexpr size_t kEventQueueSize = 4096;
+    // Parameter changes waiting for the next block; see set_parameter.
+    static constexpr size_t kParameterQueueSize = 1024;
     VM(const ModuleRegistry& registry, float sampleRate, bool testMode = false);
     ~VM();
+    // Builds the program off the audio thread and publishes it; the audio
+    // thread switches to it at the start of its next block. Safe to call
+    // while process() runs on another thread, but not concurrently with
+    // itself.
     void load_program(std::vector<uint32_t> new_bytecode);
+    // load_program in three parts, for hosts that switch several VMs in
+    // the same block, such as PartitionedVM. prepare_program builds the
+    // program on the calling thread, against the one prepared last, and
+    // returns it unpublished. publish_program hands it to the audio thread,
+    // which switches to it at the start of its next block. It is wait-free,
+    // so the audio thread may call it itself, and it fails, leaving the
+    // program with the caller, while an earlier one has not been taken
+    // yet. discard_program destroys the program prepared last instead of
+    // publishing it. A VM loaded this way is loaded only this way.
+    Program* prepare_program(std::vector<uint32_t> new_bytecode);
+    bool publish_program(Program* program);
+    void discard_program(Program* program);
+    // Destroys programs the audio thread has swapped out. load_program calls
+    // this itself; hosts that load rarely may also call it, from the same
+    // thread as load_program, to release memory sooner.
+    void collect_retired_programs();
+    // Output channels written by the most recently loaded program. Control
+    // thread only.
+    size_t num_output_channels() const;
+    // Whether the most recently loaded program runs node node_id. Control
+    // thread only.
+    bool has_node(uint32_t node_id) const;
+    // Output delay of the most recently loaded program, for hosts to report
+    // as plugin latency: nonzero only for a pipelined program. Control
+    // thread only.
+    size_t latency_frames() const;
+    // Renders num_frames frames of any size, running the program once per
+    // kFloatsPerDSPVector frames. outputs holds one pointer per channel the
+    // program writes; a null entry ends the list. Frames rendered beyond
+    // num_frames are kept in a FIFO and returned first by the next call.
     void process(const float **inputs, float **outputs, int num_frames);
+    // Queues an event for the module of node node_id (the patch's module
+    // ID). event.time is the frame, counted from the start of the next
+    // process() call, at which the event takes effect. process() hands it
+    // to that module's handle_event before rendering the 64-frame block
+    // containing that frame, with event.time rewritten to the offset within
+    // the block; events already late land at offset 0. Events for nodes the
+    // running program lacks are dropped. Wait-free and allocation free, for
+    // a control thread (MIDI, UI, sequencer) running alongside the audio
+    // thread. Single producer: callers on several threads must serialise.
+    // Returns false, dropping the event, if the queue is full.
+    bool post_event(uint32_t node_id, const ml::Event& event);
+    // Changes the constant feeding input `port` of node node_id (a `data`
+    // entry of the patch) without recompiling. The port is resolved
+    // against the most recently loaded program here; the audio thread
+    // applies the change at the start of its next process() call, jumping
+    // or, with ramp_blocks > 0, ramping linearly over that many blocks.
+    // Wait-free on the audio side. Control thread only, like load_program.
+    // Returns false if the node or port is unknown or the queue is full.
+    // A later load_program starts again from the patch's own values.
+    // Nodes the compiler folded into constants or merged into a duplicate
+    // are unknown here, and a change to a node's constant also reaches the
+    // duplicates merged into it; compile with the CompileOptions passes off
+    // to keep every node separately adjustable.
+    bool set_parameter(uint32_t node_id, const std::string& port, float value,
+                       uint32_t ramp_blocks = 0);
     void processBlock(float** outputs, int blockSize);
     void set_audio_out_module(AudioOut* pModule);
+    // Runs independent modules on pool's workers, level by level or as a
+    // work-stealing task graph; null (the default) processes serially. The
+    // pool is not owned and may be shared by VMs that never process at the
+    // same time. Takes effect at the next block.
+    void set_worker_pool(WorkerPool* pool, Schedule schedule = Schedule::kLevels);
+    // Huge pages and mlock for the memory of programs loaded from now on;
+    // see MemoryOptions. Control thread only, like load_program.
+    void set_memory_options(const MemoryOptions& options) { m_memory_options = options; }
     const ml::DSPVector& getRegisterForTest(int index) const;
     void process(const PatchGraph* graph);
     float* get_output_buffer(int channel) const;
 private:
+    // Takes the most recently published program, if any, at the start of a
+    // block. Audio thread only; never allocates or frees.
+    void adopt_pending_program();
+    // Moves events from m_events into m_scheduled, stamped with the frame
+    // they are due at. Audio thread only.
+    void schedule_events();
+    // Hands the active program the events due before the end of the block
+    // about to be rendered. Audio thread only.
+    void deliver_events();
+    // Applies the queued parameter changes. Audio thread only.
+    void apply_parameters();
     const ModuleRegistry& m_registry;
-    std::vector<uint32_t> m_bytecode;
-    std::vector<ml::DSPVector> m_registers;
-    std::map<uint32_t, std::unique_ptr<dsp::DSPModule>> m_module_instances;
+    // Program hot swap. load_program builds a complete Program on the calling
+    // thread and publishes it through m_pending_program. The audio thread
+    // exchanges it into m_active_program at the next block boundary and
+    // passes the program it replaced back through m_retired_programs, to be
+    // destroyed by the next non-real-time call to collect_retired_programs.
+    // Module instances of nodes present in both programs are moved across at
+    // the swap, so their state survives the reload.
+    std::atomic<Program*> m_pending_program{nullptr};
+    const Program* m_published_program = nullptr; // control thread only
+    Program* m_active_program = nullptr; // audio thread only
+    SpscQueue<Program*, 8> m_retired_programs;
+    // Control-thread events for the audio thread, routed by node ID.
+    struct NodeEvent {
+        uint32_t node_id;
+        ml::Event event;
+    };
+    SpscQueue<NodeEvent, kEventQueueSize> m_events;
+    // Events taken off m_events, in frame order, waiting for their block.
+    struct ScheduledEvent {
+        uint64_t frame;
+        NodeEvent queued;
+    };
+    std::array<ScheduledEvent, kEventQueueSize> m_scheduled;
+    size_t m_num_scheduled = 0;
+    // Frames rendered since construction, including those still in m_fifo.
+    uint64_t m_frames_rendered = 0;
+    // Control-thread parameter changes, by node and input port index.
+    struct ParameterChange {
+        uint32_t node_id;
+        uint32_t port;
+        float value;
+        uint32_t ramp_blocks;
+    };
+    SpscQueue<ParameterChange, kParameterQueueSize> m_parameters;
+    std::atomic<WorkerPool*> m_worker_pool{nullptr};
+    std::atomic<Schedule> m_schedule{Schedule::kLevels};
+    // Output rendered ahead by a trailing partial block; the last
+    // m_fifo_frames frames of each vector are still to be delivered.
+    std::array<ml::DSPVector, Program::kMaxOutputChannels> m_fifo;
+    int m_fifo_frames = 0;
     float m_sampleRate;
     bool m_testMode;
+    MemoryOptions m_memory_options;
     AudioOut* m_audio_out_module = nullptr;
-    std::unique_ptr<dsp::DSPModule> create_module(uint32_t module_id);
     void execute_bytecode(const std::vector<uint32_t>& bytecode);
     std::vector<float> m_vm_memory;
 };
@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+namespace madronavm {
+// A fixed set of worker threads for splitting one audio block across cores.
+// Workers are created (and pinned to cores where the platform allows) up
+// front and then spin, waiting for work; handing them a job is a
+// few atomic operations, with no locks, allocation or system calls, so
+// parallel_for may be called from the audio thread.
+class WorkerPool {
+public:
+  static constexpr size_t kCacheLineSize = 64;
+  using Task = void (*)(void* context, uint32_t index);
+  // Starts num_workers threads. With pin_threads, worker i is bound to core
+  // (i + 1) modulo the core count, so no worker lands on core 0 unless
+  // there are more workers than other cores. The calling audio thread is
+  // not pinned; the host owns its affinity.
+  explicit WorkerPool(size_t num_workers, bool pin_threads = true);
+  ~WorkerPool();
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+  size_t num_workers() const { return m_threads.size(); }
+  // Runs task(context, i) for every i in [0, count), spread over the workers
+  // and the calling thread, and returns once all have finished. One caller
+  // at a time.
+  void parallel_for(Task task, void* context, uint32_t count);
+private:
+  void worker_loop();
+  // Claims and runs indices of the job tagged `generation` until none are
+  // left or a newer job has replaced it.
+  void run_tasks(uint32_t generation);
+  static void pin_to_core(std::thread& thread, size_t core);
+  // The job's generation in the high 32 bits, the next unclaimed index in
+  // the low 32. Claiming with a compare-exchange on the whole word means a
+  // worker still finishing an old job can never take an index of a new one.
+  // parallel_for closes the old job (index UINT32_MAX) before it rewrites
+  // the fields below, so a claim based on the old word always fails.
+  alignas(kCacheLineSize) std::atomic<uint64_t> m_work{0};
+  alignas(kCacheLineSize) std::atomic<uint32_t> m_done{0};
+  // The job itself. Atomic because a late worker may read them while the
+  // next job is being published; the old job is closed by then, so its
+  // claim fails and the values are discarded.
+  std::atomic<Task> m_task{nullptr};
+  std::atomic<void*> m_context{nullptr};
+  std::atomic<uint32_t> m_count{0};
+  std::atomic<bool> m_stop{false};
+  std::vector<std::thread> m_threads;
+};
+} // namespace madronavm
@@ -2,12 +2,17 @@
 #include "../../external/madronalib/external/rtaudio/RtAudio.h"
 #include "common/embedded_logging.h"
 #include <algorithm>
+#include <utility>
 namespace ml {
 CustomAudioTask::CustomAudioTask(ml::AudioContext* ctx, AudioCallback callback, unsigned int deviceId)
   : mContext(ctx), mCallback(callback), mDeviceId(deviceId) {
   mRtAudio = std::make_unique<RtAudio>();
   mBuffer = std::make_unique<ml::SignalProcessBuffer>(ctx->inputs.size(), ctx->outputs.size(), kMaxBlockSize);
 }
+CustomAudioTask::CustomAudioTask(ml::AudioContext* ctx, DirectCallback callback, unsigned int deviceId)
+  : mContext(ctx), mDirectCallback(std::move(callback)), mDeviceId(deviceId) {
+  mRtAudio = std::make_unique<RtAudio>();
+}
 CustomAudioTask::~CustomAudioTask() {
   stopAudio();
 }
@@ -19,8 +24,10 @@ int CustomAudioTask::rtAudioCallback(void* outputBuffer, void* inputBuffer, unsi
   }
   // Set up input and output pointers (non-interleaved)
   constexpr size_t kMaxIOChannels = 64;
-  const float* inputs[kMaxIOChannels];
-  float* outputs[kMaxIOChannels];
+  // Null past the device's channels: VM::process stops at the first null
+  // output, so a program wider than the device never writes past it.
+  const float* inputs[kMaxIOChannels] = {};
+  float* outputs[kMaxIOChannels] = {};
   const float* pInputBuffer = reinterpret_cast<const float*>(inputBuffer);
   float* pOutputBuffer = reinterpret_cast<float*>(outputBuffer);
   size_t nIns = std::min(kMaxIOChannels, task->mContext->inputs.size());
@@ -31,6 +38,10 @@ int CustomAudioTask::rtAudioCallback(void* outputBuffer, void* inputBuffer, unsi
   for (size_t i = 0; i < nOuts; ++i) {
     outputs[i] = pOutputBuffer + i * nBufferFrames;
   }
+  if (task->mDirectCallback) {
+    task->mDirectCallback(outputs, static_cast<int>(nBufferFrames));
+    return 0;
+  }
   // Process through the buffer using a lambda
   task->mBuffer->process(inputs, outputs, nBufferFrames, task->mContext,
     [](ml::AudioContext* ctx, void* state) {
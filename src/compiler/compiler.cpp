@@ -1,7 +1,15 @@
 #include "compiler/compiler.h"
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <limits>
 #include <map>
+#include <set>
 #include <stdexcept>
+#include <string>
+#include <tuple>
 #include "compiler/module_registry.h"
+#include "dsp/module_factory.h"
 #include "vm/opcodes.h"
 #include <cstring>
 namespace madronavm {
@@ -62,75 +70,1057 @@ std::vector<uint32_t> Compiler::topological_sort(const PatchGraph& graph) {
     }
     return sorted_nodes;
 }
-std::vector<uint32_t> Compiler::compile(const PatchGraph& graph, const ModuleRegistry& registry) {
+// Walks the connections backwards from every audio_out; whatever the walk
+// never visits cannot affect the output.
+PatchGraph Compiler::eliminate_dead_nodes(const PatchGraph& graph, std::vector<uint32_t>* removed) {
+    std::set<uint32_t> live;
+    std::vector<uint32_t> stack;
+    for (const auto& node : graph.nodes) {
+        if (node.name == "audio_out") {
+            live.insert(node.id);
+            stack.push_back(node.id);
+        }
+    }
+    if (live.empty()) {
+        return graph;
+    }
+    while (!stack.empty()) {
+        const uint32_t node_id = stack.back();
+        stack.pop_back();
+        for (const auto& conn : graph.connections) {
+            if (conn.to_node_id == node_id && live.insert(conn.from_node_id).second) {
+                stack.push_back(conn.from_node_id);
+            }
+        }
+    }
+    PatchGraph pruned;
+    std::vector<uint32_t> dead;
+    for (const auto& node : graph.nodes) {
+        if (live.count(node.id)) {
+            pruned.nodes.push_back(node);
+        } else {
+            dead.push_back(node.id);
+        }
+    }
+    // A live node's inputs are all live, so a connection is kept exactly
+    // when its destination is.
+    for (const auto& conn : graph.connections) {
+        if (live.count(conn.to_node_id)) {
+            pruned.connections.push_back(conn);
+        }
+    }
+    if (removed) {
+        std::sort(dead.begin(), dead.end());
+        removed->insert(removed->end(), dead.begin(), dead.end());
+    }
+    return pruned;
+}
+// Two stateless nodes compute the same thing when they run the same module
+// on the same voices and every input port reads the same constant bits, the
+// same output of the same (surviving) node, or nothing.
+PatchGraph Compiler::merge_duplicates(const PatchGraph& graph, const ModuleRegistry& registry,
+                                      std::vector<uint32_t>* merged) {
+    std::map<uint32_t, const Node*> node_of;
+    bool has_output = false;
+    for (const auto& node : graph.nodes) {
+        node_of[node.id] = &node;
+        has_output = has_output || node.name == "audio_out";
+    }
+    if (!has_output) {
+        return graph;
+    }
+    std::map<std::pair<uint32_t, std::string>, const Connection*> feeder;
+    for (const auto& conn : graph.connections) {
+        feeder.emplace(std::make_pair(conn.to_node_id, conn.to_port_name), &conn);
+    }
+    // Per input port: the feeding node and port, or UINT32_MAX and the
+    // constant's bit patterns (none for an unconnected port).
+    using InputKey = std::tuple<uint32_t, std::string, std::vector<uint32_t>>;
+    using NodeKey = std::tuple<std::string, uint32_t, std::vector<InputKey>>;
+    std::map<NodeKey, uint32_t> first_of;
+    // Every merged node, mapped to the node that now stands in for it.
+    std::map<uint32_t, uint32_t> survivor;
+    for (uint32_t node_id : topological_sort(graph)) {
+        const Node& node = *node_of.at(node_id);
+        const auto& info = registry.get_info(node.name);
+        if (!info.stateless) {
+            continue;
+        }
+        std::vector<InputKey> inputs;
+        for (const auto& port : info.inputs) {
+            auto given = std::find_if(node.constants.begin(), node.constants.end(),
+                                      [&](const ConstantInput& c) { return c.port_name == port; });
+            if (given != node.constants.end()) {
+                std::vector<float> values = given->voice_values;
+                if (values.empty()) {
+                    values.push_back(given->value);
+                }
+                std::vector<uint32_t> bits(values.size());
+                std::memcpy(bits.data(), values.data(), values.size() * sizeof(float));
+                inputs.emplace_back(UINT32_MAX, std::string(), std::move(bits));
+                continue;
+            }
+            auto conn = feeder.find({node.id, port});
+            if (conn == feeder.end()) {
+                inputs.emplace_back(UINT32_MAX, std::string(), std::vector<uint32_t>());
+                continue;
+            }
+            auto from = survivor.find(conn->second->from_node_id);
+            inputs.emplace_back(from != survivor.end() ? from->second : conn->second->from_node_id,
+                                conn->second->from_port_name, std::vector<uint32_t>());
+        }
+        auto first = first_of.emplace(NodeKey(node.name, node.voices, std::move(inputs)), node.id);
+        if (!first.second) {
+            survivor[node.id] = first.first->second;
+        }
+    }
+    if (survivor.empty()) {
+        return graph;
+    }
+    PatchGraph result;
+    for (const auto& node : graph.nodes) {
+        if (!survivor.count(node.id)) {
+            result.nodes.push_back(node);
+        }
+    }
+    for (const auto& conn : graph.connections) {
+        if (survivor.count(conn.to_node_id)) {
+            continue;
+        }
+        Connection kept = conn;
+        auto from = survivor.find(conn.from_node_id);
+        if (from != survivor.end()) {
+            kept.from_node_id = from->second;
+        }
+        result.connections.push_back(std::move(kept));
+    }
+    if (merged) {
+        for (const auto& entry : survivor) {
+            merged->push_back(entry.first);
+        }
+    }
+    return result;
+}
+PatchGraph Compiler::fold_constants(const PatchGraph& graph, const ModuleRegistry& registry,
+                                    std::vector<uint32_t>* folded) {
+    // Stateless modules ignore the sample rate; any will do.
+    constexpr float kSampleRate = 48000.0f;
+    std::map<uint32_t, const Node*> node_of;
+    bool has_output = false;
+    for (const auto& node : graph.nodes) {
+        node_of[node.id] = &node;
+        has_output = has_output || node.name == "audio_out";
+    }
+    if (!has_output) {
+        return graph;
+    }
+    // The connection compile() reads for each input port: the first.
+    std::map<std::pair<uint32_t, std::string>, const Connection*> feeder;
+    for (const auto& conn : graph.connections) {
+        feeder.emplace(std::make_pair(conn.to_node_id, conn.to_port_name), &conn);
+    }
+    // The value of every output port of the nodes folded so far.
+    std::map<std::pair<uint32_t, std::string>, float> folded_outputs;
+    std::set<uint32_t> folded_ids;
+    for (uint32_t node_id : topological_sort(graph)) {
+        const Node& node = *node_of.at(node_id);
+        const auto& info = registry.get_info(node.name);
+        if (!info.stateless || node.voices > 1) {
+            continue;
+        }
+        // A node fed only by its own data is a parameter source, a knob the
+        // host turns with VM::set_parameter, so it stays, and so do its
+        // readers.
+        const bool connected = std::any_of(info.inputs.begin(), info.inputs.end(),
+                                           [&](const std::string& port) {
+                                               return feeder.count({node.id, port}) != 0;
+                                           });
+        if (!node.constants.empty() && !connected) {
+            continue;
+        }
+        std::vector<ml::DSPVector> input_values(info.inputs.size());
+        std::vector<const float*> inputs(info.inputs.size(), nullptr);
+        bool constant = true;
+        for (size_t i = 0; i < info.inputs.size() && constant; ++i) {
+            const std::string& port = info.inputs[i];
+            auto given = std::find_if(node.constants.begin(), node.constants.end(),
+                                      [&](const ConstantInput& c) { return c.port_name == port; });
+            if (given != node.constants.end()) {
+                constant = given->voice_values.size() <= 1;
+                input_values[i] = ml::DSPVector(given->value);
+                inputs[i] = input_values[i].getConstBuffer();
+                continue;
+            }
+            auto conn = feeder.find({node.id, port});
+            if (conn == feeder.end()) {
+                continue;
+            }
+            auto value = folded_outputs.find({conn->second->from_node_id, conn->second->from_port_name});
+            constant = value != folded_outputs.end();
+            if (constant) {
+                input_values[i] = ml::DSPVector(value->second);
+                inputs[i] = input_values[i].getConstBuffer();
+            }
+        }
+        if (!constant) {
+            continue;
+        }
+        std::vector<ml::DSPVector> output_values(info.outputs.size());
+        std::vector<float*> outputs;
+        for (auto& output : output_values) {
+            outputs.push_back(output.getBuffer());
+        }
+        auto module = dsp::create_module(registry.get_id(node.name), kSampleRate);
+        module->process(inputs.data(), static_cast<int>(inputs.size()), outputs.data(),
+                        static_cast<int>(outputs.size()));
+        // Only a value the same in every sample fits a LOAD_K.
+        bool uniform = true;
+        for (const auto& output : output_values) {
+            for (int i = 1; i < kFloatsPerDSPVector; ++i) {
+                uniform = uniform && output[i] == output[0];
+            }
+        }
+        if (!uniform) {
+            continue;
+        }
+        for (size_t k = 0; k < info.outputs.size(); ++k) {
+            folded_outputs[{node.id, info.outputs[k]}] = output_values[k][0];
+        }
+        folded_ids.insert(node.id);
+    }
+    if (folded_ids.empty()) {
+        return graph;
+    }
+    PatchGraph result;
+    for (const auto& node : graph.nodes) {
+        if (folded_ids.count(node.id)) {
+            continue;
+        }
+        Node kept = node;
+        for (const auto& conn : graph.connections) {
+            if (conn.to_node_id != node.id || feeder.at({node.id, conn.to_port_name}) != &conn ||
+                !folded_ids.count(conn.from_node_id)) {
+                continue;
+            }
+            auto given = std::find_if(kept.constants.begin(), kept.constants.end(),
+                                      [&](const ConstantInput& c) { return c.port_name == conn.to_port_name; });
+            if (given == kept.constants.end()) {
+                kept.constants.push_back(
+                    {conn.to_port_name, folded_outputs.at({conn.from_node_id, conn.from_port_name}), {}});
+            }
+        }
+        result.nodes.push_back(std::move(kept));
+    }
+    for (const auto& conn : graph.connections) {
+        if (!folded_ids.count(conn.from_node_id) && !folded_ids.count(conn.to_node_id)) {
+            result.connections.push_back(conn);
+        }
+    }
+    if (folded) {
+        folded->insert(folded->end(), folded_ids.begin(), folded_ids.end());
+    }
+    return result;
+}
+std::vector<std::vector<uint32_t>> Compiler::dependency_levels(const PatchGraph& graph) {
     auto sorted_node_ids = topological_sort(graph);
+    // Visiting in topological order means every input's level is final
+    // before the node that reads it is placed.
+    std::map<uint32_t, size_t> level_of;
+    std::vector<std::vector<uint32_t>> levels;
+    for (uint32_t node_id : sorted_node_ids) {
+        size_t level = 0;
+        for (const auto& conn : graph.connections) {
+            if (conn.to_node_id == node_id) {
+                level = std::max(level, level_of.at(conn.from_node_id) + 1);
+            }
+        }
+        level_of[node_id] = level;
+        if (level >= levels.size()) {
+            levels.resize(level + 1);
+        }
+        levels[level].push_back(node_id);
+    }
+    return levels;
+}
+namespace {
+// A node the final mix may absorb: a plain sum of its two inputs.
+bool is_mix_node(const Node& node) {
+    return node.name == "add" && node.constants.empty();
+}
+} // namespace
+std::vector<PatchGraph> Compiler::partition(const PatchGraph& graph) {
+    // --- 1. Find the final mix ---
+    // audio_out, then every add whose outputs go only into the mix.
+    std::set<uint32_t> mix;
+    for (const auto& node : graph.nodes) {
+        if (node.name == "audio_out") {
+            mix.insert(node.id);
+        }
+    }
+    for (bool grown = true; grown;) {
+        grown = false;
+        for (const auto& node : graph.nodes) {
+            if (mix.count(node.id) || !is_mix_node(node)) {
+                continue;
+            }
+            bool feeds_mix = false;
+            bool feeds_other = false;
+            for (const auto& conn : graph.connections) {
+                if (conn.from_node_id == node.id) {
+                    (mix.count(conn.to_node_id) ? feeds_mix : feeds_other) = true;
+                }
+            }
+            if (feeds_mix && !feeds_other) {
+                mix.insert(node.id);
+                grown = true;
+            }
+        }
+    }
+    // --- 2. Group the other nodes into weakly connected components ---
+    std::map<uint32_t, uint32_t> parent;
+    auto find = [&](uint32_t id) {
+        while (parent[id] != id) {
+            parent[id] = parent[parent[id]];
+            id = parent[id];
+        }
+        return id;
+    };
+    for (const auto& node : graph.nodes) {
+        if (!mix.count(node.id)) {
+            parent[node.id] = node.id;
+        }
+    }
+    for (const auto& conn : graph.connections) {
+        if (!mix.count(conn.from_node_id) && !mix.count(conn.to_node_id)) {
+            parent[find(conn.from_node_id)] = find(conn.to_node_id);
+        }
+    }
+    // Partitions are numbered in order of their first node.
+    std::map<uint32_t, size_t> partition_of_root;
+    std::map<uint32_t, size_t> partition_of;
+    for (const auto& node : graph.nodes) {
+        if (!mix.count(node.id)) {
+            auto it = partition_of_root.emplace(find(node.id), partition_of_root.size()).first;
+            partition_of[node.id] = it->second;
+        }
+    }
+    if (partition_of_root.size() < 2) {
+        return {graph};
+    }
+    std::vector<PatchGraph> partitions(partition_of_root.size());
+    for (const auto& node : graph.nodes) {
+        if (!mix.count(node.id)) {
+            partitions[partition_of.at(node.id)].nodes.push_back(node);
+        }
+    }
+    for (const auto& conn : graph.connections) {
+        if (!mix.count(conn.from_node_id) && !mix.count(conn.to_node_id)) {
+            partitions[partition_of.at(conn.from_node_id)].connections.push_back(conn);
+        }
+    }
+    // --- 3. Give each partition its share of the mix ---
+    // The non-mix outputs summed into a mix input, once per path. Like
+    // compile(), only the first connection into a port counts.
+    std::function<void(uint32_t, const std::string&, std::vector<const Connection*>&)> collect =
+        [&](uint32_t node_id, const std::string& port, std::vector<const Connection*>& sources) {
+            for (const auto& conn : graph.connections) {
+                if (conn.to_node_id == node_id && conn.to_port_name == port) {
+                    if (mix.count(conn.from_node_id)) {
+                        collect(conn.from_node_id, "in1", sources);
+                        collect(conn.from_node_id, "in2", sources);
+                    } else {
+                        sources.push_back(&conn);
+                    }
+                    return;
+                }
+            }
+        };
+    // Sums of several sources within one partition get new add nodes,
+    // numbered after the highest node ID of the patch.
+    uint32_t max_id = 0;
+    for (const auto& node : graph.nodes) {
+        max_id = std::max(max_id, node.id);
+    }
+    std::vector<uint32_t> next_ids(partitions.size(), max_id + 1);
+    for (const auto& out : graph.nodes) {
+        if (out.name != "audio_out") {
+            continue;
+        }
+        // The mix sums every copy, so only the first keeps the constant
+        // inputs; on the others those ports stay unconnected.
+        for (size_t p = 0; p < partitions.size(); ++p) {
+            Node copy = out;
+            if (p > 0) {
+                copy.constants.clear();
+            }
+            partitions[p].nodes.push_back(std::move(copy));
+        }
+        std::set<std::string> ports_seen;
+        for (const auto& constant : out.constants) {
+            // A constant wins over the connections into its port (see
+            // compile()), so none of them is wired in anywhere.
+            ports_seen.insert(constant.port_name);
+        }
+        for (const auto& out_conn : graph.connections) {
+            if (out_conn.to_node_id != out.id || !ports_seen.insert(out_conn.to_port_name).second) {
+                continue;
+            }
+            std::vector<const Connection*> sources;
+            collect(out.id, out_conn.to_port_name, sources);
+            std::vector<std::pair<uint32_t, std::string>> sums(partitions.size());
+            for (const Connection* source : sources) {
+                const size_t p = partition_of.at(source->from_node_id);
+                std::pair<uint32_t, std::string> output{source->from_node_id, source->from_port_name};
+                if (sums[p].second.empty()) {
+                    sums[p] = output;
+                    continue;
+                }
+                const uint32_t add_id = next_ids[p]++;
+                partitions[p].nodes.push_back({add_id, "add", {}});
+                partitions[p].connections.push_back({sums[p].first, sums[p].second, add_id, "in1"});
+                partitions[p].connections.push_back({output.first, output.second, add_id, "in2"});
+                sums[p] = {add_id, "out"};
+            }
+            for (size_t p = 0; p < partitions.size(); ++p) {
+                if (!sums[p].second.empty()) {
+                    partitions[p].connections.push_back(
+                        {sums[p].first, sums[p].second, out.id, out_conn.to_port_name});
+                }
+            }
+        }
+    }
+    return partitions;
+}
+namespace {
+// Modules the VM runs as a native opcode instead of a PROC.
+const std::map<std::string, OpCode> kNativeOps = {
+    {"add", OpCode::ADD},         {"mul", OpCode::MUL},   {"gain", OpCode::MUL},
+    {"threshold", OpCode::CMP_GT}, {"float", OpCode::SPLAT}, {"int", OpCode::SPLAT_INT},
+};
+// The instructions a module's PROC takes along as one superinstruction
+// when they read its output, most frequent first. Counted over the example
+// patches once constants are folded and arithmetic chains fused, a module's
+// output is read by an EXPR 13 times (oscillators and envelopes scaled and
+// offset as modulators), by a MUL 9 times (oscillators and filters into
+// their gain) and never by a lone ADD or CMP_GT. A module read by more
+// than one pairs with the most frequent.
+const std::vector<std::pair<OpCode, OpCode>> kSuperinstructions = {
+    {OpCode::EXPR, OpCode::PROC_EXPR},
+    {OpCode::MUL, OpCode::PROC_MUL},
+};
+// The PROC_Nx1 form of a mono PROC with `num_inputs` inputs and one
+// output; PROC for any other shape.
+OpCode arity_form(size_t num_inputs, size_t num_outputs) {
+    if (num_outputs != 1) {
+        return OpCode::PROC;
+    }
+    switch (num_inputs) {
+    case 1: return OpCode::PROC_1x1;
+    case 2: return OpCode::PROC_2x1;
+    case 3: return OpCode::PROC_3x1;
+    case 5: return OpCode::PROC_5x1;
+    default: return OpCode::PROC;
+    }
+}
+// The EXPR operation of a native binary opcode; PUSH for any other.
+ExprOp expression_op(OpCode opcode) {
+    switch (opcode) {
+    case OpCode::ADD: return ExprOp::ADD;
+    case OpCode::MUL: return ExprOp::MUL;
+    case OpCode::CMP_GT: return ExprOp::CMP_GT;
+    default: return ExprOp::PUSH;
+    }
+}
+// Hands out registers for module outputs, reusing those whose last reader
+// ran at an earlier dependency level: interval colouring, with a value
+// live from its writer's level to its last reader's. Reuse waits for a
+// later level because the nodes of one level may run in parallel, and it
+// stays within one pipeline stage because the stages of consecutive
+// blocks run at the same time.
+class RegisterAllocator {
+public:
+    // Registers that are never reused.
+    uint32_t reserve(uint32_t count) {
+        const uint32_t reg = m_next;
+        m_next += count;
+        return reg;
+    }
+    // The lowest run of count consecutive free registers of the stage, or
+    // new ones.
+    uint32_t allocate(uint32_t count, size_t stage) {
+        auto& free = m_free[stage];
+        for (auto it = free.begin(); it != free.end(); ++it) {
+            auto last = it;
+            uint32_t run = 1;
+            while (run < count && std::next(last) != free.end() && *std::next(last) == *last + 1) {
+                ++last;
+                ++run;
+            }
+            if (run == count) {
+                const uint32_t reg = *it;
+                free.erase(it, std::next(last));
+                return reg;
+            }
+            it = last;
+        }
+        return reserve(count);
+    }
+    // Returns [reg, reg + count) to the stage once last_level is over.
+    void release(uint32_t reg, uint32_t count, size_t stage, size_t last_level) {
+        m_pending.push_back({reg, count, stage, last_level});
+    }
+    // Called before the nodes of each level are allocated.
+    void begin_level(size_t level) {
+        auto done = std::partition(m_pending.begin(), m_pending.end(),
+                                   [&](const Release& r) { return r.last_level >= level; });
+        for (auto it = done; it != m_pending.end(); ++it) {
+            for (uint32_t i = 0; i < it->count; ++i) {
+                m_free[it->stage].insert(it->reg + i);
+            }
+        }
+        m_pending.erase(done, m_pending.end());
+    }
+    uint32_t size() const { return m_next; }
+private:
+    struct Release {
+        uint32_t reg;
+        uint32_t count;
+        size_t stage;
+        size_t last_level;
+    };
+    uint32_t m_next = 0;
+    std::map<size_t, std::set<uint32_t>> m_free;
+    std::vector<Release> m_pending;
+};
+} // namespace
+// Linear partitioning by dynamic programming: best[k][i] is the lowest
+// possible cost of the costliest stage when the first i nodes form k
+// stages.
+std::vector<uint32_t> Compiler::pipeline_cuts(const PatchGraph& graph, size_t num_stages,
+                                              const std::map<uint32_t, float>& node_costs) {
+    // The order compile() emits, which leaves out dead nodes.
+    std::vector<uint32_t> order;
+    for (const auto& level : dependency_levels(eliminate_dead_nodes(graph))) {
+        order.insert(order.end(), level.begin(), level.end());
+    }
+    const size_t n = order.size();
+    num_stages = std::min(num_stages, n);
+    if (num_stages < 2) {
+        return {};
+    }
+    std::vector<double> prefix(n + 1, 0.0);
+    for (size_t i = 0; i < n; ++i) {
+        auto it = node_costs.find(order[i]);
+        prefix[i + 1] = prefix[i] + (it != node_costs.end() ? it->second : 1.0f);
+    }
+    constexpr double kInfinity = std::numeric_limits<double>::infinity();
+    std::vector<std::vector<double>> best(num_stages + 1, std::vector<double>(n + 1, kInfinity));
+    std::vector<std::vector<size_t>> split(num_stages + 1, std::vector<size_t>(n + 1, 0));
+    best[0][0] = 0.0;
+    for (size_t k = 1; k <= num_stages; ++k) {
+        for (size_t i = k; i <= n; ++i) {
+            for (size_t j = k - 1; j < i; ++j) {
+                const double cost = std::max(best[k - 1][j], prefix[i] - prefix[j]);
+                if (cost < best[k][i]) {
+                    best[k][i] = cost;
+                    split[k][i] = j;
+                }
+            }
+        }
+    }
+    std::vector<uint32_t> starts(num_stages - 1);
+    for (size_t k = num_stages, i = n; k > 1; --k) {
+        i = split[k][i];
+        starts[k - 2] = order[i];
+    }
+    return starts;
+}
+std::vector<uint32_t> Compiler::compile(const PatchGraph& patch, const ModuleRegistry& registry,
+                                        const std::vector<uint32_t>& stage_starts,
+                                        CompileReport* report, const CompileOptions& options) {
+    PatchGraph graph = eliminate_dead_nodes(patch, report ? &report->removed_nodes : nullptr);
+    if (options.fold_constants) {
+        graph = fold_constants(graph, registry, report ? &report->folded_nodes : nullptr);
+    }
+    if (options.merge_duplicates) {
+        graph = merge_duplicates(graph, registry, report ? &report->merged_nodes : nullptr);
+    }
+    auto levels = dependency_levels(graph);
     std::vector<uint32_t> instructions;
-    // Maps a module's output port {node_id, port_name} to a register index.
+    // Maps a module's output port {node_id, port_name} to a register index,
+    // the first of several for a polyphonic port.
     std::map<std::pair<uint32_t, std::string>, uint32_t> port_to_reg_map;
-    uint32_t next_reg = 0;
+    // Voices each node's outputs carry.
+    std::map<uint32_t, uint32_t> lanes_of;
+    RegisterAllocator registers;
+    // Dense module slot per PROC, assigned in execution order so the VM can
+    // lay module state out contiguously in the order it is processed.
+    uint32_t next_slot = 0;
     // Create a map of nodes by ID for quick lookups.
     std::map<uint32_t, Node> node_map;
     for(const auto& node : graph.nodes) {
         node_map[node.id] = node;
     }
-    for (uint32_t node_id : sorted_node_ids) {
-        const auto& node = node_map.at(node_id);
-        const auto& module_info = registry.get_info(node.name);
-        // --- 1. Handle Constant Inputs ---
-        // For each constant, emit a LOAD_K instruction into a new register.
-        std::map<std::string, uint32_t> constant_regs;
-        for (const auto& constant : node.constants) {
-            uint32_t reg = next_reg++;
-            constant_regs[constant.port_name] = reg;
-            instructions.push_back(static_cast<uint32_t>(OpCode::LOAD_K));
-            instructions.push_back(reg);
-            uint32_t val_as_u32;
-            static_assert(sizeof(float) == sizeof(uint32_t));
-            std::memcpy(&val_as_u32, &constant.value, sizeof(val_as_u32));
-            instructions.push_back(val_as_u32);
-        }
-        // --- 2. Prepare for PROC instruction ---
-        std::vector<uint32_t> in_regs;
-        for (const auto& port_name : module_info.inputs) {
-            // Check if the input is a constant for this node.
-            if (constant_regs.count(port_name)) {
-                in_regs.push_back(constant_regs.at(port_name));
-                continue;
+    // The connection feeding each input port, or null. Like the emission
+    // below, only the first connection into a port counts.
+    auto feeder_of = [&](uint32_t node_id, const std::string& port_name) -> const Connection* {
+        for (const auto& conn : graph.connections) {
+            if (conn.to_node_id == node_id && conn.to_port_name == port_name) {
+                return &conn;
+            }
+        }
+        return nullptr;
+    };
+    auto has_constant = [](const Node& node, const std::string& port_name) {
+        return std::any_of(node.constants.begin(), node.constants.end(),
+                           [&](const ConstantInput& c) { return c.port_name == port_name; });
+    };
+    // --- Voices ---
+    // A node runs as many voices as its widest input or constant, or as
+    // many as it asks for. voice_mix folds its voices into one.
+    std::map<uint32_t, uint32_t> run_lanes;
+    for (const auto& level : levels) {
+        for (uint32_t node_id : level) {
+            const auto& node = node_map.at(node_id);
+            uint32_t lanes = node.voices;
+            for (const auto& constant : node.constants) {
+                lanes = std::max<uint32_t>(lanes, constant.voice_values.size());
             }
-            // Otherwise, find the connection that feeds this input port.
-            bool found_connection = false;
             for (const auto& conn : graph.connections) {
-                if (conn.to_node_id == node.id && conn.to_port_name == port_name) {
-                    in_regs.push_back(port_to_reg_map.at({conn.from_node_id, conn.from_port_name}));
-                    found_connection = true;
-                    break;
+                if (conn.to_node_id == node.id) {
+                    lanes = std::max(lanes, lanes_of.at(conn.from_node_id));
                 }
             }
-            if (!found_connection) {
-                // If an input is not connected and not a constant, we mark it as null.
-                in_regs.push_back(UINT32_MAX);
+            const bool is_voice_mix = node.name == "voice_mix";
+            if (lanes > 1 && !registry.get_info(node.name).poly && !is_voice_mix) {
+                throw std::runtime_error("Node " + std::to_string(node.id) + " (" + node.name +
+                                         ") cannot run " + std::to_string(lanes) +
+                                         " voices; mix them down with voice_mix first");
             }
+            run_lanes[node.id] = lanes;
+            lanes_of[node.id] = is_voice_mix ? 1 : lanes;
         }
-        // Allocate new registers for all of this module's output ports.
-        std::vector<uint32_t> out_regs;
-        for (const auto& port_name : module_info.outputs) {
-            uint32_t reg = next_reg++;
-            out_regs.push_back(reg);
-            port_to_reg_map[{node.id, port_name}] = reg;
+    }
+    // --- Liveness ---
+    // The level and pipeline stage of every node, in emission order, and
+    // for every output port the last level that reads it.
+    std::map<uint32_t, std::pair<size_t, size_t>> position_of;
+    auto place_nodes = [&] {
+        for (size_t level = 0, stage = 0; level < levels.size(); ++level) {
+            for (uint32_t node_id : levels[level]) {
+                if (std::find(stage_starts.begin(), stage_starts.end(), node_id) != stage_starts.end()) {
+                    ++stage;
+                }
+                position_of[node_id] = {level, stage};
+            }
         }
-        // --- 3. Emit PROC instruction ---
-        if (node.name == "audio_out") {
-            instructions.push_back(static_cast<uint32_t>(OpCode::AUDIO_OUT));
-            instructions.push_back(in_regs.size());
-            instructions.insert(instructions.end(), in_regs.begin(), in_regs.end());
-        } else {
-            instructions.push_back(static_cast<uint32_t>(OpCode::PROC));
-            instructions.push_back(node.id);
-            instructions.push_back(registry.get_id(node.name));
-            instructions.push_back(in_regs.size());
-            instructions.push_back(out_regs.size());
-            instructions.insert(instructions.end(), in_regs.begin(), in_regs.end());
-            instructions.insert(instructions.end(), out_regs.begin(), out_regs.end());
+    };
+    place_nodes();
+    // --- Expression Fusion ---
+    // A mono arithmetic node whose only reader is another one in the same
+    // pipeline stage joins that reader's expression tree, up to
+    // kMaxExpressionDepth - 1 nodes per tree. The root of each tree runs
+    // the whole tree as one EXPR, and the values inside it never touch a
+    // register.
+    std::map<uint32_t, uint32_t> fused_into;
+    if (options.fuse_expressions) {
+        std::map<uint32_t, size_t> num_readers;
+        for (const auto& conn : graph.connections) {
+            ++num_readers[conn.from_node_id];
+        }
+        auto fusable = [&](const Node& node) {
+            auto native = kNativeOps.find(node.name);
+            if (native == kNativeOps.end() || expression_op(native->second) == ExprOp::PUSH ||
+                run_lanes.at(node.id) != 1) {
+                return false;
+            }
+            for (const auto& port_name : registry.get_info(node.name).inputs) {
+                if (!has_constant(node, port_name) && !feeder_of(node.id, port_name)) {
+                    return false;
+                }
+            }
+            return true;
+        };
+        // Nodes in the tree rooted at each fusable node so far.
+        std::map<uint32_t, size_t> tree_size;
+        for (const auto& level : levels) {
+            for (uint32_t node_id : level) {
+                const Node& node = node_map.at(node_id);
+                if (!fusable(node)) {
+                    continue;
+                }
+                size_t size = 1;
+                for (const auto& port_name : registry.get_info(node.name).inputs) {
+                    if (has_constant(node, port_name)) {
+                        continue;
+                    }
+                    const uint32_t from = feeder_of(node_id, port_name)->from_node_id;
+                    auto operand = tree_size.find(from);
+                    if (operand != tree_size.end() && num_readers.at(from) == 1 &&
+                        position_of.at(from).second == position_of.at(node_id).second &&
+                        size + operand->second < kMaxExpressionDepth) {
+                        fused_into[from] = node_id;
+                        size += operand->second;
+                    }
+                }
+                tree_size[node_id] = size;
+            }
+        }
+    }
+    auto root_of = [&](uint32_t node_id) {
+        for (auto it = fused_into.find(node_id); it != fused_into.end(); it = fused_into.find(node_id)) {
+            node_id = it->second;
+        }
+        return node_id;
+    };
+    // --- Superinstructions ---
+    // A mono MUL or EXPR, one of whose leaves is a mono module's output,
+    // joins that module's PROC as a PROC_MUL or PROC_EXPR if its other
+    // leaves are ready by then: constants, or nodes of an earlier level.
+    // Kinds are paired in the order of kSuperinstructions. The MUL, or the
+    // whole tree of the EXPR, moves up into the module's level, straight
+    // after it, so the liveness below sees it where it runs.
+    std::map<uint32_t, uint32_t> paired_reader; // module node -> MUL node or EXPR root
+    std::map<uint32_t, uint32_t> paired_module; // MUL node or EXPR root -> module node
+    // The nodes each pair moves, in emission order.
+    std::map<uint32_t, std::vector<uint32_t>> paired_nodes;
+    if (options.superinstructions) {
+        std::set<uint32_t> roots;
+        for (const auto& [from, to] : fused_into) {
+            roots.insert(to);
+        }
+        // The instruction a node outside any tree runs as, going by its
+        // kind alone.
+        auto instruction_of = [&](uint32_t node_id) {
+            if (roots.count(node_id)) {
+                return OpCode::EXPR;
+            }
+            auto native = kNativeOps.find(node_map.at(node_id).name);
+            return native != kNativeOps.end() && run_lanes.at(node_id) == 1 ? native->second : OpCode::PROC;
+        };
+        for (const auto& entry : kSuperinstructions) {
+            const OpCode kind = entry.first;
+            for (const auto& level : levels) {
+                for (uint32_t node_id : level) {
+                    if (fused_into.count(node_id) || instruction_of(node_id) != kind) {
+                        continue;
+                    }
+                    std::vector<uint32_t> nodes;
+                    for (const auto& tree_level : levels) {
+                        for (uint32_t member : tree_level) {
+                            if (root_of(member) == node_id) {
+                                nodes.push_back(member);
+                            }
+                        }
+                    }
+                    // Every input port in the tree, by node and port; those
+                    // fed from inside the tree are always ready.
+                    std::vector<std::pair<uint32_t, std::string>> leaves;
+                    for (uint32_t member : nodes) {
+                        for (const auto& port_name : registry.get_info(node_map.at(member).name).inputs) {
+                            leaves.emplace_back(member, port_name);
+                        }
+                    }
+                    auto ready_by = [&](const std::pair<uint32_t, std::string>& leaf, uint32_t module) {
+                        if (has_constant(node_map.at(leaf.first), leaf.second)) {
+                            return true;
+                        }
+                        const Connection* conn = feeder_of(leaf.first, leaf.second);
+                        return conn && (fused_into.count(conn->from_node_id) || conn->from_node_id == module ||
+                                        position_of.at(conn->from_node_id).first < position_of.at(module).first);
+                    };
+                    // A tree node that starts a pipeline stage cannot move.
+                    if (std::any_of(nodes.begin(), nodes.end(), [&](uint32_t member) {
+                            return std::find(stage_starts.begin(), stage_starts.end(), member) != stage_starts.end();
+                        })) {
+                        continue;
+                    }
+                    for (const auto& leaf : leaves) {
+                        const Connection* conn = has_constant(node_map.at(leaf.first), leaf.second)
+                                                     ? nullptr
+                                                     : feeder_of(leaf.first, leaf.second);
+                        if (!conn || fused_into.count(conn->from_node_id)) {
+                            continue;
+                        }
+                        const uint32_t module = conn->from_node_id;
+                        if (instruction_of(module) != OpCode::PROC || run_lanes.at(module) != 1 ||
+                            paired_reader.count(module) ||
+                            position_of.at(module).second != position_of.at(node_id).second ||
+                            !std::all_of(leaves.begin(), leaves.end(),
+                                         [&](const auto& other) { return ready_by(other, module); })) {
+                            continue;
+                        }
+                        paired_reader[module] = node_id;
+                        paired_module[node_id] = module;
+                        paired_nodes[node_id] = nodes;
+                        break;
+                    }
+                }
+            }
+        }
+        for (const auto& [reader, module] : paired_module) {
+            const auto& nodes = paired_nodes.at(reader);
+            for (uint32_t member : nodes) {
+                auto& from = levels[position_of.at(member).first];
+                from.erase(std::find(from.begin(), from.end(), member));
+            }
+            auto& to = levels[position_of.at(module).first];
+            to.insert(std::find(to.begin(), to.end(), module) + 1, nodes.begin(), nodes.end());
+        }
+        levels.erase(std::remove_if(levels.begin(), levels.end(),
+                                    [](const std::vector<uint32_t>& level) { return level.empty(); }),
+                     levels.end());
+        place_nodes();
+    }
+    struct Liveness {
+        size_t last_level;
+        bool crosses_stage;
+    };
+    // A fused node writes no register, and a register read inside a tree is
+    // read when the tree's root runs.
+    std::map<std::pair<uint32_t, std::string>, Liveness> liveness;
+    for (const auto& conn : graph.connections) {
+        if (fused_into.count(conn.from_node_id)) {
+            continue;
+        }
+        const auto& from = position_of.at(conn.from_node_id);
+        const auto& to = position_of.at(root_of(conn.to_node_id));
+        auto& live = liveness.emplace(std::make_pair(conn.from_node_id, conn.from_port_name),
+                                      Liveness{from.first, false}).first->second;
+        live.last_level = std::max(live.last_level, to.first);
+        live.crosses_stage = live.crosses_stage || from.second != to.second;
+    }
+    // The tree of every fused node and root emitted so far: its postfix
+    // code, with PUSH naming a register, and its EXPR node table.
+    struct Expression {
+        std::vector<std::pair<ExprOp, uint32_t>> code;
+        std::vector<uint32_t> nodes;
+        uint32_t num_nodes = 0;
+    };
+    std::map<uint32_t, Expression> expressions;
+    // Stands in for an input computed inside the tree.
+    constexpr uint32_t kFusedRegister = UINT32_MAX - 1;
+    // Where the PROC of the last paired module begins and ends, for its
+    // reader to extend.
+    std::pair<size_t, size_t> paired_proc;
+    for (size_t level = 0; level < levels.size(); ++level) {
+        // Lets the VM run the nodes of one level in parallel.
+        if (level > 0) {
+            instructions.push_back(static_cast<uint32_t>(OpCode::BARRIER));
+        }
+        registers.begin_level(level);
+        for (uint32_t node_id : levels[level]) {
+            if (std::find(stage_starts.begin(), stage_starts.end(), node_id) != stage_starts.end()) {
+                instructions.push_back(static_cast<uint32_t>(OpCode::STAGE));
+            }
+            const size_t stage = position_of.at(node_id).second;
+            const auto& node = node_map.at(node_id);
+            const auto& module_info = registry.get_info(node.name);
+            const uint32_t lanes = run_lanes.at(node.id);
+            const bool is_voice_mix = node.name == "voice_mix";
+            auto check_voices = [&](size_t voices, const std::string& port_name) {
+                if (voices > 1 && voices != lanes) {
+                    throw std::runtime_error("Node " + std::to_string(node.id) + " port " + port_name +
+                                             " has " + std::to_string(voices) + " voices, but the node runs " +
+                                             std::to_string(lanes));
+                }
+            };
+            // --- 1. Handle Constant Inputs ---
+            // For each constant, emit a LOAD_K instruction into a new register,
+            // or one per voice into consecutive registers for a polyphonic one.
+            // Constant registers are never reused: the VM hoists a LOAD_K
+            // out of the block loop only while it is its register's sole
+            // writer.
+            std::map<std::string, uint32_t> constant_regs;
+            for (const auto& constant : node.constants) {
+                check_voices(constant.voice_values.size(), constant.port_name);
+                const bool poly = constant.voice_values.size() > 1;
+                std::vector<float> values = poly ? constant.voice_values : std::vector<float>{constant.value};
+                uint32_t reg = registers.reserve(values.size());
+                constant_regs[constant.port_name] = poly ? (reg | kPolyRegister) : reg;
+                for (float value : values) {
+                    instructions.push_back(static_cast<uint32_t>(OpCode::LOAD_K));
+                    instructions.push_back(reg++);
+                    uint32_t val_as_u32;
+                    static_assert(sizeof(float) == sizeof(uint32_t));
+                    std::memcpy(&val_as_u32, &value, sizeof(val_as_u32));
+                    instructions.push_back(val_as_u32);
+                }
+            }
+            // --- 2. Prepare for PROC instruction ---
+            std::vector<uint32_t> in_regs;
+            // Nodes fused into this one, in the order of their ports, which
+            // are kFusedRegister in in_regs.
+            std::vector<uint32_t> fused_operands;
+            for (const auto& port_name : module_info.inputs) {
+                // Check if the input is a constant for this node.
+                if (constant_regs.count(port_name)) {
+                    in_regs.push_back(constant_regs.at(port_name));
+                    continue;
+                }
+                // Otherwise, find the connection that feeds this input port.
+                bool found_connection = false;
+                for (const auto& conn : graph.connections) {
+                    if (conn.to_node_id == node.id && conn.to_port_name == port_name &&
+                        fused_into.count(conn.from_node_id)) {
+                        in_regs.push_back(kFusedRegister);
+                        fused_operands.push_back(conn.from_node_id);
+                        found_connection = true;
+                        break;
+                    }
+                    if (conn.to_node_id == node.id && conn.to_port_name == port_name) {
+                        uint32_t reg = port_to_reg_map.at({conn.from_node_id, conn.from_port_name});
+                        const uint32_t voices = lanes_of.at(conn.from_node_id);
+                        if (is_voice_mix) {
+                            // Every voice becomes one input of the sum.
+                            for (uint32_t v = 0; v < voices; ++v) {
+                                in_regs.push_back(reg + v);
+                            }
+                        } else {
+                            check_voices(voices, port_name);
+                            in_regs.push_back(voices > 1 ? (reg | kPolyRegister) : reg);
+                        }
+                        found_connection = true;
+                        break;
+                    }
+                }
+                if (!found_connection) {
+                    // If an input is not connected and not a constant, we mark it as null.
+                    in_regs.push_back(UINT32_MAX);
+                }
+            }
+            // --- 2b. Fused Expressions ---
+            // A node in a tree adds its operation, after its operands', and
+            // its entry in the node table; only the root emits anything.
+            const bool in_tree = fused_into.count(node.id) || !fused_operands.empty();
+            if (in_tree) {
+                Expression& expr = expressions[node.id];
+                for (size_t i = 0, k = 0; i < in_regs.size(); ++i) {
+                    if (in_regs[i] != kFusedRegister) {
+                        expr.code.emplace_back(ExprOp::PUSH, in_regs[i]);
+                        continue;
+                    }
+                    const Expression& operand = expressions.at(fused_operands[k++]);
+                    expr.code.insert(expr.code.end(), operand.code.begin(), operand.code.end());
+                    expr.nodes.insert(expr.nodes.end(), operand.nodes.begin(), operand.nodes.end());
+                    expr.num_nodes += operand.num_nodes;
+                }
+                expr.code.emplace_back(expression_op(kNativeOps.at(node.name)), 0);
+                expr.nodes.push_back(node.id);
+                expr.nodes.push_back(registry.get_id(node.name));
+                expr.nodes.push_back(in_regs.size());
+                for (uint32_t reg : in_regs) {
+                    expr.nodes.push_back(reg == kFusedRegister ? UINT32_MAX : reg);
+                }
+                ++expr.num_nodes;
+                if (fused_into.count(node.id)) {
+                    continue;
+                }
+            }
+            // Allocate registers for all of this module's output ports, one
+            // per voice, and schedule their release after the last reader.
+            // Ports with no reader are free again from the next level on;
+            // ports read in a later pipeline stage, and those of modules that
+            // retain their outputs, are never released.
+            const uint32_t out_lanes = lanes_of.at(node.id);
+            std::vector<uint32_t> out_regs;
+            for (const auto& port_name : module_info.outputs) {
+                uint32_t reg = registers.allocate(out_lanes, stage);
+                out_regs.push_back(reg);
+                port_to_reg_map[{node.id, port_name}] = reg;
+            }
+            for (size_t k = 0; k < out_regs.size() && !module_info.retains_outputs; ++k) {
+                auto it = liveness.find({node.id, module_info.outputs[k]});
+                if (it == liveness.end()) {
+                    registers.release(out_regs[k], out_lanes, stage, level);
+                } else if (!it->second.crosses_stage) {
+                    registers.release(out_regs[k], out_lanes, stage, it->second.last_level);
+                }
+            }
+            // --- 3. Emit PROC instruction ---
+            // Mono arithmetic with every input present runs inline in the
+            // VM; a null input needs the module's own validation.
+            auto native = kNativeOps.find(node.name);
+            const bool inline_op = native != kNativeOps.end() && out_lanes == 1 &&
+                                   std::find(in_regs.begin(), in_regs.end(), UINT32_MAX) == in_regs.end();
+            const size_t emitted = instructions.size();
+            if (node.name == "audio_out") {
+                instructions.push_back(static_cast<uint32_t>(OpCode::AUDIO_OUT));
+                instructions.push_back(in_regs.size());
+                instructions.insert(instructions.end(), in_regs.begin(), in_regs.end());
+            } else if (in_tree) {
+                // The tree's leaves become the inputs, each listed once.
+                const Expression& expr = expressions.at(node.id);
+                std::vector<uint32_t> leaves;
+                std::vector<uint32_t> ops;
+                for (const auto& [op, reg] : expr.code) {
+                    if (op != ExprOp::PUSH) {
+                        ops.push_back(static_cast<uint32_t>(op));
+                        continue;
+                    }
+                    auto leaf = std::find(leaves.begin(), leaves.end(), reg);
+                    if (leaf == leaves.end()) {
+                        leaf = leaves.insert(leaves.end(), reg);
+                    }
+                    ops.push_back(static_cast<uint32_t>(ExprOp::PUSH) |
+                                  static_cast<uint32_t>(leaf - leaves.begin()) << kExprOperandShift);
+                }
+                instructions.push_back(static_cast<uint32_t>(OpCode::EXPR));
+                instructions.push_back(expr.num_nodes);
+                instructions.push_back(leaves.size());
+                instructions.push_back(ops.size());
+                instructions.push_back(out_regs[0]);
+                instructions.insert(instructions.end(), leaves.begin(), leaves.end());
+                instructions.insert(instructions.end(), ops.begin(), ops.end());
+                instructions.insert(instructions.end(), expr.nodes.begin(), expr.nodes.end());
+            } else if (inline_op) {
+                instructions.push_back(static_cast<uint32_t>(native->second));
+                instructions.push_back(node.id);
+                instructions.push_back(registry.get_id(node.name));
+                instructions.insert(instructions.end(), in_regs.begin(), in_regs.end());
+                instructions.insert(instructions.end(), out_regs.begin(), out_regs.end());
+            } else if (out_lanes > 1) {
+                instructions.push_back(static_cast<uint32_t>(OpCode::PROC_POLY));
+                instructions.push_back(node.id);
+                instructions.push_back(registry.get_id(node.name));
+                instructions.push_back(next_slot++);
+                instructions.push_back(out_lanes);
+                instructions.push_back(in_regs.size());
+                instructions.push_back(out_regs.size());
+                instructions.insert(instructions.end(), in_regs.begin(), in_regs.end());
+                instructions.insert(instructions.end(), out_regs.begin(), out_regs.end());
+            } else {
+                // A paired module keeps the counted form its reader
+                // extends.
+                const OpCode form = options.arity_forms && !paired_reader.count(node.id)
+                                        ? arity_form(in_regs.size(), out_regs.size())
+                                        : OpCode::PROC;
+                paired_proc.first = instructions.size();
+                instructions.push_back(static_cast<uint32_t>(form));
+                instructions.push_back(node.id);
+                instructions.push_back(registry.get_id(node.name));
+                instructions.push_back(next_slot++);
+                if (form == OpCode::PROC) {
+                    instructions.push_back(in_regs.size());
+                    instructions.push_back(out_regs.size());
+                }
+                instructions.insert(instructions.end(), in_regs.begin(), in_regs.end());
+                instructions.insert(instructions.end(), out_regs.begin(), out_regs.end());
+                paired_proc.second = instructions.size();
+            }
+            if (paired_module.count(node.id)) {
+                // The module's PROC moves after this node's LOAD_Ks and
+                // those of its tree, and becomes the superinstruction, with
+                // this instruction's words after the opcode appended.
+                const auto [begin, end] = paired_proc;
+                const auto pair = std::find_if(kSuperinstructions.begin(), kSuperinstructions.end(),
+                                               [&](const auto& entry) {
+                                                   return static_cast<uint32_t>(entry.first) == instructions[emitted];
+                                               });
+                std::rotate(instructions.begin() + begin, instructions.begin() + end, instructions.begin() + emitted);
+                instructions[emitted - (end - begin)] = static_cast<uint32_t>(pair->second);
+                instructions.erase(instructions.begin() + emitted);
+            }
         }
     }
     instructions.push_back(static_cast<uint32_t>(OpCode::END));
@@ -139,7 +1129,7 @@ std::vector<uint32_t> Compiler::compile(const PatchGraph& graph, const ModuleReg
     BytecodeHeader header;
     header.magic_number = kMagicNumber;
     header.version = kBytecodeVersion;
-    header.num_registers = next_reg;
+    header.num_registers = registers.size();
     header.program_size_words = instructions.size() + sizeof(BytecodeHeader) / sizeof(uint32_t);
     final_bytecode.resize(sizeof(BytecodeHeader) / sizeof(uint32_t));
     std::memcpy(final_bytecode.data(), &header, sizeof(header));
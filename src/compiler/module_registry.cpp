@@ -52,6 +52,12 @@ ModuleRegistry::ModuleRegistry(std::string_view json_path) {
                 }
             }
         }
+        cJSON* poly = cJSON_GetObjectItem(info_item, "poly");
+        info.poly = poly && poly->type == cJSON_True;
+        cJSON* retains_outputs = cJSON_GetObjectItem(info_item, "retains_outputs");
+        info.retains_outputs = retains_outputs && retains_outputs->type == cJSON_True;
+        cJSON* stateless = cJSON_GetObjectItem(info_item, "stateless");
+        info.stateless = stateless && stateless->type == cJSON_True;
         name_to_id[name] = id;
         name_to_info[name] = info;
     }
@@ -71,4 +77,19 @@ const ModuleInfo& ModuleRegistry::get_info(const std::string& name) const {
     }
     return it->second;
 }
+const std::string& ModuleRegistry::get_name(uint32_t id) const {
+    for (const auto& [name, module_id] : name_to_id) {
+        if (module_id == id) {
+            return name;
+        }
+    }
+    throw std::runtime_error("Unknown module ID: " + std::to_string(id));
+}
+std::vector<std::string> ModuleRegistry::get_names() const {
+    std::vector<std::string> names;
+    for (const auto& entry : name_to_id) {
+        names.push_back(entry.first);
+    }
+    return names;
+}
 } // namespace madronavm 
\ No newline at end of file
@@ -7,7 +7,7 @@ ADSR::ADSR(float sampleRate) : DSPModule(sampleRate) {
     mADSR.clear();
 }
 void ADSR::process(const float** inputs, int num_inputs, float** outputs, int num_outputs) {
-    if (!validate_ports("ADSR", num_inputs, inputs, {0, 1, 2, 3, 4}, num_outputs, 1)) return;
+    if (!validate_ports("ADSR", num_inputs, inputs, {0, 1, 2, 3, 4}, num_outputs, outputs, 1)) return;
     const float* gateIn = inputs[0];
     const float* attackIn = inputs[1];
     const float* decayIn = inputs[2];
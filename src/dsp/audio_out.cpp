@@ -4,8 +4,8 @@
 #include "MLAudioContext.h"
 #include "audio/custom_audio_task.h"
 #include "audio/device_info.h"
+#include <algorithm>
 #include <iostream>
-#include <vector>
 namespace madronavm {
 /*
  * Audio Device Selection Implementation Notes:
@@ -18,7 +18,9 @@ namespace madronavm {
  * - Maintains compatibility with existing AudioOut interface
  * - Allows specifying audio output device via constructor parameter
  * - Provides static methods to enumerate and query available devices
- * - Uses the same RtAudio and SignalProcessBuffer infrastructure as madronalib
+ * - Uses the same RtAudio infrastructure as madronalib, but hands the device
+ * buffers straight to the VM, which blocks internally, instead of going
+ * through a SignalProcessBuffer
  */
 using namespace ml;
 constexpr int kOutputChannels = 2;
@@ -28,11 +30,13 @@ AudioOut::AudioOut(float sampleRate, bool testMode, unsigned int deviceId)
     // Create context and custom audio task with device selection
     mContext = std::make_unique<ml::AudioContext>(0, kOutputChannels, static_cast<int>(sampleRate));
     // Create custom audio task
+    // The VM handles any host buffer size itself, so it renders straight
+    // into the device buffers.
     mCustomAudioTask = std::make_unique<ml::CustomAudioTask>(
         mContext.get(),
-        [this](ml::AudioContext* ctx) {
-          this->audioCallback(ctx);
-        },
+        ml::CustomAudioTask::DirectCallback([this](float** outputs, int num_frames) {
+          this->audioCallback(outputs, num_frames);
+        }),
         deviceId);
     mCustomAudioTask->startAudio();
   }
@@ -61,20 +65,14 @@ void AudioOut::process(const float** inputs, int num_inputs, float** outputs, in
 void AudioOut::setVMCallback(std::function<void(float **, int)> callback) {
   vmCallback_ = callback;
 }
-void AudioOut::audioCallback(ml::AudioContext* ctx) {
+void AudioOut::audioCallback(float** outputs, int num_frames) {
   if (vmCallback_) {
-    std::vector<float *> out_buffers;
-    auto& outputs = ctx->outputs;
-    out_buffers.reserve(outputs.size());
-    for (size_t i = 0; i < outputs.size(); ++i) {
-      out_buffers.push_back(outputs[i].getBuffer());
-    }
-    vmCallback_(out_buffers.data(), kFloatsPerDSPVector);
+    vmCallback_(outputs, num_frames);
   } else {
-    // Fill with silence if no callback is set.
-    auto& outputs = ctx->outputs;
-    for (size_t i = 0; i < outputs.size(); ++i) {
-      outputs[i] = 0.f;
+    // Fill with silence if no callback is set. As in VM::process, a null
+    // entry ends the channel list.
+    for (int i = 0; i < kOutputChannels && outputs[i]; ++i) {
+      std::fill(outputs[i], outputs[i] + num_frames, 0.f);
     }
   }
 }
@@ -2,17 +2,9 @@
 #include "MLDSPFilters.h"
 #include "dsp/validation.h"
 namespace madronavm::dsp {
-struct Bandpass::impl {
-    ml::Bandpass mFilter;
-};
-Bandpass::Bandpass(float sampleRate) : DSPModule(sampleRate) {
-    pImpl = new impl();
-}
-Bandpass::~Bandpass() {
-    delete pImpl;
-}
+Bandpass::Bandpass(float sampleRate) : DSPModule(sampleRate), mFilter() {}
 void Bandpass::process(const float** inputs, int num_inputs, float** outputs, int num_outputs) {
-    if (!validate_ports("Bandpass", num_inputs, inputs, {0, 1, 2}, num_outputs, 1)) return;
+    if (!validate_ports("Bandpass", num_inputs, inputs, {0, 1, 2}, num_outputs, outputs, 1)) return;
     ml::DSPVector vIn(inputs[0]);
     ml::DSPVector vCutoff(inputs[1]);
     ml::DSPVector vQ(inputs[2]);
@@ -28,10 +20,10 @@ void Bandpass::process(const float** inputs, int num_inputs, float** outputs, in
         // Calculate coefficients for this sample
         const float omega = vOmega[n];
         const float k = vK[n];
-        pImpl->mFilter.mCoeffs = ml::Bandpass::coeffs(omega, k);
+        mFilter.mCoeffs = ml::Bandpass::coeffs(omega, k);
         // Process single sample
         ml::DSPVector sampleIn(vIn[n]);
-        ml::DSPVector sampleOut = pImpl->mFilter(sampleIn);
+        ml::DSPVector sampleOut = mFilter(sampleIn);
         vy[n] = sampleOut[0];
     }
     for(int i=0; i<kFloatsPerDSPVector; ++i) {
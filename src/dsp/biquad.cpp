@@ -2,16 +2,11 @@
 #include "MLDSPFilters.h"
 #include "dsp/validation.h"
 namespace madronavm::dsp {
-struct Biquad::Impl {
-  ml::Lopass mFilter;
-  Impl() {
-    mFilter.clear();
-  }
-};
-Biquad::Biquad(float sampleRate) : DSPModule(sampleRate), pImpl(std::make_unique<Impl>()) {}
-Biquad::~Biquad() = default;
+Biquad::Biquad(float sampleRate) : DSPModule(sampleRate), mFilter() {
+  mFilter.clear();
+}
 void Biquad::process(const float** inputs, int num_inputs, float** outputs, int num_outputs) {
-  if (!validate_ports("Biquad", num_inputs, inputs, {0, 1, 2}, num_outputs, 1)) return;
+  if (!validate_ports("Biquad", num_inputs, inputs, {0, 1, 2}, num_outputs, outputs, 1)) return;
   const float* signal = inputs[0];
   const float cutoff = inputs[1][0];
   const float resonance = inputs[2][0];
@@ -26,7 +21,7 @@ void Biquad::process(const float** inputs, int num_inputs, float** outputs, int
   // load input signal
   ml::DSPVector vSignal(signal);
   // process one vector of samples
-  ml::DSPVector v = pImpl->mFilter(vSignal, vOmega, vK);
+  ml::DSPVector v = mFilter(vSignal, vOmega, vK);
   // copy to output
   for(int i=0; i<kFloatsPerDSPVector; ++i) {
     outputs[0][i] = v[i];
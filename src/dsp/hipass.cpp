@@ -2,17 +2,9 @@
 #include "MLDSPFilters.h"
 #include "dsp/validation.h"
 namespace madronavm::dsp {
-struct Hipass::impl {
-    ml::Hipass mFilter;
-};
-Hipass::Hipass(float sampleRate) : DSPModule(sampleRate) {
-    pImpl = new impl();
-}
-Hipass::~Hipass() {
-    delete pImpl;
-}
+Hipass::Hipass(float sampleRate) : DSPModule(sampleRate), mFilter() {}
 void Hipass::process(const float** inputs, int num_inputs, float** outputs, int num_outputs) {
-    if (!validate_ports("Hipass", num_inputs, inputs, {0, 1, 2}, num_outputs, 1)) return;
+    if (!validate_ports("Hipass", num_inputs, inputs, {0, 1, 2}, num_outputs, outputs, 1)) return;
     ml::DSPVector vIn(inputs[0]);
     ml::DSPVector vCutoff(inputs[1]);
     ml::DSPVector vQ(inputs[2]);
@@ -29,10 +21,10 @@ void Hipass::process(const float** inputs, int num_inputs, float** outputs, int
         // Calculate coefficients for this sample
         const float omega = vOmega[n];
         const float k = vK[n];
-        pImpl->mFilter.mCoeffs = ml::Hipass::coeffs(omega, k);
+        mFilter.mCoeffs = ml::Hipass::coeffs(omega, k);
         // Process single sample
         ml::DSPVector sampleIn(vIn[n]);
-        ml::DSPVector sampleOut = pImpl->mFilter(sampleIn);
+        ml::DSPVector sampleOut = mFilter(sampleIn);
         vy[n] = sampleOut[0];
     }
     for(int i=0; i<kFloatsPerDSPVector; ++i) {
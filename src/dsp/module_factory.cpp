@@ -0,0 +1,168 @@
+#include "dsp/module_factory.h"
+#include "dsp/sine_gen.h"
+#include "dsp/phasor_gen.h"
+#include "dsp/gain.h"
+#include "dsp/audio_out.h"
+#include "dsp/float.h"
+#include "dsp/int.h"
+#include "dsp/add.h"
+#include "dsp/mul.h"
+#include "dsp/adsr.h"
+#include "dsp/threshold.h"
+#include "dsp/lopass.h"
+#include "dsp/hipass.h"
+#include "dsp/bandpass.h"
+#include "dsp/saw_gen.h"
+#include "dsp/pulse_gen.h"
+#include "dsp/biquad.h"
+#include "dsp/poly_sine_gen.h"
+#include "dsp/poly_saw_gen.h"
+#include "dsp/poly_lopass.h"
+#include "dsp/poly_gain.h"
+#include "dsp/poly_adsr.h"
+#include "dsp/voice_mix.h"
+#include "dsp/poly_voice_controller.h"
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+namespace madronavm::dsp {
+namespace {
+// The LaneState a polyphonic variant declares, or void.
+template <typename T, typename = void>
+struct LaneStateOf {
+  using type = void;
+};
+template <typename T>
+struct LaneStateOf<T, std::void_t<typename T::LaneState>> {
+  using type = typename T::LaneState;
+};
+template <typename T>
+constexpr bool kHasLanes = !std::is_void_v<typename LaneStateOf<T>::type>;
+// Lane state starts after the module, aligned for it.
+template <typename T>
+constexpr size_t lane_offset() {
+  if constexpr (kHasLanes<T>) {
+    constexpr size_t alignment = alignof(typename LaneStateOf<T>::type);
+    return (sizeof(T) + alignment - 1) / alignment * alignment;
+  } else {
+    return sizeof(T);
+  }
+}
+template <typename T>
+void* lane_storage(void* storage) {
+  return static_cast<char*>(storage) + lane_offset<T>();
+}
+template <typename T>
+DSPModule* construct(void* storage, float sampleRate, size_t lanes) {
+  if constexpr (kHasLanes<T>) {
+    return new (storage) T(sampleRate, lane_storage<T>(storage), lanes);
+  } else {
+    return new (storage) T(sampleRate);
+  }
+}
+// The VM should not create a real audio driver. The main application
+// will create the "real" AudioOut module and link it to the VM.
+// We create one in test mode here so it exists as a module instance,
+// but it won't try to open an audio device.
+template <>
+DSPModule* construct<AudioOut>(void* storage, float sampleRate, size_t) {
+  return new (storage) AudioOut(sampleRate, true);
+}
+template <typename T>
+DSPModule* relocate(void* storage, DSPModule& source) {
+  if constexpr (kHasLanes<T>) {
+    return new (storage) T(std::move(static_cast<T&>(source)), lane_storage<T>(storage));
+  } else {
+    return new (storage) T(std::move(static_cast<T&>(source)));
+  }
+}
+template <typename T>
+constexpr DSPModule* (*relocator())(void*, DSPModule&) {
+  if constexpr (kHasLanes<T> || std::is_move_constructible_v<T>) {
+    return &relocate<T>;
+  } else {
+    return nullptr;
+  }
+}
+template <typename T>
+std::unique_ptr<DSPModule> create(float sampleRate) {
+  return std::make_unique<T>(sampleRate);
+}
+template <>
+std::unique_ptr<DSPModule> create<AudioOut>(float sampleRate) {
+  return std::make_unique<AudioOut>(sampleRate, true);
+}
+template <typename T>
+constexpr std::unique_ptr<DSPModule> (*creator())(float) {
+  if constexpr (kHasLanes<T>) {
+    return nullptr;
+  } else {
+    return &create<T>;
+  }
+}
+struct ModuleEntry {
+  ModuleDescriptor descriptor;
+  // Null for modules with lane state.
+  std::unique_ptr<DSPModule> (*create)(float sampleRate);
+};
+template <typename T>
+constexpr ModuleEntry describe(uint32_t id) {
+  if constexpr (kHasLanes<T>) {
+    using LaneState = typename LaneStateOf<T>::type;
+    return { { id, sizeof(T), std::max(alignof(T), alignof(LaneState)), lane_offset<T>(), sizeof(LaneState),
+               &construct<T>, relocator<T>() }, creator<T>() };
+  } else {
+    return { { id, sizeof(T), alignof(T), sizeof(T), 0, &construct<T>, relocator<T>() }, creator<T>() };
+  }
+}
+// Map module IDs to their implementations based on data/modules.json
+const ModuleEntry kModuleEntries[] = {
+  describe<AudioOut>(1),      // audio_out (0x001)
+  describe<SineGen>(256),     // sine_gen (0x100)
+  describe<SawGen>(257),      // saw_gen (0x101)
+  describe<PulseGen>(258),    // pulse_gen (0x102)
+  describe<PhasorGen>(259),   // phasor_gen (0x103 - temporary, not in spec)
+  describe<Lopass>(512),      // lopass (0x200)
+  describe<Hipass>(513),      // hipass (0x201)
+  describe<Bandpass>(514),    // bandpass (0x202)
+  describe<Biquad>(516),      // biquad (0x204)
+  describe<Add>(1024),        // add (0x400)
+  describe<Mul>(1025),        // mul (0x401)
+  describe<Gain>(1027),       // gain (0x403)
+  describe<Float>(1028),      // float (0x404)
+  describe<Int>(1029),        // int (0x405)
+  describe<VoiceMix>(1030),   // voice_mix (0x406)
+  describe<Threshold>(1280),  // threshold (0x500)
+  describe<ADSR>(1536),       // adsr (0x600)
+  describe<PolyVoiceController>(1537), // voice_controller (0x601), one voice
+  // Polyphonic variants, run by PROC_POLY
+  describe<PolySineGen>(256 | kPolyVariant),
+  describe<PolySawGen>(257 | kPolyVariant),
+  describe<PolyLopass>(512 | kPolyVariant),
+  describe<PolyGain>(1027 | kPolyVariant),
+  describe<PolyADSR>(1536 | kPolyVariant),
+  describe<PolyVoiceController>(1537 | kPolyVariant),
+};
+const ModuleEntry& find_entry(uint32_t module_id) {
+  for (const auto& entry : kModuleEntries) {
+    if (entry.descriptor.id == module_id) {
+      return entry;
+    }
+  }
+  throw std::runtime_error("Unknown module ID: " + std::to_string(module_id));
+}
+} // namespace
+const ModuleDescriptor& get_module_descriptor(uint32_t module_id) {
+  return find_entry(module_id).descriptor;
+}
+std::unique_ptr<DSPModule> create_module(uint32_t module_id, float sampleRate) {
+  const ModuleEntry& entry = find_entry(module_id);
+  if (!entry.create) {
+    throw std::runtime_error("Module ID " + std::to_string(module_id) + " needs lane storage from a ModulePool");
+  }
+  return entry.create(sampleRate);
+}
+} // namespace madronavm::dsp
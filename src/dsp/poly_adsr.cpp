@@ -0,0 +1,44 @@
+#include "dsp/poly_adsr.h"
+#include "MLDSPOps.h" // For kFloatsPerDSPVector
+namespace madronavm::dsp {
+PolyADSR::PolyADSR(float sampleRate, void* laneStorage, size_t lanes)
+    : PolyModule(sampleRate), mADSRs(laneStorage, lanes) {
+    for (auto& adsr : mADSRs) {
+        adsr.clear();
+    }
+}
+PolyADSR::PolyADSR(PolyADSR&& other, void* laneStorage)
+    : PolyModule(std::move(other)), mADSRs(std::move(other.mADSRs), laneStorage) {}
+void PolyADSR::process(const float** inputs, int num_inputs, float** outputs, int num_outputs) {
+    const int lanes = validate_poly_ports(num_inputs, inputs, {0, 1, 2, 3, 4}, num_outputs, outputs,
+                                          mADSRs.size());
+    if (lanes == 0) return;
+    const float** gateIn = inputs;
+    const float** attackIn = inputs + lanes;
+    const float** decayIn = inputs + 2 * lanes;
+    const float** sustainIn = inputs + 3 * lanes;
+    const float** releaseIn = inputs + 4 * lanes;
+    // Like ADSR, coefficients come from the first sample of each parameter.
+    // Voices sharing all four parameters with the last processed voice
+    // share its calcCoeffs call.
+    int last = -1;
+    auto shares_params = [&](int lane) {
+        return last >= 0 && attackIn[lane] == attackIn[last] && decayIn[lane] == decayIn[last] &&
+               sustainIn[lane] == sustainIn[last] && releaseIn[lane] == releaseIn[last];
+    };
+    for (int lane = 0; lane < lanes; ++lane) {
+        if (!run_lane(lane, outputs)) continue;
+        if (shares_params(lane)) {
+            mADSRs[lane].coeffs = mADSRs[last].coeffs;
+        } else {
+            mADSRs[lane].coeffs = ml::ADSR::calcCoeffs(attackIn[lane][0], decayIn[lane][0], sustainIn[lane][0],
+                                                       releaseIn[lane][0], mSampleRate);
+        }
+        last = lane;
+        ml::DSPVector result = mADSRs[lane](ml::DSPVector(gateIn[lane]));
+        for (int i = 0; i < kFloatsPerDSPVector; ++i) {
+            outputs[lane][i] = result[i];
+        }
+    }
+}
+} // namespace madronavm::dsp
@@ -0,0 +1,18 @@
+#include "dsp/poly_gain.h"
+#include "MLDSPOps.h"
+#include "dsp/poly.h"
+namespace madronavm::dsp {
+PolyGain::PolyGain(float sampleRate) : PolyModule(sampleRate) {}
+void PolyGain::process(const float **inputs, int num_inputs, float **outputs, int num_outputs) {
+    const int lanes = validate_poly_ports(num_inputs, inputs, {0, 1}, num_outputs, outputs);
+    if (lanes == 0) return;
+    for (int lane = 0; lane < lanes; ++lane) {
+        if (!run_lane(lane, outputs)) continue;
+        const float* in = inputs[lane];
+        const float* gain = inputs[lanes + lane];
+        for (int i = 0; i < kFloatsPerDSPVector; ++i) {
+            outputs[lane][i] = in[i] * gain[i];
+        }
+    }
+}
+} // namespace madronavm::dsp
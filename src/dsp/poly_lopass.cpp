@@ -0,0 +1,36 @@
+#include "dsp/poly_lopass.h"
+#include "MLDSPFilters.h"
+namespace madronavm::dsp {
+PolyLopass::PolyLopass(float sampleRate, void* laneStorage, size_t lanes)
+    : PolyModule(sampleRate), mFilters(laneStorage, lanes) {}
+PolyLopass::PolyLopass(PolyLopass&& other, void* laneStorage)
+    : PolyModule(std::move(other)), mFilters(std::move(other.mFilters), laneStorage) {}
+void PolyLopass::process(const float** inputs, int num_inputs, float** outputs, int num_outputs) {
+    const int lanes = validate_poly_ports(num_inputs, inputs, {0, 1, 2}, num_outputs, outputs,
+                                          mFilters.size());
+    if (lanes == 0) return;
+    const float** cutoffIn = inputs + lanes;
+    const float** qIn = inputs + 2 * lanes;
+    // Coefficients as in Lopass, recomputed only when a lane's cutoff or Q
+    // buffer differs from the last processed lane's, so broadcast controls
+    // are converted once per block rather than once per voice.
+    const float* cutoff = nullptr;
+    const float* q = nullptr;
+    ml::DSPVector vOmega, vK;
+    for (int lane = 0; lane < lanes; ++lane) {
+        if (!run_lane(lane, outputs)) continue;
+        if (cutoffIn[lane] != cutoff || qIn[lane] != q) {
+            cutoff = cutoffIn[lane];
+            q = qIn[lane];
+            ml::DSPVector vCutoff(cutoffIn[lane]);
+            ml::DSPVector vQ(qIn[lane]);
+            vOmega = ml::clamp(vCutoff / mSampleRate, ml::DSPVector(0.0f), ml::DSPVector(0.49f));
+            vK = ml::DSPVector(1.0f) / ml::clamp(vQ, ml::DSPVector(0.1f), ml::DSPVector(100.0f));
+        }
+        ml::DSPVector v = mFilters[lane](ml::DSPVector(inputs[lane]), vOmega, vK);
+        for (int i = 0; i < kFloatsPerDSPVector; ++i) {
+            outputs[lane][i] = v[i];
+        }
+    }
+}
+} // namespace madronavm::dsp
@@ -0,0 +1,32 @@
+#include "dsp/poly_saw_gen.h"
+#include "MLDSPGens.h"
+namespace madronavm::dsp {
+PolySawGen::PolySawGen(float sampleRate, void* laneStorage, size_t lanes)
+    : PolyModule(sampleRate), mOscs(laneStorage, lanes) {
+  for (auto& osc : mOscs) {
+    osc.clear();
+  }
+}
+PolySawGen::PolySawGen(PolySawGen&& other, void* laneStorage)
+    : PolyModule(std::move(other)), mOscs(std::move(other.mOscs), laneStorage) {}
+void PolySawGen::process(const float** inputs, int num_inputs, float** outputs, int num_outputs) {
+  const int lanes = validate_poly_ports(num_inputs, inputs, {0}, num_outputs, outputs, mOscs.size());
+  if (lanes == 0) return;
+  const float sr = mSampleRate;
+  // A broadcast frequency is the same buffer in every lane: convert it once.
+  const float* freqIn = nullptr;
+  ml::DSPVector vFreq;
+  for (int lane = 0; lane < lanes; ++lane) {
+    if (!run_lane(lane, outputs)) continue;
+    if (inputs[lane] != freqIn) {
+      freqIn = inputs[lane];
+      vFreq = ml::DSPVector(freqIn);
+      vFreq /= sr;
+    }
+    ml::DSPVector v = mOscs[lane](vFreq);
+    for (int i = 0; i < kFloatsPerDSPVector; ++i) {
+      outputs[lane][i] = v[i];
+    }
+  }
+}
+} // namespace madronavm::dsp
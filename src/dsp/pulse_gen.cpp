@@ -2,16 +2,11 @@
 #include "MLDSPGens.h"
 #include "dsp/validation.h"
 namespace madronavm::dsp {
-struct PulseGen::Impl {
-  ml::PulseGen mOsc;
-  Impl() {
-    mOsc.clear();
-  }
-};
-PulseGen::PulseGen(float sampleRate) : DSPModule(sampleRate), pImpl(std::make_unique<Impl>()) {}
-PulseGen::~PulseGen() = default;
+PulseGen::PulseGen(float sampleRate) : DSPModule(sampleRate), mOsc() {
+  mOsc.clear();
+}
 void PulseGen::process(const float** inputs, int num_inputs, float** outputs, int num_outputs) {
-  if (!validate_ports("PulseGen", num_inputs, inputs, {0, 1}, num_outputs, 1)) return;
+  if (!validate_ports("PulseGen", num_inputs, inputs, {0, 1}, num_outputs, outputs, 1)) return;
   const float freq = inputs[0][0];
   const float width = inputs[1][0];
   const float sr = mSampleRate;
@@ -20,7 +15,7 @@ void PulseGen::process(const float** inputs, int num_inputs, float** outputs, in
   // pulse width from 0-1 (0.5 = square wave)
   ml::DSPVector vWidth(width);
   // process one vector of samples
-  ml::DSPVector v = pImpl->mOsc(vFreq, vWidth);
+  ml::DSPVector v = mOsc(vFreq, vWidth);
   // copy to output
   for(int i=0; i<kFloatsPerDSPVector; ++i) {
     outputs[0][i] = v[i];
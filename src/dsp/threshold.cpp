@@ -5,7 +5,7 @@ namespace madronavm::dsp {
 Threshold::Threshold(float sampleRate) : DSPModule(sampleRate) {
 }
 void Threshold::process(const float** inputs, int num_inputs, float** outputs, int num_outputs) {
-    if (!validate_ports("Threshold", num_inputs, inputs, {0, 1}, num_outputs, 1)) return;
+    if (!validate_ports("Threshold", num_inputs, inputs, {0, 1}, num_outputs, outputs, 1)) return;
     const float* signal = inputs[0];      // Input signal
     const float* threshold = inputs[1];   // Threshold value
     float* out = outputs[0];              // Output (0.0 or 1.0)
@@ -1,34 +1,309 @@
 #include "dsp/voice_controller.h"
+#include <algorithm>
+#include <cmath>
+#include <utility>
 namespace madronavm::dsp {
 VoiceController::VoiceController(float sampleRate)
-    : DSPModule(sampleRate), mEventProcessor(sampleRate) {
-  mEventProcessor.setPolyphony(kMaxVoices);
-  mEventProcessor.setGlideTimeInSeconds(0.0f);
+    : VoiceController(sampleRate, false) {}
+VoiceController::VoiceController(float sampleRate, bool laneMajor)
+    : DSPModule(sampleRate), mLaneMajor(laneMajor) {
+  // Every voice starts idle and unwritten, so the first block silences all.
+  for (size_t v = 0; v < kMaxVoices; ++v) {
+    mStale[v] = static_cast<uint8_t>(v);
+    mVoices[v].stale = true;
+  }
+  mNumStale = kMaxVoices;
+}
+void VoiceController::setPolyphony(size_t voices) {
+  mPolyphony = std::clamp<size_t>(voices, 1, kMaxVoices);
+  for (size_t i = mNumActive; i-- > 0;) {
+    if (mActive[i] >= mPolyphony) {
+      deactivate(mActive[i]);
+    }
+  }
+}
+void VoiceController::setReleaseTime(float seconds) {
+  mReleaseSamples = static_cast<int64_t>(std::ceil(std::max(seconds, 0.0f) * mSampleRate));
 }
 void VoiceController::process(const float** inputs, int num_inputs, float** outputs, int num_outputs) {
-  // Add our queued events to the processor's buffer.
-  for(const auto& e : mEventQueue) {
-    mEventProcessor.addEvent(e);
-  }
-  mEventQueue.clear();
-  // Process the vector. This will handle all event logic.
-  // NOTE: The VM doesn't provide a startOffset, so we assume 0 for now.
-  // This is sufficient for simple cases but may not be for more advanced sequencing.
-  mEventProcessor.processVector(0);
-  // Copy the results to our module's output buffers.
-  for (int v = 0; v < kMaxVoices; ++v) {
-    const auto& voice = mEventProcessor.getVoice(v);
-    for (int i = 0; i < kNumOutputsPerVoice; ++i) {
-      int output_idx = v * kNumOutputsPerVoice + i;
-      if (output_idx < num_outputs) {
-        const float* voiceOutput = voice.outputs.getRowDataConst(i);
-        float* moduleOutput = outputs[output_idx];
-        if (moduleOutput) {
-          for (int s = 0; s < kFloatsPerDSPVector; ++s) {
-            moduleOutput[s] = voiceOutput[s];
-          }
-        }
+  if (mLaneMajor) {
+    const size_t lanes = static_cast<size_t>(num_outputs) / kNumOutputsPerVoice;
+    if (lanes != mPolyphony) {
+      setPolyphony(lanes);
+    }
+  }
+  // The release input, broadcast to every lane, is read once per block.
+  if (num_inputs > 0 && inputs[0]) {
+    setReleaseTime(inputs[0][0]);
+  }
+  // Events split the block so that each takes effect at its own sample; a
+  // block without events is rendered in one piece.
+  // Insertion sort by time: stable, allocation free, and events from the
+  // VM arrive in order already.
+  for (size_t i = 1; i < mNumEvents; ++i) {
+    for (size_t j = i; j > 0 && mEvents[j - 1].time > mEvents[j].time; --j) {
+      std::swap(mEvents[j - 1], mEvents[j]);
+    }
+  }
+  int begin = 0;
+  for (size_t i = 0; i < mNumEvents; ++i) {
+    const int offset = std::clamp(mEvents[i].time, 0, kFloatsPerDSPVector - 1);
+    if (offset > begin) {
+      render(outputs, num_outputs, begin, offset);
+      begin = offset;
+    }
+    applyEvent(mEvents[i], offset);
+  }
+  mNumEvents = 0;
+  render(outputs, num_outputs, begin, kFloatsPerDSPVector);
+  // Idle voices are silent now until they are taken again, except those
+  // that went idle part way through this block: the next block still
+  // holds their old samples before that point.
+  size_t kept = 0;
+  for (size_t i = 0; i < mNumStale; ++i) {
+    Voice& voice = mVoices[mStale[i]];
+    if (voice.idle_from > 0 && !voice.active) {
+      voice.idle_from = 0;
+      mStale[kept++] = mStale[i];
+    } else {
+      voice.stale = false;
+    }
+  }
+  mNumStale = kept;
+  mBusy.clear();
+  for (size_t i = 0; i < mNumActive; ++i) {
+    mBusy.insert(mActive[i]);
+  }
+  for (size_t i = 0; i < mNumStale; ++i) {
+    mBusy.insert(mStale[i]);
+  }
+  // Voices whose release has run out are done after this block.
+  for (size_t i = mNumActive; i-- > 0;) {
+    Voice& voice = mVoices[mActive[i]];
+    if (!voice.gate) {
+      voice.release_left -= kFloatsPerDSPVector;
+      if (voice.release_left <= 0) {
+        deactivate(mActive[i]);
+      }
+    }
+  }
+  mClock += kFloatsPerDSPVector;
+}
+// Writes samples [begin, end) of the block. Only active voices and voices
+// that went idle since the last block are touched; the rest cost nothing.
+void VoiceController::render(float** outputs, int num_outputs, int begin, int end) const {
+  for (size_t i = 0; i < mNumStale; ++i) {
+    const size_t v = mStale[i];
+    if (mVoices[v].active) continue; // Taken again since; written below.
+    for (size_t row = 0; row < kNumOutputsPerVoice; ++row) {
+      const size_t output_idx = outputIndex(v, row, num_outputs);
+      if (output_idx < static_cast<size_t>(num_outputs) && outputs[output_idx]) {
+        std::fill(outputs[output_idx] + begin, outputs[output_idx] + end, 0.0f);
+      }
+    }
+  }
+  for (size_t i = 0; i < mNumActive; ++i) {
+    writeVoice(mActive[i], outputs, num_outputs, begin, end);
+  }
+}
+size_t VoiceController::outputIndex(size_t voice, size_t row, int num_outputs) const {
+  if (mLaneMajor) {
+    return row * (static_cast<size_t>(num_outputs) / kNumOutputsPerVoice) + voice;
+  }
+  return voice * kNumOutputsPerVoice + row;
+}
+void VoiceController::handle_event(const ml::Event& event) {
+  if (mNumEvents == mEvents.size()) {
+    // Too many for one block: apply those queued so far at its start, in
+    // order, giving up sample accuracy for them.
+    for (size_t i = 0; i < mNumEvents; ++i) {
+      applyEvent(mEvents[i], 0);
+    }
+    mNumEvents = 0;
+  }
+  mEvents[mNumEvents++] = event;
+}
+void VoiceController::applyEvent(const ml::Event& event, int offset) {
+  switch (event.type) {
+  case ml::kNoteOn:
+    startNote(event, offset);
+    break;
+  case ml::kNoteOff:
+    endNote(event, offset);
+    break;
+  case ml::kPitchWheel:
+    mBend = std::clamp(event.value1, -1.0f, 1.0f);
+    break;
+  case ml::kNotePressure:
+    for (size_t i = 0; i < mNumActive; ++i) {
+      Voice& voice = mVoices[mActive[i]];
+      if (voice.pitch == static_cast<int>(event.value1)) {
+        voice.pressure = event.value2;
+      }
+    }
+    break;
+  case ml::kChannelPressure:
+    mChannelPressure = event.value1;
+    for (size_t i = 0; i < mNumActive; ++i) {
+      mVoices[mActive[i]].pressure = event.value1;
+    }
+    break;
+  case ml::kController:
+    switch (static_cast<int>(event.value1)) {
+    case 1:
+      mModulation = event.value2;
+      break;
+    case 64:
+      setSustain(event.value2 >= 0.5f, offset);
+      break;
+    case 74:
+      mTimbre = event.value2;
+      break;
+    default:
+      ++mNumIgnored;
+      break;
+    }
+    break;
+  case ml::kSustainPedal:
+    setSustain(event.value1 >= 0.5f, offset);
+    break;
+  default:
+    ++mNumIgnored;
+    break;
+  }
+}
+void VoiceController::startNote(const ml::Event& e, int offset) {
+  const size_t v = chooseVoice(static_cast<int>(e.value1));
+  Voice& voice = mVoices[v];
+  voice.pitch = static_cast<int>(e.value1);
+  voice.velocity = e.value2;
+  voice.pressure = mChannelPressure;
+  voice.gate = true;
+  voice.sustained = false;
+  voice.start = mClock + offset;
+  voice.release_left = 0;
+  activate(v);
+}
+void VoiceController::endNote(const ml::Event& e, int offset) {
+  for (size_t i = mNumActive; i-- > 0;) {
+    const size_t v = mActive[i];
+    Voice& voice = mVoices[v];
+    if (voice.gate && voice.pitch == static_cast<int>(e.value1)) {
+      if (mSustain) {
+        voice.sustained = true;
+      } else {
+        releaseVoice(v, offset);
+      }
+    }
+  }
+}
+void VoiceController::releaseVoice(size_t v, int offset) {
+  Voice& voice = mVoices[v];
+  voice.gate = false;
+  voice.sustained = false;
+  // Counted from the end of this block, which is offset samples in.
+  voice.release_left = mReleaseSamples + offset;
+  if (mReleaseSamples == 0) {
+    deactivate(v, offset);
+  }
+}
+// Lifting the pedal releases the notes it held.
+void VoiceController::setSustain(bool down, int offset) {
+  mSustain = down;
+  if (down) return;
+  for (size_t i = mNumActive; i-- > 0;) {
+    if (mVoices[mActive[i]].sustained) {
+      releaseVoice(mActive[i], offset);
+    }
+  }
+}
+// A voice already playing the pitch is retriggered. Otherwise the lowest
+// idle voice is taken, and failing that the oldest releasing voice, then
+// the oldest held one.
+size_t VoiceController::chooseVoice(int pitch) const {
+  for (size_t i = 0; i < mNumActive; ++i) {
+    if (mVoices[mActive[i]].pitch == pitch) {
+      return mActive[i];
+    }
+  }
+  if (mNumActive < mPolyphony) {
+    for (size_t v = 0; v < mPolyphony; ++v) {
+      if (!mVoices[v].active) {
+        return v;
+      }
+    }
+  }
+  size_t oldest = mActive[0];
+  for (size_t i = 1; i < mNumActive; ++i) {
+    const Voice& candidate = mVoices[mActive[i]];
+    const Voice& current = mVoices[oldest];
+    if (candidate.gate != current.gate ? !candidate.gate : candidate.start < current.start) {
+      oldest = mActive[i];
+    }
+  }
+  return oldest;
+}
+void VoiceController::activate(size_t voice) {
+  if (mVoices[voice].active) return;
+  mVoices[voice].active = true;
+  mActiveIndex[voice] = static_cast<uint8_t>(mNumActive);
+  mActive[mNumActive++] = static_cast<uint8_t>(voice);
+}
+void VoiceController::deactivate(size_t voice, int offset) {
+  if (!mVoices[voice].active) return;
+  // Swap the last active voice into this one's place.
+  const uint8_t last = mActive[--mNumActive];
+  mActive[mActiveIndex[voice]] = last;
+  mActiveIndex[last] = mActiveIndex[voice];
+  const bool listed = mVoices[voice].stale;
+  mVoices[voice] = Voice{};
+  mVoices[voice].stale = true;
+  mVoices[voice].idle_from = offset;
+  if (!listed) {
+    mStale[mNumStale++] = static_cast<uint8_t>(voice);
+  }
+}
+void VoiceController::writeVoice(size_t v, float** outputs, int num_outputs, int begin, int end) const {
+  const Voice& voice = mVoices[v];
+  const int64_t started = static_cast<int64_t>(voice.start) - static_cast<int64_t>(mClock);
+  for (size_t row = 0; row < kNumOutputsPerVoice; ++row) {
+    const size_t output_idx = outputIndex(v, row, num_outputs);
+    if (output_idx >= static_cast<size_t>(num_outputs) || !outputs[output_idx]) continue;
+    float* out = outputs[output_idx];
+    switch (row) {
+    case ml::kGate:
+      std::fill(out + begin, out + end, voice.gate ? voice.velocity : 0.0f);
+      break;
+    case ml::kPitch:
+      std::fill(out + begin, out + end, static_cast<float>(voice.pitch) + mBend * mBendRange);
+      break;
+    case ml::kVelocity:
+      std::fill(out + begin, out + end, voice.velocity);
+      break;
+    case ml::kVoice:
+      std::fill(out + begin, out + end, static_cast<float>(v));
+      break;
+    case ml::kAftertouch:
+    case ml::kZ:
+      std::fill(out + begin, out + end, voice.pressure);
+      break;
+    case ml::kModulation:
+      std::fill(out + begin, out + end, mModulation);
+      break;
+    case ml::kX:
+      std::fill(out + begin, out + end, mBend);
+      break;
+    case ml::kY:
+      std::fill(out + begin, out + end, mTimbre);
+      break;
+    case ml::kElapsedTime:
+      for (int s = begin; s < end; ++s) {
+        out[s] = static_cast<float>(s - started) / mSampleRate;
       }
+      break;
+    default:
+      std::fill(out + begin, out + end, 0.0f);
+      break;
     }
   }
 }
@@ -40,7 +315,7 @@ void VoiceController::noteOn(int pitch, int velocity, int voice, int time) {
   e.value2 = static_cast<float>(velocity) / 127.0f;
   e.time = time;
   e.channel = voice;
-  mEventQueue.push_back(e);
+  handle_event(e);
 }
 void VoiceController::noteOff(int pitch, int velocity, int voice, int time) {
   ml::Event e;
@@ -50,6 +325,6 @@ void VoiceController::noteOff(int pitch, int velocity, int voice, int time) {
   e.value2 = static_cast<float>(velocity) / 127.0f;
   e.time = time;
   e.channel = voice;
-  mEventQueue.push_back(e);
+  handle_event(e);
 }
-} // namespace madronavm::dsp 
\ No newline at end of file
+} // namespace madronavm::dsp
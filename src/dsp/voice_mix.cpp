@@ -0,0 +1,23 @@
+#include "dsp/voice_mix.h"
+#include "MLDSPOps.h"
+#include "dsp/validation.h"
+namespace madronavm::dsp {
+VoiceMix::VoiceMix(float sampleRate) : DSPModule(sampleRate) {}
+void VoiceMix::process(const float **inputs, int num_inputs, float **outputs, int num_outputs) {
+    if (!validate_ports("VoiceMix", num_inputs, inputs, {}, num_outputs, outputs, 1)) return;
+    float* out = outputs[0];
+    for (int i = 0; i < kFloatsPerDSPVector; ++i) {
+        out[i] = 0.0f;
+    }
+    // Summed voice by voice, in order, as a chain of add modules would.
+    bool first = true;
+    for (int v = 0; v < num_inputs; ++v) {
+        const float* in = inputs[v];
+        if (in == nullptr) continue;
+        for (int i = 0; i < kFloatsPerDSPVector; ++i) {
+            out[i] = first ? in[i] : out[i] + in[i];
+        }
+        first = false;
+    }
+}
+} // namespace madronavm::dsp
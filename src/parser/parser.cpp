@@ -32,14 +32,23 @@ PatchGraph parse_json(std::string_view json_text) {
             if (id_item) node.id = id_item->valueint;
             cJSON* name_item = cJSON_GetObjectItem(module_item, "name");
             if (name_item) node.name = name_item->valuestring;
+            cJSON* voices_item = cJSON_GetObjectItem(module_item, "voices");
+            if (voices_item && voices_item->type == cJSON_Number && voices_item->valueint > 1) {
+                node.voices = voices_item->valueint;
+            }
             cJSON* data = cJSON_GetObjectItem(module_item, "data");
             if (data && data->type == cJSON_Object) {
                 cJSON* constant_item = data->child;
                 while (constant_item) {
-                    node.constants.push_back({
-                        constant_item->string,
-                        (float)constant_item->valuedouble
-                    });
+                    ConstantInput constant{constant_item->string, (float)constant_item->valuedouble, {}};
+                    // An array holds one value per voice.
+                    if (constant_item->type == cJSON_Array) {
+                        for (cJSON* v = constant_item->child; v; v = v->next) {
+                            constant.voice_values.push_back((float)v->valuedouble);
+                        }
+                        constant.value = constant.voice_values.empty() ? 0.0f : constant.voice_values[0];
+                    }
+                    node.constants.push_back(constant);
                     constant_item = constant_item->next;
                 }
             }
@@ -0,0 +1,78 @@
+#include "vm/memory_arena.h"
+#include "common/embedded_logging.h"
+#include <cstdint>
+#include <cstring>
+#include <new>
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define MADRONA_HAS_MMAP 1
+#endif
+namespace madronavm {
+namespace {
+size_t align_up(size_t offset, size_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+} // namespace
+MemoryArena::~MemoryArena() {
+  release();
+}
+void MemoryArena::allocate(size_t bytes, const MemoryOptions& options) {
+  release();
+  if (bytes == 0) {
+    return;
+  }
+#if defined(MADRONA_HAS_MMAP)
+  // Anonymous mappings are page aligned, which covers the cache line; a
+  // huge page needs a wider mapping to align within.
+  const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  const size_t alignment = options.huge_pages ? kHugePageSize : page_size;
+  m_size = align_up(bytes, alignment);
+  m_mapping_size = m_size + (alignment > page_size ? alignment : 0);
+  m_mapping = mmap(nullptr, m_mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (m_mapping == MAP_FAILED) {
+    m_mapping = nullptr;
+    m_mapping_size = 0;
+    m_size = 0;
+    throw std::bad_alloc();
+  }
+  m_data = reinterpret_cast<void*>(align_up(reinterpret_cast<uintptr_t>(m_mapping), alignment));
+#if defined(MADV_HUGEPAGE)
+  // Advice only: the kernel may still back the arena with small pages.
+  m_huge_pages = options.huge_pages && madvise(m_data, m_size, MADV_HUGEPAGE) == 0;
+#endif
+#else
+  m_size = align_up(bytes, kCacheLineSize);
+  m_data = ::operator new(m_size, std::align_val_t(kCacheLineSize));
+#endif
+  // First touch here rather than on the audio thread.
+  std::memset(m_data, 0, m_size);
+#if defined(MADRONA_HAS_MMAP)
+  if (options.lock) {
+    m_locked = mlock(m_data, m_size) == 0;
+    if (!m_locked) {
+      MADRONA_VM_LOG_WARN("Cannot lock %u bytes of program memory", (uint32_t)m_size);
+    }
+  }
+#endif
+}
+void MemoryArena::release() {
+  if (!m_data) {
+    return;
+  }
+#if defined(MADRONA_HAS_MMAP)
+  if (m_locked) {
+    munlock(m_data, m_size);
+  }
+  munmap(m_mapping, m_mapping_size);
+#else
+  ::operator delete(m_data, std::align_val_t(kCacheLineSize));
+#endif
+  m_data = nullptr;
+  m_size = 0;
+  m_mapping = nullptr;
+  m_mapping_size = 0;
+  m_huge_pages = false;
+  m_locked = false;
+}
+} // namespace madronavm
@@ -0,0 +1,73 @@
+#include "vm/module_pool.h"
+#include <algorithm>
+namespace madronavm {
+namespace {
+size_t align_up(size_t offset, size_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+} // namespace
+ModulePool::~ModulePool() {
+  clear();
+}
+size_t ModulePool::plan(const std::vector<uint32_t>& module_ids, const std::vector<uint32_t>& lanes) {
+  clear();
+  m_descriptors.reserve(module_ids.size());
+  m_offsets.reserve(module_ids.size());
+  m_lanes.reserve(module_ids.size());
+  size_t alignment = kCacheLineSize;
+  size_t total = 0;
+  try {
+    for (size_t slot = 0; slot < module_ids.size(); ++slot) {
+      const auto& descriptor = dsp::get_module_descriptor(module_ids[slot]);
+      const size_t module_alignment = std::max(kCacheLineSize, descriptor.alignment);
+      total = align_up(total, module_alignment);
+      m_descriptors.push_back(&descriptor);
+      m_offsets.push_back(total);
+      m_lanes.push_back(slot < lanes.size() ? lanes[slot] : 1);
+      total += descriptor.storage_size(m_lanes.back());
+      alignment = std::max(alignment, module_alignment);
+    }
+  } catch (...) {
+    clear();
+    throw;
+  }
+  m_alignment = alignment;
+  return align_up(total, kCacheLineSize);
+}
+void ModulePool::build(void* storage, float sampleRate, const std::vector<bool>& deferred) {
+  m_storage = storage;
+  // Deferred slots stay null until filled, so clear() can tell them apart.
+  m_modules.assign(m_descriptors.size(), nullptr);
+  try {
+    for (size_t slot = 0; slot < m_descriptors.size(); ++slot) {
+      if (slot < deferred.size() && deferred[slot]) {
+        continue;
+      }
+      m_modules[slot] = m_descriptors[slot]->construct(slot_storage(slot), sampleRate, m_lanes[slot]);
+    }
+  } catch (...) {
+    clear();
+    throw;
+  }
+}
+void ModulePool::relocate(size_t slot, dsp::DSPModule& source) {
+  m_modules[slot] = m_descriptors[slot]->relocate(slot_storage(slot), source);
+}
+void ModulePool::construct(size_t slot, float sampleRate) {
+  m_modules[slot] = m_descriptors[slot]->construct(slot_storage(slot), sampleRate, m_lanes[slot]);
+}
+void ModulePool::clear() {
+  // Destroy in reverse construction order.
+  for (auto it = m_modules.rbegin(); it != m_modules.rend(); ++it) {
+    if (*it) {
+      (*it)->~DSPModule();
+    }
+  }
+  m_modules.clear();
+  m_descriptors.clear();
+  m_offsets.clear();
+  m_lanes.clear();
+  m_storage = nullptr;
+  m_alignment = kCacheLineSize;
+}
+} // namespace madronavm
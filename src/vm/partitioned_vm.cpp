@@ -0,0 +1,190 @@
+// Independent partitions of one patch, rendered concurrently and mixed
+#include "vm/partitioned_vm.h"
+#include <algorithm>
+#include <cstring>
+namespace madronavm {
+namespace {
+// Adds source to dest. Kept as a flat loop over plain float pointers so the
+// compiler vectorises it.
+void mix_into(float* dest, const float* source, int num_frames) {
+  for (int i = 0; i < num_frames; ++i) {
+    dest[i] += source[i];
+  }
+}
+} // namespace
+PartitionedVM::PartitionedVM(const ModuleRegistry& registry, float sampleRate, bool testMode)
+  : m_registry(registry), m_sampleRate(sampleRate), m_testMode(testMode) {}
+PartitionedVM::~PartitionedVM() {
+  // The audio thread must have stopped calling process() by now.
+  if (Layout* unclaimed = m_pending_layout.exchange(nullptr)) {
+    discard_layout(unclaimed);
+  }
+  if (m_active_layout) {
+    for (const Partition& partition : m_active_layout->partitions) {
+      delete partition.program;
+    }
+    delete m_active_layout;
+  }
+  collect_retired_layouts();
+}
+void PartitionedVM::load_partitions(const std::vector<std::vector<uint32_t>>& programs) {
+  collect_retired_layouts();
+  // Take back a layout the audio thread has not picked up yet, as
+  // VM::load_program does a program; its programs are the ones each VM
+  // prepared last, so they go back too.
+  if (Layout* unclaimed = m_pending_layout.exchange(nullptr, std::memory_order_acq_rel)) {
+    m_published_layout = unclaimed->replaced;
+    discard_layout(unclaimed);
+  }
+  auto layout = std::make_unique<Layout>();
+  layout->replaced = m_published_layout;
+  layout->partitions.reserve(programs.size());
+  for (size_t i = 0; i < programs.size(); ++i) {
+    if (i == m_vms.size()) {
+      m_vms.push_back(std::make_unique<VM>(m_registry, m_sampleRate, m_testMode));
+    }
+    VM* vm = m_vms[i].get();
+    vm->set_memory_options(m_memory_options);
+    Partition partition{vm, vm->prepare_program(programs[i]), {}};
+    layout->num_output_channels = std::max(layout->num_output_channels, vm->num_output_channels());
+    // Channels a partition does not write stay silent.
+    partition.scratch.assign(Program::kMaxOutputChannels * kMaxFramesPerPass, 0.0f);
+    layout->partitions.push_back(std::move(partition));
+  }
+  m_published_layout = layout.get();
+  m_pending_layout.store(layout.release(), std::memory_order_release);
+}
+void PartitionedVM::collect_retired_layouts() {
+  // A layout is only retired once all its programs were handed over.
+  Layout* retired = nullptr;
+  while (m_retired_layouts.try_pop(retired)) {
+    delete retired;
+  }
+  for (const auto& vm : m_vms) {
+    vm->collect_retired_programs();
+  }
+}
+void PartitionedVM::discard_layout(Layout* layout) {
+  for (auto it = layout->partitions.rbegin(); it != layout->partitions.rend(); ++it) {
+    it->vm->discard_program(it->program);
+  }
+  delete layout;
+}
+size_t PartitionedVM::num_partitions() const {
+  return m_published_layout ? m_published_layout->partitions.size() : 0;
+}
+bool PartitionedVM::post_event(uint32_t node_id, const ml::Event& event) {
+  if (m_published_layout) {
+    for (const Partition& partition : m_published_layout->partitions) {
+      if (partition.vm->has_node(node_id)) {
+        return partition.vm->post_event(node_id, event);
+      }
+    }
+  }
+  return false;
+}
+bool PartitionedVM::set_parameter(uint32_t node_id, const std::string& port, float value,
+                                  uint32_t ramp_blocks) {
+  if (m_published_layout) {
+    for (const Partition& partition : m_published_layout->partitions) {
+      if (partition.vm->has_node(node_id)) {
+        return partition.vm->set_parameter(node_id, port, value, ramp_blocks);
+      }
+    }
+  }
+  return false;
+}
+void PartitionedVM::set_worker_pool(WorkerPool* pool) {
+  m_worker_pool.store(pool, std::memory_order_release);
+}
+void PartitionedVM::adopt_pending_layout() {
+  // A program its VM could not take yet, because the VM had not switched
+  // to the one before, is offered again; until every partition has taken
+  // its program, the layout stays for one more block, so the next one
+  // never starts with a partition behind.
+  if (m_active_layout) {
+    bool waiting = false;
+    for (Partition& partition : m_active_layout->partitions) {
+      if (partition.program) {
+        waiting = true;
+        if (partition.vm->publish_program(partition.program)) {
+          partition.program = nullptr;
+        }
+      }
+    }
+    if (waiting) {
+      return;
+    }
+  }
+  if (m_pending_layout.load(std::memory_order_relaxed) == nullptr) {
+    return;
+  }
+  // As VM::adopt_pending_program: keep the current layout one more block
+  // rather than leak it.
+  if (m_active_layout && !m_retired_layouts.can_push()) {
+    return;
+  }
+  Layout* next = m_pending_layout.exchange(nullptr, std::memory_order_acq_rel);
+  if (!next) {
+    return;
+  }
+  if (m_active_layout) {
+    m_retired_layouts.try_push(m_active_layout);
+  }
+  m_active_layout = next;
+  // Each VM switches when it processes this block.
+  for (Partition& partition : next->partitions) {
+    if (partition.vm->publish_program(partition.program)) {
+      partition.program = nullptr;
+    }
+  }
+}
+void PartitionedVM::process(const float** inputs, float** outputs, int num_frames) {
+  (void)inputs; // No audio inputs yet.
+  // Block boundary: the only point at which the partitions change.
+  adopt_pending_layout();
+  Layout* layout = m_active_layout;
+  WorkerPool* pool = m_worker_pool.load(std::memory_order_acquire);
+  const size_t num_partitions = layout ? layout->partitions.size() : 0;
+  // Stereo silence without partitions, as VM renders without a program.
+  const size_t max_channels = num_partitions == 0 ? 2 : layout->num_output_channels;
+  size_t num_channels = 0;
+  while (outputs && num_channels < max_channels && outputs[num_channels]) {
+    ++num_channels;
+  }
+  for (int done = 0; done < num_frames;) {
+    const int frames = std::min(num_frames - done, kMaxFramesPerPass);
+    PassContext pass{layout, num_channels, frames};
+    const uint32_t count = static_cast<uint32_t>(num_partitions);
+    if (pool) {
+      pool->parallel_for(&PartitionedVM::render_partition, &pass, count);
+    } else {
+      for (uint32_t p = 0; p < count; ++p) {
+        render_partition(&pass, p);
+      }
+    }
+    // Final mix: the only point where partitions meet.
+    for (size_t c = 0; c < num_channels; ++c) {
+      float* dest = outputs[c] + done;
+      if (num_partitions == 0) {
+        std::fill(dest, dest + frames, 0.0f);
+        continue;
+      }
+      std::memcpy(dest, scratch_channel(layout->partitions[0], c), frames * sizeof(float));
+      for (size_t p = 1; p < num_partitions; ++p) {
+        mix_into(dest, scratch_channel(layout->partitions[p], c), frames);
+      }
+    }
+    done += frames;
+  }
+}
+void PartitionedVM::render_partition(void* context, uint32_t index) {
+  auto* pass = static_cast<PassContext*>(context);
+  Partition& partition = pass->layout->partitions[index];
+  std::array<float*, Program::kMaxOutputChannels + 1> outputs{};
+  for (size_t c = 0; c < pass->num_channels; ++c) {
+    outputs[c] = scratch_channel(partition, c);
+  }
+  partition.vm->process(nullptr, outputs.data(), pass->num_frames);
+}
+} // namespace madronavm
@@ -0,0 +1,1094 @@
+// Loaded program: decoding and execution of one bytecode image
+#include "vm/program.h"
+#include "vm/opcodes.h"
+#include "dsp/module_factory.h"
+#include "dsp/poly.h"
+#include "common/embedded_logging.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <new>
+#include <unordered_map>
+#include <utility>
+namespace madronavm {
+constexpr uint32_t kNullRegister = std::numeric_limits<uint32_t>::max();
+namespace {
+// The input count of a PROC_Nx1 form; 0 for the PROC forms that carry
+// their counts.
+uint32_t fixed_arity(OpCode opcode) {
+  switch (opcode) {
+  case OpCode::PROC_1x1: return 1;
+  case OpCode::PROC_2x1: return 2;
+  case OpCode::PROC_3x1: return 3;
+  case OpCode::PROC_5x1: return 5;
+  default: return 0;
+  }
+}
+} // namespace
+Program::Program(std::vector<uint32_t> bytecode, float sampleRate, const Program* previous,
+                 const MemoryOptions& memory)
+  : m_bytecode(std::move(bytecode)), m_replaced(previous), m_sampleRate(sampleRate) {
+  if (m_bytecode.size() < sizeof(BytecodeHeader) / sizeof(uint32_t)) {
+    uint32_t required_size = sizeof(BytecodeHeader) / sizeof(uint32_t);
+    MADRONA_VM_LOG_ERROR("Bytecode too small: %u words, need %u",
+                         (uint32_t)m_bytecode.size(), required_size);
+    clear();
+    return;
+  }
+  auto* header = reinterpret_cast<const BytecodeHeader*>(m_bytecode.data());
+  if (header->magic_number != kMagicNumber) {
+    MADRONA_VM_LOG_ERROR("Invalid magic number: got 0x%08X, expected 0x%08X",
+                         header->magic_number, kMagicNumber);
+    clear();
+    return;
+  }
+  if (header->version != kBytecodeVersion) {
+    MADRONA_VM_LOG_ERROR("Version mismatch: got %u, expected %u",
+                         header->version, kBytecodeVersion);
+    clear();
+    return;
+  }
+  m_num_registers = header->num_registers;
+  if (!decode(previous, memory)) {
+    clear();
+  }
+}
+void Program::clear() {
+  m_bytecode.clear();
+  m_module_pool.clear();
+  m_instructions.clear();
+  m_input_ptrs.clear();
+  m_output_ptrs.clear();
+  m_registers = nullptr;
+  m_num_registers = 0;
+  m_arena.release();
+  m_slot_node_ids.clear();
+  m_slot_module_ids.clear();
+  m_slot_instructions.clear();
+  m_node_slots.clear();
+  m_slot_ports.clear();
+  m_port_registers.clear();
+  m_native_nodes.clear();
+  m_lane_followers.clear();
+  m_lane_feeders.clear();
+  m_ramps.clear();
+  m_migrations.clear();
+  m_constants.clear();
+  m_num_output_channels = 0;
+  m_level_starts.clear();
+  m_stage_starts.clear();
+  m_delay_lines.clear();
+  m_delay_registers.clear();
+  m_latency_blocks = 0;
+}
+// Translates m_bytecode into m_instructions and constructs the module
+// for every PROC slot in m_module_pool, apart from those that will migrate
+// from previous. Every operand is bounds checked here,
+// once, so the handlers can trust their pointers. Pointer arrays live in
+// m_input_ptrs / m_output_ptrs; they are filled first and linked into the
+// instructions afterwards because the pools may reallocate while growing.
+// The registers do not exist until the arena is sized after the last
+// instruction, so the pointers themselves are resolved last too.
+bool Program::decode(const Program* previous, const MemoryOptions& memory) {
+  const size_t size = m_bytecode.size();
+  const uint32_t num_registers = static_cast<uint32_t>(m_num_registers);
+  // Module ID for each slot; slots are dense and each is used exactly once.
+  constexpr uint32_t kNoModule = std::numeric_limits<uint32_t>::max();
+  struct PoolOffsets {
+    size_t inputs;
+    size_t outputs;
+    uint32_t slot;
+    uint32_t level;
+    uint32_t stage;
+    uint32_t constant_reg = kNoModule;
+  };
+  std::vector<PoolOffsets> offsets;
+  // Register index of every entry of m_input_ptrs / m_output_ptrs.
+  std::vector<uint32_t> input_regs;
+  std::vector<uint32_t> output_regs;
+  // How often each register is written, saturating at 2.
+  std::vector<uint8_t> register_writes(num_registers, 0);
+  // The m_lane_followers entry of the PROC_POLY that wrote each register
+  // last, if a PROC_POLY did.
+  std::vector<uint32_t> lane_writer(num_registers, kNoModule);
+  auto count_write = [&](uint32_t reg) {
+    if (register_writes[reg] < 2) ++register_writes[reg];
+    lane_writer[reg] = kNoModule;
+  };
+  auto fits = [&](size_t pc, size_t words) { return pc + words <= size; };
+  // Decodes the words of an EXPR after its opcode, from `at`, into instr's
+  // inputs, output and program, and moves `at` past its node table.
+  auto decode_expression = [&](size_t& at, Instruction& instr) {
+    if (!fits(at, 4)) {
+      MADRONA_VM_LOG_ERROR("Truncated EXPR at PC=%u", (uint32_t)at);
+      return false;
+    }
+    const uint32_t num_nodes = m_bytecode[at];
+    const uint32_t num_inputs = m_bytecode[at + 1];
+    const uint32_t num_ops = m_bytecode[at + 2];
+    const uint32_t out_reg = m_bytecode[at + 3];
+    const size_t words = 4 + size_t(num_inputs) + num_ops;
+    if (!fits(at, words)) {
+      MADRONA_VM_LOG_ERROR("Truncated EXPR at PC=%u", (uint32_t)at);
+      return false;
+    }
+    if (out_reg >= num_registers) {
+      MADRONA_VM_LOG_ERROR("EXPR output register %u out of range at PC=%u", out_reg, (uint32_t)at);
+      return false;
+    }
+    for (uint32_t i = 0; i < num_inputs; ++i) {
+      const uint32_t reg = m_bytecode[at + 4 + i];
+      if (reg >= num_registers) {
+        MADRONA_VM_LOG_ERROR("EXPR input register %u out of range at PC=%u", reg, (uint32_t)at);
+        return false;
+      }
+      m_input_ptrs.push_back(nullptr);
+      input_regs.push_back(reg);
+    }
+    // Run the program on stack depths alone, so op_expression can trust it.
+    const uint32_t* ops = m_bytecode.data() + at + 4 + num_inputs;
+    uint32_t depth = 0;
+    for (uint32_t k = 0; k < num_ops; ++k) {
+      const auto op = static_cast<ExprOp>(ops[k] & kExprOpMask);
+      const bool valid = op == ExprOp::PUSH
+                             ? (ops[k] >> kExprOperandShift) < num_inputs && ++depth <= kMaxExpressionDepth
+                             : (op == ExprOp::ADD || op == ExprOp::MUL || op == ExprOp::CMP_GT) && depth-- >= 2;
+      if (!valid) {
+        MADRONA_VM_LOG_ERROR("Malformed EXPR program at PC=%u", (uint32_t)at);
+        return false;
+      }
+    }
+    if (depth != 1) {
+      MADRONA_VM_LOG_ERROR("Malformed EXPR program at PC=%u", (uint32_t)at);
+      return false;
+    }
+    size_t entry = at + words;
+    for (uint32_t n = 0; n < num_nodes; ++n) {
+      if (!fits(entry, 3) || !fits(entry, 3 + size_t(m_bytecode[entry + 2]))) {
+        MADRONA_VM_LOG_ERROR("Truncated EXPR node table at PC=%u", (uint32_t)at);
+        return false;
+      }
+      const uint32_t num_ports = m_bytecode[entry + 2];
+      for (uint32_t i = 0; i < num_ports; ++i) {
+        const uint32_t reg = m_bytecode[entry + 3 + i];
+        if (reg != kNullRegister && reg >= num_registers) {
+          MADRONA_VM_LOG_ERROR("EXPR port register %u out of range at PC=%u", reg, (uint32_t)at);
+          return false;
+        }
+      }
+      m_native_nodes.push_back({m_bytecode[entry], m_bytecode[entry + 1],
+                                static_cast<uint32_t>(m_instructions.size()),
+                                {static_cast<uint32_t>(m_port_registers.size()), num_ports, 1}});
+      m_port_registers.insert(m_port_registers.end(), m_bytecode.begin() + entry + 3,
+                              m_bytecode.begin() + entry + 3 + num_ports);
+      entry += 3 + num_ports;
+    }
+    m_output_ptrs.push_back(nullptr);
+    output_regs.push_back(out_reg);
+    count_write(out_reg);
+    instr.num_inputs += num_inputs;
+    instr.num_outputs += 1;
+    instr.ops = ops;
+    instr.num_ops = num_ops;
+    at = entry;
+    return true;
+  };
+  // Dependency level of the instructions being decoded; BARRIER advances it.
+  uint32_t level = 0;
+  // Pipeline stage likewise; STAGE advances it.
+  uint32_t stage = 0;
+  size_t pc = sizeof(BytecodeHeader) / sizeof(uint32_t);
+  while (pc < size) {
+    OpCode opcode = static_cast<OpCode>(m_bytecode[pc]);
+    Instruction instr{};
+    PoolOffsets offset{m_input_ptrs.size(), m_output_ptrs.size(), kNoModule, level, stage};
+    switch (opcode) {
+    case OpCode::LOAD_K: {
+      if (!fits(pc, 3) || m_bytecode[pc + 1] >= num_registers) {
+        MADRONA_VM_LOG_ERROR("Malformed LOAD_K at PC=%u", (uint32_t)pc);
+        return false;
+      }
+      uint32_t dest_reg = m_bytecode[pc + 1];
+      uint32_t value_bits = m_bytecode[pc + 2];
+      std::memcpy(&instr.constant, &value_bits, sizeof(float));
+      instr.handler = &Program::op_load_k;
+      instr.num_outputs = 1;
+      m_output_ptrs.push_back(nullptr);
+      output_regs.push_back(dest_reg);
+      offset.constant_reg = dest_reg;
+      count_write(dest_reg);
+      pc += 3;
+      break;
+    }
+    case OpCode::PROC:
+    case OpCode::PROC_POLY:
+    case OpCode::PROC_MUL:
+    case OpCode::PROC_EXPR:
+    case OpCode::PROC_1x1:
+    case OpCode::PROC_2x1:
+    case OpCode::PROC_3x1:
+    case OpCode::PROC_5x1: {
+      // PROC_POLY carries a lane count after the slot; PROC is one lane.
+      // The fixed-arity forms carry no counts at all.
+      const bool poly = opcode == OpCode::PROC_POLY;
+      const uint32_t arity = fixed_arity(opcode);
+      const size_t header = poly ? 7 : arity ? 4 : 6;
+      if (!fits(pc, header)) {
+        MADRONA_VM_LOG_ERROR("Truncated PROC at PC=%u", (uint32_t)pc);
+        return false;
+      }
+      uint32_t node_id = m_bytecode[pc + 1];
+      uint32_t module_id = m_bytecode[pc + 2];
+      uint32_t slot = m_bytecode[pc + 3];
+      uint32_t lanes = poly ? m_bytecode[pc + 4] : 1;
+      uint32_t num_inputs = arity ? arity : m_bytecode[pc + header - 2];
+      uint32_t num_outputs = arity ? 1 : m_bytecode[pc + header - 1];
+      if (!fits(pc, header + size_t(num_inputs) + num_outputs)) {
+        MADRONA_VM_LOG_ERROR("Truncated PROC at PC=%u", (uint32_t)pc);
+        return false;
+      }
+      if (lanes == 0 || lanes > dsp::kMaxPolyLanes) {
+        MADRONA_VM_LOG_ERROR("PROC_POLY has %u lanes, node %u", lanes, node_id);
+        return false;
+      }
+      // Every PROC takes at least six words, which bounds the slot count.
+      if (slot >= size / 6) {
+        MADRONA_VM_LOG_ERROR("PROC slot %u out of range for node %u", slot, node_id);
+        return false;
+      }
+      if (slot >= m_slot_module_ids.size()) {
+        m_slot_module_ids.resize(slot + 1, kNoModule);
+        m_slot_node_ids.resize(slot + 1, kNoModule);
+        m_slot_instructions.resize(slot + 1, kNoModule);
+        m_slot_ports.resize(slot + 1);
+      }
+      if (m_slot_module_ids[slot] != kNoModule) {
+        MADRONA_VM_LOG_ERROR("PROC slot %u assigned twice, node %u", slot, node_id);
+        return false;
+      }
+      m_slot_module_ids[slot] = poly ? (module_id | dsp::kPolyVariant) : module_id;
+      m_slot_node_ids[slot] = node_id;
+      m_slot_instructions[slot] = static_cast<uint32_t>(m_instructions.size());
+      m_slot_ports[slot] = {static_cast<uint32_t>(m_port_registers.size()), num_inputs, lanes};
+      m_port_registers.insert(m_port_registers.end(), m_bytecode.begin() + pc + header,
+                              m_bytecode.begin() + pc + header + num_inputs);
+      // One pointer per port and lane, lane-major. A poly input names the
+      // first of `lanes` consecutive registers; any other input, including
+      // a null one, is broadcast to every lane.
+      LaneFollower follower{slot, stage, static_cast<uint32_t>(m_lane_feeders.size()), 0, nullptr};
+      bool same_stage = true;
+      for (uint32_t i = 0; i < num_inputs; ++i) {
+        uint32_t reg_idx = m_bytecode[pc + header + i];
+        const bool poly_input = poly && reg_idx != kNullRegister && (reg_idx & kPolyRegister);
+        const uint32_t base = poly_input ? (reg_idx & ~kPolyRegister) : reg_idx;
+        if (base != kNullRegister && size_t(base) + (poly_input ? lanes : 1) > num_registers) {
+          MADRONA_VM_LOG_ERROR("PROC input register %u out of range at PC=%u", reg_idx, (uint32_t)pc);
+          return false;
+        }
+        for (uint32_t lane = 0; lane < lanes; ++lane) {
+          const uint32_t reg = poly_input ? base + lane : base;
+          m_input_ptrs.push_back(nullptr);
+          input_regs.push_back(reg);
+        }
+        const uint32_t feeder = poly_input ? lane_writer[base] : kNoModule;
+        if (feeder != kNoModule) {
+          same_stage = same_stage && m_lane_followers[feeder].stage == stage;
+          m_lane_feeders.push_back(feeder);
+        }
+      }
+      for (uint32_t i = 0; i < num_outputs; ++i) {
+        uint32_t reg_idx = m_bytecode[pc + header + num_inputs + i];
+        if (size_t(reg_idx) + lanes > num_registers) {
+          MADRONA_VM_LOG_ERROR("PROC output register %u out of range at PC=%u", reg_idx, (uint32_t)pc);
+          return false;
+        }
+        for (uint32_t lane = 0; lane < lanes; ++lane) {
+          m_output_ptrs.push_back(nullptr);
+          output_regs.push_back(reg_idx + lane);
+          count_write(reg_idx + lane);
+          if (poly) {
+            lane_writer[reg_idx + lane] = static_cast<uint32_t>(m_lane_followers.size());
+          }
+        }
+      }
+      if (poly) {
+        // Lanes published in another stage belong to another block.
+        if (same_stage) {
+          follower.num_feeders = static_cast<uint32_t>(m_lane_feeders.size()) - follower.first_feeder;
+        } else {
+          m_lane_feeders.resize(follower.first_feeder);
+        }
+        m_lane_followers.push_back(follower);
+      }
+      instr.handler = arity_handler(arity);
+      instr.num_inputs = num_inputs * lanes;
+      instr.num_outputs = num_outputs * lanes;
+      offset.slot = slot;
+      pc += header + num_inputs + num_outputs;
+      if (opcode == OpCode::PROC_EXPR) {
+        // The EXPR's words follow the module's.
+        instr.num_module_inputs = instr.num_inputs;
+        if (num_outputs == 0 || !decode_expression(pc, instr)) {
+          MADRONA_VM_LOG_ERROR("Malformed PROC_EXPR at PC=%u", (uint32_t)pc);
+          return false;
+        }
+        instr.handler = &Program::op_proc_expr;
+      }
+      if (opcode == OpCode::PROC_MUL) {
+        // The MUL's operands follow the module's, like a MUL instruction
+        // without its opcode.
+        if (!fits(pc, 5) || num_outputs == 0) {
+          MADRONA_VM_LOG_ERROR("Malformed PROC_MUL at PC=%u", (uint32_t)pc);
+          return false;
+        }
+        for (uint32_t i = 2; i < 5; ++i) {
+          if (m_bytecode[pc + i] >= num_registers) {
+            MADRONA_VM_LOG_ERROR("PROC_MUL register %u out of range at PC=%u", m_bytecode[pc + i], (uint32_t)pc);
+            return false;
+          }
+        }
+        m_native_nodes.push_back({m_bytecode[pc], m_bytecode[pc + 1], static_cast<uint32_t>(m_instructions.size()),
+                                  {static_cast<uint32_t>(m_port_registers.size()), 2, 1}});
+        for (uint32_t i = 2; i < 4; ++i) {
+          m_port_registers.push_back(m_bytecode[pc + i]);
+          m_input_ptrs.push_back(nullptr);
+          input_regs.push_back(m_bytecode[pc + i]);
+        }
+        m_output_ptrs.push_back(nullptr);
+        output_regs.push_back(m_bytecode[pc + 4]);
+        count_write(m_bytecode[pc + 4]);
+        instr.handler = &Program::op_proc_mul;
+        instr.num_inputs += 2;
+        instr.num_outputs += 1;
+        pc += 5;
+      }
+      break;
+    }
+    case OpCode::ADD:
+    case OpCode::MUL:
+    case OpCode::CMP_GT:
+    case OpCode::SPLAT:
+    case OpCode::SPLAT_INT: {
+      const bool binary = opcode == OpCode::ADD || opcode == OpCode::MUL || opcode == OpCode::CMP_GT;
+      const uint32_t num_inputs = binary ? 2 : 1;
+      if (!fits(pc, 4 + num_inputs)) {
+        MADRONA_VM_LOG_ERROR("Truncated native opcode at PC=%u", (uint32_t)pc);
+        return false;
+      }
+      const uint32_t node_id = m_bytecode[pc + 1];
+      // Operands are plain registers: never null, never polyphonic.
+      for (uint32_t i = 0; i <= num_inputs; ++i) {
+        if (m_bytecode[pc + 3 + i] >= num_registers) {
+          MADRONA_VM_LOG_ERROR("Native opcode register %u out of range at PC=%u",
+                               m_bytecode[pc + 3 + i], (uint32_t)pc);
+          return false;
+        }
+      }
+      m_native_nodes.push_back({node_id, m_bytecode[pc + 2], static_cast<uint32_t>(m_instructions.size()),
+                                {static_cast<uint32_t>(m_port_registers.size()), num_inputs, 1}});
+      for (uint32_t i = 0; i < num_inputs; ++i) {
+        m_port_registers.push_back(m_bytecode[pc + 3 + i]);
+        m_input_ptrs.push_back(nullptr);
+        input_regs.push_back(m_bytecode[pc + 3 + i]);
+      }
+      const uint32_t out_reg = m_bytecode[pc + 3 + num_inputs];
+      m_output_ptrs.push_back(nullptr);
+      output_regs.push_back(out_reg);
+      count_write(out_reg);
+      switch (opcode) {
+      case OpCode::ADD: instr.handler = &Program::op_add; break;
+      case OpCode::MUL: instr.handler = &Program::op_mul; break;
+      case OpCode::CMP_GT: instr.handler = &Program::op_cmp_gt; break;
+      case OpCode::SPLAT: instr.handler = &Program::op_splat; break;
+      default: instr.handler = &Program::op_splat_int; break;
+      }
+      instr.num_inputs = num_inputs;
+      instr.num_outputs = 1;
+      pc += 4 + num_inputs;
+      break;
+    }
+    case OpCode::EXPR: {
+      ++pc;
+      if (!decode_expression(pc, instr)) {
+        return false;
+      }
+      instr.handler = &Program::op_expression;
+      break;
+    }
+    case OpCode::AUDIO_OUT: {
+      if (!fits(pc, 2) || !fits(pc, 2 + size_t(m_bytecode[pc + 1]))) {
+        MADRONA_VM_LOG_ERROR("Truncated AUDIO_OUT at PC=%u", (uint32_t)pc);
+        return false;
+      }
+      uint32_t num_inputs = m_bytecode[pc + 1];
+      if (num_inputs > kMaxOutputChannels) {
+        MADRONA_VM_LOG_ERROR("AUDIO_OUT has %u channels, at most %u supported",
+                             num_inputs, (uint32_t)kMaxOutputChannels);
+        return false;
+      }
+      m_num_output_channels = std::max<size_t>(m_num_output_channels, num_inputs);
+      for (uint32_t i = 0; i < num_inputs; ++i) {
+        uint32_t reg_idx = m_bytecode[pc + 2 + i];
+        // An unconnected channel plays silence.
+        if (reg_idx != kNullRegister && reg_idx >= num_registers) {
+          MADRONA_VM_LOG_ERROR("AUDIO_OUT register %u out of range at PC=%u", reg_idx, (uint32_t)pc);
+          return false;
+        }
+        m_input_ptrs.push_back(nullptr);
+        input_regs.push_back(reg_idx);
+      }
+      instr.handler = &Program::op_audio_out;
+      instr.num_inputs = num_inputs;
+      pc += 2 + num_inputs;
+      break;
+    }
+    case OpCode::BARRIER: {
+      ++level;
+      ++pc;
+      continue;
+    }
+    case OpCode::STAGE: {
+      ++stage;
+      ++pc;
+      continue;
+    }
+    case OpCode::END: {
+      pc = size; // End of program
+      continue;
+    }
+    default: {
+      MADRONA_VM_LOG_ERROR("Unknown opcode: 0x%02X at PC=%u",
+                           m_bytecode[pc], (uint32_t)pc);
+      return false;
+    }
+    }
+    m_instructions.push_back(instr);
+    offsets.push_back(offset);
+  }
+  for (size_t slot = 0; slot < m_slot_module_ids.size(); ++slot) {
+    if (m_slot_module_ids[slot] == kNoModule) {
+      MADRONA_VM_LOG_ERROR("PROC slot %u is never assigned", (uint32_t)slot);
+      return false;
+    }
+    m_node_slots.emplace_back(m_slot_node_ids[slot], static_cast<uint32_t>(slot));
+  }
+  std::sort(m_node_slots.begin(), m_node_slots.end());
+  // A LOAD_K is the only writer of its register in compiled code, so that
+  // register holds the same value every block. Fill it once here and drop
+  // the instruction; a register that is written more than once keeps its
+  // LOAD_K in the block loop.
+  size_t kept = 0;
+  std::vector<uint32_t> kept_index(m_instructions.size(), kNoModule);
+  for (size_t i = 0; i < m_instructions.size(); ++i) {
+    const uint32_t reg = offsets[i].constant_reg;
+    if (reg != kNoModule && register_writes[reg] == 1) {
+      m_constants.push_back({reg, m_instructions[i].constant});
+      continue;
+    }
+    if (offsets[i].slot != kNoModule) {
+      m_slot_instructions[offsets[i].slot] = static_cast<uint32_t>(kept);
+    }
+    kept_index[i] = static_cast<uint32_t>(kept);
+    m_instructions[kept] = m_instructions[i];
+    offsets[kept] = offsets[i];
+    ++kept;
+  }
+  m_instructions.resize(kept);
+  offsets.resize(kept);
+  for (NativeNode& node : m_native_nodes) {
+    node.instruction = kept_index[node.instruction];
+  }
+  std::sort(m_native_nodes.begin(), m_native_nodes.end(),
+            [](const NativeNode& a, const NativeNode& b) { return a.node_id < b.node_id; });
+  // Level boundaries over the surviving instructions; levels left empty by
+  // hoisting disappear.
+  for (size_t i = 0; i < kept; ++i) {
+    if (i == 0 || offsets[i].level != offsets[i - 1].level) {
+      m_level_starts.push_back(static_cast<uint32_t>(i));
+    }
+  }
+  m_level_starts.push_back(static_cast<uint32_t>(kept));
+  if (stage > 0) {
+    // Stages are kept even if empty, so stage numbers match the bytecode.
+    for (uint32_t s = 0, i = 0; s <= stage; ++s) {
+      while (i < kept && offsets[i].stage < s) {
+        ++i;
+      }
+      m_stage_starts.push_back(i);
+    }
+    m_stage_starts.push_back(static_cast<uint32_t>(kept));
+  }
+  m_ramps.reserve(m_constants.size());
+  std::vector<bool> deferred;
+  if (previous && !previous->empty()) {
+    deferred = plan_migration(*previous);
+  }
+  // One arena: the registers, then the modules in slot order.
+  try {
+    const size_t register_bytes = m_num_registers * sizeof(ml::DSPVector);
+    std::vector<uint32_t> slot_lanes(m_slot_ports.size());
+    for (size_t slot = 0; slot < m_slot_ports.size(); ++slot) {
+      slot_lanes[slot] = m_slot_ports[slot].lanes;
+    }
+    const size_t module_bytes = m_module_pool.plan(m_slot_module_ids, slot_lanes);
+    const size_t module_alignment = m_module_pool.alignment();
+    m_arena.allocate(register_bytes + module_alignment + module_bytes, memory);
+    char* base = static_cast<char*>(m_arena.data());
+    m_registers = reinterpret_cast<ml::DSPVector*>(base);
+    for (size_t reg = 0; reg < m_num_registers; ++reg) {
+      new (&m_registers[reg]) ml::DSPVector();
+    }
+    const uintptr_t modules = reinterpret_cast<uintptr_t>(base) + register_bytes;
+    void* module_storage = reinterpret_cast<void*>(
+        (modules + module_alignment - 1) / module_alignment * module_alignment);
+    m_module_pool.build(module_storage, m_sampleRate, deferred);
+  } catch (const std::exception&) {
+    MADRONA_VM_LOG_ERROR("Cannot create modules for %u slots", (uint32_t)m_slot_module_ids.size());
+    return false;
+  }
+  for (size_t i = 0; i < m_input_ptrs.size(); ++i) {
+    const uint32_t reg = input_regs[i];
+    m_input_ptrs[i] = reg == kNullRegister ? nullptr : m_registers[reg].getConstBuffer();
+  }
+  for (size_t i = 0; i < m_output_ptrs.size(); ++i) {
+    m_output_ptrs[i] = m_registers[output_regs[i]].getBuffer();
+  }
+  for (const Constant& constant : m_constants) {
+    fill_register(constant.reg, constant.value);
+  }
+  for (size_t i = 0; i < m_instructions.size(); ++i) {
+    m_instructions[i].inputs = m_input_ptrs.data() + offsets[i].inputs;
+    m_instructions[i].outputs = m_output_ptrs.data() + offsets[i].outputs;
+    if (offsets[i].slot != kNoModule) {
+      // Null for a migrating slot until take_state_from() fills it.
+      m_instructions[i].module = m_module_pool.get(offsets[i].slot);
+    }
+  }
+  follow_voice_allocators();
+  build_task_graph(input_regs, output_regs);
+  return build_pipeline(input_regs, output_regs);
+}
+// Adds an edge for every register hazard between two instructions: a read
+// after the last write, and a write after earlier reads or writes. The
+// host buffers count as one extra register written by every AUDIO_OUT, so
+// those stay in program order too.
+void Program::build_task_graph(const std::vector<uint32_t>& input_regs,
+                               const std::vector<uint32_t>& output_regs) {
+  const uint32_t host_reg = static_cast<uint32_t>(m_num_registers);
+  constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+  std::vector<std::vector<uint32_t>> successors(m_instructions.size());
+  std::vector<uint32_t> last_writer(host_reg + 1, kNone);
+  std::vector<std::vector<uint32_t>> readers(host_reg + 1);
+  // Edges into `to` are added while `to` is the newest instruction, so a
+  // duplicate is always the last entry of the list.
+  auto add_edge = [&](uint32_t from, uint32_t to) {
+    if (from != kNone && from != to && (successors[from].empty() || successors[from].back() != to)) {
+      successors[from].push_back(to);
+    }
+  };
+  auto write = [&](uint32_t reg, uint32_t instr) {
+    add_edge(last_writer[reg], instr);
+    for (uint32_t reader : readers[reg]) {
+      add_edge(reader, instr);
+    }
+    readers[reg].clear();
+    last_writer[reg] = instr;
+  };
+  for (uint32_t i = 0; i < m_instructions.size(); ++i) {
+    const Instruction& instr = m_instructions[i];
+    const size_t first_input = instr.inputs - m_input_ptrs.data();
+    const size_t first_output = instr.outputs - m_output_ptrs.data();
+    for (uint32_t k = 0; k < instr.num_inputs; ++k) {
+      const uint32_t reg = input_regs[first_input + k];
+      if (reg != kNullRegister) {
+        add_edge(last_writer[reg], i);
+        readers[reg].push_back(i);
+      }
+    }
+    for (uint32_t k = 0; k < instr.num_outputs; ++k) {
+      write(output_regs[first_output + k], i);
+    }
+    if (instr.handler == &Program::op_audio_out) {
+      write(host_reg, i);
+    }
+  }
+  m_task_graph.build(successors);
+}
+// Points every read of a register written in an earlier stage at the
+// matching delay line entry.
+bool Program::build_pipeline(const std::vector<uint32_t>& input_regs,
+                             const std::vector<uint32_t>& output_regs) {
+  if (num_stages() < 2) {
+    return true;
+  }
+  constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+  const size_t num_registers = m_num_registers;
+  std::vector<uint32_t> stage_of(m_instructions.size());
+  for (uint32_t stage = 0; stage < num_stages(); ++stage) {
+    for (uint32_t i = m_stage_starts[stage]; i < m_stage_starts[stage + 1]; ++i) {
+      stage_of[i] = stage;
+    }
+  }
+  std::vector<uint32_t> writer_stage(num_registers, kNone);
+  for (size_t i = 0; i < m_instructions.size(); ++i) {
+    const Instruction& instr = m_instructions[i];
+    const size_t first_output = instr.outputs - m_output_ptrs.data();
+    for (uint32_t k = 0; k < instr.num_outputs; ++k) {
+      const uint32_t reg = output_regs[first_output + k];
+      if (writer_stage[reg] != kNone && writer_stage[reg] != stage_of[i]) {
+        MADRONA_VM_LOG_ERROR("Register %u written in pipeline stages %u and more", reg, writer_stage[reg]);
+        return false;
+      }
+      writer_stage[reg] = stage_of[i];
+    }
+    if (instr.handler == &Program::op_audio_out) {
+      m_latency_blocks = stage_of[i];
+    }
+  }
+  // Delay needed by each register: the distance to its furthest reader.
+  std::vector<uint32_t> delay(num_registers, 0);
+  for (size_t i = 0; i < m_instructions.size(); ++i) {
+    const Instruction& instr = m_instructions[i];
+    const size_t first_input = instr.inputs - m_input_ptrs.data();
+    for (uint32_t k = 0; k < instr.num_inputs; ++k) {
+      const uint32_t reg = input_regs[first_input + k];
+      if (reg == kNullRegister || writer_stage[reg] == kNone) {
+        continue;
+      }
+      if (writer_stage[reg] > stage_of[i]) {
+        MADRONA_VM_LOG_ERROR("Register %u read in stage %u, before it is written",
+                             reg, stage_of[i]);
+        return false;
+      }
+      delay[reg] = std::max(delay[reg], stage_of[i] - writer_stage[reg]);
+    }
+  }
+  std::vector<uint32_t> line_start(num_registers, kNone);
+  uint32_t num_delay_registers = 0;
+  for (uint32_t reg = 0; reg < num_registers; ++reg) {
+    if (delay[reg] > 0) {
+      m_delay_lines.push_back({reg, num_delay_registers, delay[reg]});
+      line_start[reg] = num_delay_registers;
+      num_delay_registers += delay[reg];
+    }
+  }
+  // Sized once, so the pointers below stay valid.
+  m_delay_registers.resize(num_delay_registers);
+  for (size_t i = 0; i < m_instructions.size(); ++i) {
+    const Instruction& instr = m_instructions[i];
+    const size_t first_input = instr.inputs - m_input_ptrs.data();
+    for (uint32_t k = 0; k < instr.num_inputs; ++k) {
+      const uint32_t reg = input_regs[first_input + k];
+      if (reg == kNullRegister || writer_stage[reg] == kNone || writer_stage[reg] == stage_of[i]) {
+        continue;
+      }
+      const uint32_t distance = stage_of[i] - writer_stage[reg];
+      m_input_ptrs[first_input + k] =
+          m_delay_registers[line_start[reg] + distance - 1].getConstBuffer();
+    }
+  }
+  return true;
+}
+// Pairs each slot with a slot of previous running the same node with the
+// same module ID, and returns which slots should be left unconstructed.
+std::vector<bool> Program::plan_migration(const Program& previous) {
+  std::unordered_map<uint32_t, uint32_t> previous_slots; // node_id -> slot
+  previous_slots.reserve(previous.m_slot_node_ids.size());
+  for (size_t slot = 0; slot < previous.m_slot_node_ids.size(); ++slot) {
+    previous_slots.emplace(previous.m_slot_node_ids[slot], static_cast<uint32_t>(slot));
+  }
+  std::vector<bool> deferred(m_slot_module_ids.size(), false);
+  for (size_t slot = 0; slot < m_slot_node_ids.size(); ++slot) {
+    auto it = previous_slots.find(m_slot_node_ids[slot]);
+    if (it == previous_slots.end()) {
+      continue;
+    }
+    const uint32_t source_slot = it->second;
+    const uint32_t module_id = m_slot_module_ids[slot];
+    const auto& descriptor = dsp::get_module_descriptor(module_id);
+    // Lane state is sized for the lane count, so a node whose voice count
+    // changed starts fresh.
+    if (previous.m_slot_module_ids[source_slot] != module_id || !descriptor.relocate ||
+        (descriptor.lane_size && previous.m_slot_ports[source_slot].lanes != m_slot_ports[slot].lanes)) {
+      continue;
+    }
+    m_migrations.push_back({static_cast<uint32_t>(slot), source_slot});
+    deferred[slot] = true;
+    // Each running instance can be moved out only once.
+    previous_slots.erase(it);
+  }
+  return deferred;
+}
+void Program::take_state_from(Program* previous) {
+  const bool planned = previous && previous == m_replaced;
+  for (const Migration& migration : m_migrations) {
+    if (planned) {
+      m_module_pool.relocate(migration.slot, *previous->m_module_pool.get(migration.source_slot));
+    } else {
+      // Only reachable if the program was swapped in over a different one
+      // than it was planned against: start the node fresh instead.
+      m_module_pool.construct(migration.slot, m_sampleRate);
+    }
+    m_instructions[m_slot_instructions[migration.slot]].module = m_module_pool.get(migration.slot);
+  }
+  m_num_migrated = planned ? m_migrations.size() : 0;
+  // Keeps capacity, so this does not free.
+  m_migrations.clear();
+  // Moved modules still point at the lanes of previous's allocators.
+  follow_voice_allocators();
+}
+// Points every PROC_POLY module at the lanes it follows: its own
+// active_lanes() if it allocates voices, else the set shared by every
+// PROC_POLY feeding its polyphonic inputs in the same stage, else none.
+// A migrating slot publishes nothing until take_state_from() fills it.
+void Program::follow_voice_allocators() {
+  for (LaneFollower& follower : m_lane_followers) {
+    dsp::DSPModule* module = m_module_pool.get(follower.slot);
+    follower.lanes = module ? module->active_lanes() : nullptr;
+    if (module && !follower.lanes && follower.num_feeders > 0) {
+      follower.lanes = m_lane_followers[m_lane_feeders[follower.first_feeder]].lanes;
+      for (uint32_t k = 1; k < follower.num_feeders; ++k) {
+        if (m_lane_followers[m_lane_feeders[follower.first_feeder + k]].lanes != follower.lanes) {
+          follower.lanes = nullptr;
+          break;
+        }
+      }
+    }
+    if (module) {
+      module->follow_lanes(follower.lanes);
+    }
+  }
+}
+bool Program::set_constant(uint32_t reg, float value) {
+  return ramp_constant(reg, value, 0);
+}
+bool Program::ramp_constant(uint32_t reg, float value, uint32_t ramp_blocks) {
+  for (size_t i = 0; i < m_constants.size(); ++i) {
+    Constant& constant = m_constants[i];
+    if (constant.reg != reg) continue;
+    auto ramp = std::find(m_ramps.begin(), m_ramps.end(), static_cast<uint32_t>(i));
+    const bool ramping = ramp != m_ramps.end();
+    if (ramp_blocks == 0) {
+      constant.value = value;
+      constant.ramp_samples = 0;
+      fill_register(reg, value);
+      if (ramping) {
+        m_ramps.erase(ramp);
+      }
+      return true;
+    }
+    constant.target = value;
+    constant.ramp_samples = ramp_blocks * kFloatsPerDSPVector;
+    constant.step = (value - constant.value) / static_cast<float>(constant.ramp_samples);
+    if (!ramping) {
+      // Never reallocates: reserved for every constant at load.
+      m_ramps.push_back(static_cast<uint32_t>(i));
+    }
+    return true;
+  }
+  return false;
+}
+void Program::advance_ramps() {
+  for (size_t i = m_ramps.size(); i-- > 0;) {
+    Constant& constant = m_constants[m_ramps[i]];
+    if (constant.ramp_samples == 0) {
+      // The block after the ramp holds the target in every sample again.
+      fill_register(constant.reg, constant.value);
+      m_ramps[i] = m_ramps.back();
+      m_ramps.pop_back();
+      continue;
+    }
+    float* dest = m_registers[constant.reg].getBuffer();
+    for (int s = 0; s < kFloatsPerDSPVector; ++s) {
+      constant.value += constant.step;
+      dest[s] = constant.value;
+    }
+    constant.ramp_samples -= kFloatsPerDSPVector;
+    if (constant.ramp_samples == 0) {
+      // The last block lands exactly on the target.
+      constant.value = constant.target;
+      dest[kFloatsPerDSPVector - 1] = constant.value;
+    }
+  }
+}
+bool Program::set_parameter(uint32_t node_id, uint32_t port, float value, uint32_t ramp_blocks) {
+  const uint32_t slot = slot_for_node(node_id);
+  const NativeNode* native = slot == kNullRegister ? native_node(node_id) : nullptr;
+  if (slot == kNullRegister && !native) {
+    return false;
+  }
+  const SlotPorts& ports = native ? native->ports : m_slot_ports[slot];
+  if (port >= ports.count) {
+    return false;
+  }
+  const uint32_t reg = m_port_registers[ports.first + port];
+  if (reg == kNullRegister) {
+    return false;
+  }
+  // A polyphonic constant is one register per lane.
+  const bool poly = ports.lanes > 1 && (reg & kPolyRegister);
+  const uint32_t base = poly ? (reg & ~kPolyRegister) : reg;
+  bool found = true;
+  for (uint32_t lane = 0; lane < (poly ? ports.lanes : 1); ++lane) {
+    found = ramp_constant(base + lane, value, ramp_blocks) && found;
+  }
+  return found;
+}
+uint32_t Program::slot_for_node(uint32_t node_id) const {
+  auto it = std::lower_bound(m_node_slots.begin(), m_node_slots.end(),
+                             std::make_pair(node_id, uint32_t(0)));
+  if (it == m_node_slots.end() || it->first != node_id) {
+    return kNullRegister;
+  }
+  return it->second;
+}
+const Program::NativeNode* Program::native_node(uint32_t node_id) const {
+  auto it = std::lower_bound(m_native_nodes.begin(), m_native_nodes.end(), node_id,
+                             [](const NativeNode& node, uint32_t id) { return node.node_id < id; });
+  return it != m_native_nodes.end() && it->node_id == node_id ? &*it : nullptr;
+}
+dsp::DSPModule* Program::module_for_node(uint32_t node_id) const {
+  const uint32_t slot = slot_for_node(node_id);
+  return slot == kNullRegister ? nullptr : m_module_pool.get(slot);
+}
+uint32_t Program::module_id_for_node(uint32_t node_id) const {
+  const uint32_t slot = slot_for_node(node_id);
+  if (slot != kNullRegister) {
+    return m_slot_module_ids[slot];
+  }
+  const NativeNode* native = native_node(node_id);
+  return native ? native->module_id : kNullRegister;
+}
+void Program::fill_register(uint32_t reg, float value) {
+  float* dest = m_registers[reg].getBuffer();
+  for (int i = 0; i < kFloatsPerDSPVector; ++i) {
+    dest[i] = value;
+  }
+}
+void Program::op_load_k(const Instruction& instr, float**) {
+  float* dest = instr.outputs[0];
+  for (int i = 0; i < kFloatsPerDSPVector; ++i) {
+    dest[i] = instr.constant;
+  }
+}
+void Program::op_proc(const Instruction& instr, float**) {
+  instr.module->process(instr.inputs, instr.num_inputs, instr.outputs, instr.num_outputs);
+}
+template <uint32_t N>
+void Program::op_proc_fixed(const Instruction& instr, float**) {
+  instr.module->process(instr.inputs, N, instr.outputs, 1);
+}
+Program::Handler Program::arity_handler(uint32_t arity) {
+  switch (arity) {
+  case 1: return &Program::op_proc_fixed<1>;
+  case 2: return &Program::op_proc_fixed<2>;
+  case 3: return &Program::op_proc_fixed<3>;
+  case 5: return &Program::op_proc_fixed<5>;
+  default: return &Program::op_proc;
+  }
+}
+void Program::op_proc_mul(const Instruction& instr, float**) {
+  const uint32_t num_inputs = instr.num_inputs - 2;
+  const uint32_t num_outputs = instr.num_outputs - 1;
+  instr.module->process(instr.inputs, num_inputs, instr.outputs, num_outputs);
+  const float* a = instr.inputs[num_inputs];
+  const float* b = instr.inputs[num_inputs + 1];
+  float* out = instr.outputs[num_outputs];
+  for (int i = 0; i < kFloatsPerDSPVector; ++i) {
+    out[i] = a[i] * b[i];
+  }
+}
+void Program::op_proc_expr(const Instruction& instr, float**) {
+  const uint32_t num_outputs = instr.num_outputs - 1;
+  instr.module->process(instr.inputs, instr.num_module_inputs, instr.outputs, num_outputs);
+  Instruction expr = instr;
+  expr.inputs += instr.num_module_inputs;
+  expr.outputs += num_outputs;
+  op_expression(expr, nullptr);
+}
+void Program::op_add(const Instruction& instr, float**) {
+  const float* a = instr.inputs[0];
+  const float* b = instr.inputs[1];
+  float* out = instr.outputs[0];
+  for (int i = 0; i < kFloatsPerDSPVector; ++i) {
+    out[i] = a[i] + b[i];
+  }
+}
+void Program::op_mul(const Instruction& instr, float**) {
+  const float* a = instr.inputs[0];
+  const float* b = instr.inputs[1];
+  float* out = instr.outputs[0];
+  for (int i = 0; i < kFloatsPerDSPVector; ++i) {
+    out[i] = a[i] * b[i];
+  }
+}
+void Program::op_cmp_gt(const Instruction& instr, float**) {
+  const float* a = instr.inputs[0];
+  const float* b = instr.inputs[1];
+  float* out = instr.outputs[0];
+  for (int i = 0; i < kFloatsPerDSPVector; ++i) {
+    out[i] = a[i] > b[i] ? 1.0f : 0.0f;
+  }
+}
+void Program::op_splat(const Instruction& instr, float**) {
+  const float value = instr.inputs[0][0];
+  float* out = instr.outputs[0];
+  for (int i = 0; i < kFloatsPerDSPVector; ++i) {
+    out[i] = value;
+  }
+}
+void Program::op_splat_int(const Instruction& instr, float**) {
+  const float value = static_cast<float>(static_cast<int>(instr.inputs[0][0]));
+  float* out = instr.outputs[0];
+  for (int i = 0; i < kFloatsPerDSPVector; ++i) {
+    out[i] = value;
+  }
+}
+void Program::op_expression(const Instruction& instr, float**) {
+  float* out = instr.outputs[0];
+  // Leaves are read in place from their registers. Each stack position has
+  // two scratch vectors, so a result never overwrites the operand it is
+  // computed from, and the last result goes straight to the output.
+  alignas(64) float scratch[kMaxExpressionDepth][2][kFloatsPerDSPVector];
+  const float* stack[kMaxExpressionDepth];
+  uint32_t bank[kMaxExpressionDepth] = {};
+  uint32_t depth = 0;
+  for (uint32_t k = 0; k < instr.num_ops; ++k) {
+    const uint32_t op = instr.ops[k];
+    if (static_cast<ExprOp>(op & kExprOpMask) == ExprOp::PUSH) {
+      stack[depth++] = instr.inputs[op >> kExprOperandShift];
+      continue;
+    }
+    const float* a = stack[depth - 2];
+    const float* b = stack[depth - 1];
+    bank[depth - 2] ^= 1;
+    float* result = k + 1 == instr.num_ops ? out : scratch[depth - 2][bank[depth - 2]];
+    switch (static_cast<ExprOp>(op & kExprOpMask)) {
+    case ExprOp::ADD:
+      for (int i = 0; i < kFloatsPerDSPVector; ++i) result[i] = a[i] + b[i];
+      break;
+    case ExprOp::MUL:
+      for (int i = 0; i < kFloatsPerDSPVector; ++i) result[i] = a[i] * b[i];
+      break;
+    default:
+      for (int i = 0; i < kFloatsPerDSPVector; ++i) result[i] = a[i] > b[i] ? 1.0f : 0.0f;
+      break;
+    }
+    stack[--depth - 1] = result;
+  }
+  if (stack[0] != out) {
+    std::memcpy(out, stack[0], kFloatsPerDSPVector * sizeof(float));
+  }
+}
+void Program::op_audio_out(const Instruction& instr, float** outputs) {
+  if (!outputs) return; // Only process if we have output buffers
+  for (uint32_t i = 0; i < instr.num_inputs; ++i) {
+    if (!outputs[i]) { // Check if the specific output channel is valid
+      continue;
+    }
+    if (instr.inputs[i]) {
+      std::memcpy(outputs[i], instr.inputs[i], kFloatsPerDSPVector * sizeof(float));
+    } else {
+      std::memset(outputs[i], 0, kFloatsPerDSPVector * sizeof(float));
+    }
+  }
+}
+void Program::run(float** outputs, WorkerPool* pool, Schedule schedule) {
+  if (!m_ramps.empty()) {
+    advance_ramps();
+  }
+  if (num_stages() > 1) {
+    run_pipeline(outputs, pool);
+    return;
+  }
+  if (!pool || pool->num_workers() == 0 || num_levels() == m_instructions.size()) {
+    // Direct-threaded dispatch: each decoded instruction carries its handler.
+    for (const Instruction& instr : m_instructions) {
+      instr.handler(instr, outputs);
+    }
+    return;
+  }
+  if (schedule == Schedule::kTaskGraph) {
+    InstructionTask task{m_instructions.data(), outputs};
+    m_task_graph.run(*pool, &Program::run_instruction_task, &task);
+    return;
+  }
+  for (size_t level = 0; level + 1 < m_level_starts.size(); ++level) {
+    const uint32_t begin = m_level_starts[level];
+    const uint32_t count = m_level_starts[level + 1] - begin;
+    if (count == 1) {
+      m_instructions[begin].handler(m_instructions[begin], outputs);
+      continue;
+    }
+    InstructionTask task{m_instructions.data() + begin, outputs};
+    pool->parallel_for(&Program::run_instruction_task, &task, count);
+  }
+}
+void Program::run_instruction_task(void* context, uint32_t index) {
+  auto* task = static_cast<InstructionTask*>(context);
+  const Instruction& instr = task->first[index];
+  instr.handler(instr, task->outputs);
+}
+// Every stage works on a different block, and none reads a register
+// another stage writes during the block, so the stages need no
+// synchronisation until the delay lines advance.
+void Program::run_pipeline(float** outputs, WorkerPool* pool) {
+  StageTask task{this, outputs};
+  const uint32_t count = static_cast<uint32_t>(num_stages());
+  if (pool) {
+    pool->parallel_for(&Program::run_stage_task, &task, count);
+  } else {
+    for (uint32_t stage = 0; stage < count; ++stage) {
+      run_stage_task(&task, stage);
+    }
+  }
+  for (const DelayLine& line : m_delay_lines) {
+    for (uint32_t i = line.length - 1; i > 0; --i) {
+      m_delay_registers[line.first + i] = m_delay_registers[line.first + i - 1];
+    }
+    m_delay_registers[line.first] = m_registers[line.reg];
+  }
+}
+void Program::run_stage_task(void* context, uint32_t stage) {
+  auto* task = static_cast<StageTask*>(context);
+  const Program& program = *task->program;
+  for (uint32_t i = program.m_stage_starts[stage]; i < program.m_stage_starts[stage + 1]; ++i) {
+    const Instruction& instr = program.m_instructions[i];
+    instr.handler(instr, task->outputs);
+  }
+}
+std::map<uint32_t, float> Program::measure_node_costs(int num_blocks) {
+  std::vector<double> total_ns(m_instructions.size(), 0.0);
+  for (int block = 0; block < num_blocks; ++block) {
+    for (size_t i = 0; i < m_instructions.size(); ++i) {
+      const auto start = std::chrono::steady_clock::now();
+      m_instructions[i].handler(m_instructions[i], nullptr);
+      total_ns[i] += std::chrono::duration<double, std::nano>(
+          std::chrono::steady_clock::now() - start).count();
+    }
+  }
+  std::map<uint32_t, float> costs;
+  for (size_t slot = 0; slot < m_slot_node_ids.size(); ++slot) {
+    costs[m_slot_node_ids[slot]] =
+        static_cast<float>(total_ns[m_slot_instructions[slot]] / std::max(num_blocks, 1));
+  }
+  // The nodes of one EXPR, PROC_MUL or PROC_EXPR share its time.
+  std::vector<uint32_t> nodes_per_instruction(m_instructions.size(), 0);
+  for (uint32_t instruction : m_slot_instructions) {
+    ++nodes_per_instruction[instruction];
+  }
+  for (const NativeNode& node : m_native_nodes) {
+    ++nodes_per_instruction[node.instruction];
+  }
+  for (size_t slot = 0; slot < m_slot_node_ids.size(); ++slot) {
+    costs[m_slot_node_ids[slot]] /= nodes_per_instruction[m_slot_instructions[slot]];
+  }
+  for (const NativeNode& node : m_native_nodes) {
+    costs[node.node_id] = static_cast<float>(total_ns[node.instruction] / nodes_per_instruction[node.instruction] /
+                                             std::max(num_blocks, 1));
+  }
+  return costs;
+}
+} // namespace madronavm
@@ -0,0 +1,144 @@
+// Work-stealing execution of a task dependency graph
+#include "vm/task_graph.h"
+#include "common/cpu_relax.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+namespace madronavm {
+namespace {
+// Weight of a new measurement in the smoothed cost.
+constexpr float kCostSmoothing = 0.25f;
+// Spins this many times without finding work before also yielding, in case
+// the thread holding the work we wait for was preempted.
+constexpr int kSpinsBeforeYield = 1 << 10;
+} // namespace
+void TaskGraph::build(const std::vector<std::vector<uint32_t>>& successors) {
+  m_num_tasks = successors.size();
+  m_successor_starts.assign(1, 0);
+  m_successors.clear();
+  m_num_predecessors.assign(m_num_tasks, 0);
+  for (const auto& task_successors : successors) {
+    for (uint32_t successor : task_successors) {
+      m_successors.push_back(successor);
+      ++m_num_predecessors[successor];
+    }
+    m_successor_starts.push_back(static_cast<uint32_t>(m_successors.size()));
+  }
+  m_roots.clear();
+  for (uint32_t task = 0; task < m_num_tasks; ++task) {
+    if (m_num_predecessors[task] == 0) {
+      m_roots.push_back(task);
+    }
+  }
+  m_cost.assign(m_num_tasks, 1.0f);
+  m_priority.assign(m_num_tasks, 0.0f);
+  m_sample.assign(m_num_tasks, 0.0f);
+  m_pending = std::make_unique<std::atomic<uint32_t>[]>(m_num_tasks);
+  for (WorkStealingDeque& deque : m_deques) {
+    deque.reset_capacity(m_num_tasks);
+  }
+  m_blocks = 0;
+  update_priorities();
+}
+void TaskGraph::run(WorkerPool& pool, Execute execute, void* context) {
+  if (m_num_tasks == 0) {
+    return;
+  }
+  const uint32_t num_participants =
+      static_cast<uint32_t>(std::min(pool.num_workers() + 1, kMaxParticipants));
+  const bool profile = m_blocks++ % kProfileInterval == 0;
+  for (size_t task = 0; task < m_num_tasks; ++task) {
+    m_pending[task].store(m_num_predecessors[task], std::memory_order_relaxed);
+  }
+  for (uint32_t p = 0; p < num_participants; ++p) {
+    m_deques[p].clear();
+  }
+  // Roots are sorted by ascending priority, so dealing them out in order
+  // leaves the most critical ones at the bottoms of the deques, where
+  // their owners pop first.
+  for (size_t i = 0; i < m_roots.size(); ++i) {
+    m_deques[i % num_participants].push(m_roots[i]);
+  }
+  m_remaining.store(static_cast<uint32_t>(m_num_tasks), std::memory_order_relaxed);
+  // parallel_for publishes all of the above to the workers.
+  RunContext run{this, execute, context, num_participants, profile};
+  pool.parallel_for(&TaskGraph::participate, &run, num_participants);
+  if (profile) {
+    // The first measurement replaces the placeholder unit costs outright.
+    const float weight = m_blocks == 1 ? 1.0f : kCostSmoothing;
+    for (size_t task = 0; task < m_num_tasks; ++task) {
+      m_cost[task] += weight * (m_sample[task] - m_cost[task]);
+    }
+    update_priorities();
+  }
+}
+void TaskGraph::participate(void* context, uint32_t participant) {
+  const auto* run = static_cast<const RunContext*>(context);
+  run->graph->participate(*run, participant);
+}
+// Participant indices are claimed from the pool, so each deque has exactly
+// one owner per run even if one thread ends up claiming several indices.
+void TaskGraph::participate(const RunContext& run, uint32_t participant) {
+  WorkStealingDeque& own = m_deques[participant];
+  int spins = 0;
+  while (m_remaining.load(std::memory_order_acquire) > 0) {
+    uint32_t task = own.pop();
+    for (uint32_t i = 1; task == WorkStealingDeque::kEmpty && i < run.num_participants; ++i) {
+      task = m_deques[(participant + i) % run.num_participants].steal();
+    }
+    if (task == WorkStealingDeque::kEmpty) {
+      if (++spins < kSpinsBeforeYield) {
+        cpu_relax();
+      } else {
+        spins = 0;
+        std::this_thread::yield();
+      }
+      continue;
+    }
+    spins = 0;
+    if (run.profile) {
+      const auto start = std::chrono::steady_clock::now();
+      run.execute(run.context, task);
+      m_sample[task] = std::chrono::duration<float, std::nano>(
+          std::chrono::steady_clock::now() - start).count();
+    } else {
+      run.execute(run.context, task);
+    }
+    // Successors are in ascending priority, so the most critical one that
+    // becomes ready is pushed last and popped next by this thread.
+    for (uint32_t i = m_successor_starts[task]; i < m_successor_starts[task + 1]; ++i) {
+      const uint32_t successor = m_successors[i];
+      if (m_pending[successor].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        own.push(successor);
+      }
+    }
+    m_remaining.fetch_sub(1, std::memory_order_acq_rel);
+  }
+}
+void TaskGraph::update_priorities() {
+  for (size_t task = m_num_tasks; task-- > 0;) {
+    float longest = 0.0f;
+    for (uint32_t i = m_successor_starts[task]; i < m_successor_starts[task + 1]; ++i) {
+      longest = std::max(longest, m_priority[m_successors[i]]);
+    }
+    m_priority[task] = m_cost[task] + longest;
+  }
+  sort_by_priority(m_roots.data(), m_roots.data() + m_roots.size());
+  for (size_t task = 0; task < m_num_tasks; ++task) {
+    sort_by_priority(m_successors.data() + m_successor_starts[task],
+                     m_successors.data() + m_successor_starts[task + 1]);
+  }
+}
+// Insertion sort: the lists are short and nearly sorted from the previous
+// update, and unlike std::sort this is guaranteed not to allocate.
+void TaskGraph::sort_by_priority(uint32_t* first, uint32_t* last) {
+  for (uint32_t* i = first + (first != last); i < last; ++i) {
+    const uint32_t task = *i;
+    uint32_t* j = i;
+    for (; j > first && m_priority[*(j - 1)] > m_priority[task]; --j) {
+      *j = *(j - 1);
+    }
+    *j = task;
+  }
+}
+} // namespace madronavm
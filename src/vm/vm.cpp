@@ -1,184 +1,234 @@
 // Virtual machine implementation
 #include "vm/vm.h"
-#include "vm/opcodes.h"
-#include "dsp/sine_gen.h"
-#include "dsp/phasor_gen.h"
-#include "dsp/gain.h"
 #include "dsp/audio_out.h"
-#include "dsp/float.h"
-#include "dsp/int.h"
-#include "dsp/add.h"
-#include "dsp/mul.h"
-#include "dsp/adsr.h"
-#include "dsp/threshold.h"
-#include "dsp/lopass.h"
-#include "dsp/hipass.h"
-#include "dsp/bandpass.h"
-#include "dsp/saw_gen.h"
-#include "dsp/pulse_gen.h"
-#include "dsp/biquad.h"
-#include "common/embedded_logging.h"
+#include "dsp/module_factory.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <exception>
 #include <limits>
+#include <utility>
 namespace madronavm {
-constexpr uint32_t kNullRegister = std::numeric_limits<uint32_t>::max();
-VM::VM(const ModuleRegistry& registry, float sampleRate, bool testMode) 
+VM::VM(const ModuleRegistry& registry, float sampleRate, bool testMode)
   : m_registry(registry), m_sampleRate(sampleRate), m_testMode(testMode) {}
-VM::~VM() {}
-std::unique_ptr<dsp::DSPModule> VM::create_module(uint32_t module_id) {
-  // Map module IDs to their implementations based on data/modules.json
-  switch (module_id) {
-    case 1: // audio_out (0x001)
-      // The VM should not create a real audio driver. The main application
-      // will create the "real" AudioOut module and link it to the VM.
-      // We create one in test mode here so it exists as a module instance,
-      // but it won't try to open an audio device.
-      return std::make_unique<AudioOut>(m_sampleRate, true);
-    case 256: // sine_gen (0x100)
-      return std::make_unique<dsp::SineGen>(m_sampleRate);
-    case 257: // saw_gen (0x101)
-      return std::make_unique<dsp::SawGen>(m_sampleRate);
-    case 258: // pulse_gen (0x102)
-      return std::make_unique<dsp::PulseGen>(m_sampleRate);
-    case 259: // phasor_gen (0x103 - temporary, not in spec)
-      return std::make_unique<dsp::PhasorGen>(m_sampleRate);
-    case 512: // lopass (0x200)
-      return std::make_unique<dsp::Lopass>(m_sampleRate);
-    case 513: // hipass (0x201)
-      return std::make_unique<dsp::Hipass>(m_sampleRate);
-    case 514: // bandpass (0x202)
-      return std::make_unique<dsp::Bandpass>(m_sampleRate);
-    case 516: // biquad (0x204)
-      return std::make_unique<dsp::Biquad>(m_sampleRate);
-    case 1024: // add (0x400)
-      return std::make_unique<dsp::Add>(m_sampleRate);
-    case 1025: // mul (0x401)
-      return std::make_unique<dsp::Mul>(m_sampleRate);
-    case 1027: // gain (0x403)
-      return std::make_unique<dsp::Gain>(m_sampleRate);
-    case 1028: // float (0x404)
-      return std::make_unique<dsp::Float>(m_sampleRate);
-    case 1029: // int (0x405)
-      return std::make_unique<dsp::Int>(m_sampleRate);
-    case 1280: // threshold (0x500)
-      return std::make_unique<dsp::Threshold>(m_sampleRate);
-    case 1536: // adsr (0x600)
-      return std::make_unique<dsp::ADSR>(m_sampleRate);
-    default:
-      throw std::runtime_error("Unknown module ID: " + std::to_string(module_id));
-  }
+VM::~VM() {
+  // The audio thread must have stopped calling process() by now.
+  delete m_pending_program.exchange(nullptr);
+  delete m_active_program;
+  collect_retired_programs();
 }
 void VM::load_program(std::vector<uint32_t> new_bytecode) {
-  // TODO: make this thread-safe
-  m_bytecode = std::move(new_bytecode);
-  // Clear any existing module instances
-  m_module_instances.clear();
-  if (m_bytecode.size() < sizeof(BytecodeHeader) / sizeof(uint32_t)) {
-    uint32_t required_size = sizeof(BytecodeHeader) / sizeof(uint32_t);
-    MADRONA_VM_LOG_ERROR("Bytecode too small: %u words, need %u", 
-                         (uint32_t)m_bytecode.size(), required_size);
-    m_bytecode.clear();
+  // Take back a program the audio thread has not picked up yet; it was never
+  // seen there, so it can be freed immediately. With nothing pending the
+  // audio thread's program cannot change until the next publish, so
+  // m_published_program is exactly the program the new one will replace.
+  if (Program* unclaimed = m_pending_program.exchange(nullptr, std::memory_order_acq_rel)) {
+    m_published_program = unclaimed->replaced_program();
+    delete unclaimed;
+  }
+  m_pending_program.store(prepare_program(std::move(new_bytecode)), std::memory_order_release);
+}
+Program* VM::prepare_program(std::vector<uint32_t> new_bytecode) {
+  collect_retired_programs();
+  // All allocation, page faulting and module construction happens here, on
+  // the caller's thread; nodes that survive the edit are left for the swap to move over.
+  // Malformed bytecode still yields a (silent) program, so a bad load
+  // replaces the running patch exactly as it did before.
+  Program* program = new Program(std::move(new_bytecode), m_sampleRate, m_published_program,
+                                 m_memory_options);
+  m_published_program = program;
+  return program;
+}
+bool VM::publish_program(Program* program) {
+  Program* unclaimed = nullptr;
+  return m_pending_program.compare_exchange_strong(unclaimed, program, std::memory_order_release,
+                                                   std::memory_order_relaxed);
+}
+void VM::discard_program(Program* program) {
+  m_published_program = program->replaced_program();
+  delete program;
+}
+void VM::collect_retired_programs() {
+  Program* retired = nullptr;
+  while (m_retired_programs.try_pop(retired)) {
+    delete retired;
+  }
+}
+size_t VM::num_output_channels() const {
+  return m_published_program ? m_published_program->num_output_channels() : 0;
+}
+bool VM::has_node(uint32_t node_id) const {
+  return m_published_program &&
+         m_published_program->module_id_for_node(node_id) != std::numeric_limits<uint32_t>::max();
+}
+size_t VM::latency_frames() const {
+  return m_published_program ? m_published_program->latency_blocks() * kFloatsPerDSPVector : 0;
+}
+void VM::adopt_pending_program() {
+  if (m_pending_program.load(std::memory_order_relaxed) == nullptr) {
     return;
   }
-  auto* header = reinterpret_cast<const BytecodeHeader*>(m_bytecode.data());
-  if (header->magic_number != kMagicNumber) {
-    MADRONA_VM_LOG_ERROR("Invalid magic number: got 0x%08X, expected 0x%08X", 
-                         header->magic_number, kMagicNumber);
-    m_bytecode.clear();
+  // If the retire queue is full the control thread has not collected for a
+  // while; keep the current program one more block rather than leak it.
+  if (m_active_program && !m_retired_programs.can_push()) {
     return;
   }
-  if (header->version != kBytecodeVersion) {
-    MADRONA_VM_LOG_ERROR("Version mismatch: got %u, expected %u", 
-                         header->version, kBytecodeVersion);
-    m_bytecode.clear();
+  Program* next = m_pending_program.exchange(nullptr, std::memory_order_acq_rel);
+  if (!next) {
     return;
   }
-  m_registers.resize(header->num_registers);
+  // The old program has finished its last block: hand its module state over.
+  next->take_state_from(m_active_program);
+  if (m_active_program) {
+    m_retired_programs.try_push(m_active_program);
+  }
+  m_active_program = next;
+}
+bool VM::post_event(uint32_t node_id, const ml::Event& event) {
+  return m_events.try_push({node_id, event});
+}
+void VM::schedule_events() {
+  // Event times count from the first frame this call hands the host: the
+  // oldest frame still in the FIFO, or else the next one to be rendered.
+  const uint64_t call_start = m_frames_rendered - m_fifo_frames;
+  NodeEvent queued;
+  while (m_num_scheduled < m_scheduled.size() && m_events.try_pop(queued)) {
+    const uint64_t frame = call_start + static_cast<uint64_t>(std::max(queued.event.time, 0));
+    // Insertion keeps frame order and, for equal frames, posting order;
+    // events normally arrive in order, so this rarely moves anything.
+    size_t i = m_num_scheduled++;
+    while (i > 0 && m_scheduled[i - 1].frame > frame) {
+      m_scheduled[i] = m_scheduled[i - 1];
+      --i;
+    }
+    m_scheduled[i] = {frame, queued};
+  }
+}
+void VM::deliver_events() {
+  const uint64_t block_start = m_frames_rendered;
+  const uint64_t block_end = block_start + kFloatsPerDSPVector;
+  size_t delivered = 0;
+  while (delivered < m_num_scheduled && m_scheduled[delivered].frame < block_end) {
+    NodeEvent& queued = m_scheduled[delivered].queued;
+    const uint64_t frame = m_scheduled[delivered].frame;
+    queued.event.time = frame > block_start ? static_cast<int>(frame - block_start) : 0;
+    dsp::DSPModule* module =
+        m_active_program ? m_active_program->module_for_node(queued.node_id) : nullptr;
+    if (module) {
+      module->handle_event(queued.event);
+    }
+    ++delivered;
+  }
+  if (delivered > 0) {
+    std::copy(m_scheduled.begin() + delivered, m_scheduled.begin() + m_num_scheduled,
+              m_scheduled.begin());
+    m_num_scheduled -= delivered;
+  }
+}
+bool VM::set_parameter(uint32_t node_id, const std::string& port, float value, uint32_t ramp_blocks) {
+  if (!m_published_program) {
+    return false;
+  }
+  const uint32_t module_id = m_published_program->module_id_for_node(node_id);
+  if (module_id == std::numeric_limits<uint32_t>::max()) {
+    return false;
+  }
+  const ModuleInfo* info = nullptr;
+  try {
+    info = &m_registry.get_info(m_registry.get_name(module_id & ~dsp::kPolyVariant));
+  } catch (const std::exception&) {
+    return false;
+  }
+  auto it = std::find(info->inputs.begin(), info->inputs.end(), port);
+  if (it == info->inputs.end()) {
+    return false;
+  }
+  const uint32_t index = static_cast<uint32_t>(it - info->inputs.begin());
+  return m_parameters.try_push({node_id, index, value, ramp_blocks});
+}
+void VM::apply_parameters() {
+  ParameterChange change;
+  while (m_parameters.try_pop(change)) {
+    if (m_active_program) {
+      m_active_program->set_parameter(change.node_id, change.port, change.value, change.ramp_blocks);
+    }
+  }
 }
 void VM::set_audio_out_module(AudioOut* pModule) {
     m_audio_out_module = pModule;
 }
+void VM::set_worker_pool(WorkerPool* pool, Schedule schedule) {
+    m_schedule.store(schedule, std::memory_order_relaxed);
+    m_worker_pool.store(pool, std::memory_order_release);
+}
 const ml::DSPVector& VM::getRegisterForTest(int index) const {
-    return m_registers[index];
+    return m_active_program->get_register(index);
 }
 void VM::processBlock(float** outputs, int blockSize) {
-    // For now, we ignore inputs and assume blockSize matches kFloatsPerDSPVector
+    // The VM takes no audio inputs yet.
     this->process(nullptr, outputs, blockSize);
 }
 void VM::process(const float **inputs, float **outputs, int num_frames) {
-  if (m_bytecode.empty()) {
-    // If there's no program, we should probably output silence.
-    if(outputs && outputs[0] && outputs[1]) {
-        for(int i=0; i<num_frames; ++i) {
-            outputs[0][i] = 0.f;
-            outputs[1][i] = 0.f;
-        }
-    }
-    return;
+  // Block boundary: the only point at which the running program changes.
+  adopt_pending_program();
+  apply_parameters();
+  schedule_events();
+  Program* program = m_active_program;
+  const bool has_program = program && !program->empty();
+  // Host channels are the leading non-null entries of outputs, up to the
+  // number the program writes (stereo silence without a program).
+  const size_t max_channels = has_program ? program->num_output_channels() : 2;
+  size_t num_channels = 0;
+  while (outputs && num_channels < max_channels && outputs[num_channels]) {
+    ++num_channels;
   }
-  size_t pc = sizeof(BytecodeHeader) / sizeof(uint32_t);
-  while (pc < m_bytecode.size()) {
-    OpCode opcode = static_cast<OpCode>(m_bytecode[pc]);
-    switch (opcode) {
-    case OpCode::LOAD_K: {
-      uint32_t dest_reg = m_bytecode[pc + 1];
-      uint32_t value_bits = m_bytecode[pc + 2];
-      float value = *reinterpret_cast<float*>(&value_bits);
-      m_registers[dest_reg] = value;
-      pc += 3;
-      break;
-    }
-    case OpCode::PROC: {
-      uint32_t node_id = m_bytecode[pc + 1];
-      uint32_t module_id = m_bytecode[pc + 2];
-      uint32_t num_inputs = m_bytecode[pc + 3];
-      uint32_t num_outputs = m_bytecode[pc + 4];
-      // Create module instance if it doesn't exist
-      if (m_module_instances.find(node_id) == m_module_instances.end()) {
-        m_module_instances[node_id] = create_module(module_id);
-      }
-      // Gather input register pointers
-      std::vector<const float*> input_ptrs(num_inputs);
-      for (uint32_t i = 0; i < num_inputs; ++i) {
-        uint32_t reg_idx = m_bytecode[pc + 5 + i];
-        if (reg_idx == kNullRegister) {
-            input_ptrs[i] = nullptr;
-        } else {
-            input_ptrs[i] = m_registers[reg_idx].getConstBuffer();
-        }
-      }
-      // Gather output register pointers  
-      std::vector<float*> output_ptrs(num_outputs);
-      for (uint32_t i = 0; i < num_outputs; ++i) {
-        uint32_t reg_idx = m_bytecode[pc + 5 + num_inputs + i];
-        output_ptrs[i] = m_registers[reg_idx].getBuffer();
-      }
-      // Call the module's process method
-      m_module_instances[node_id]->process(input_ptrs.data(), num_inputs, output_ptrs.data(), num_outputs);
-      pc += 5 + num_inputs + num_outputs;
-      break;
+  int done = 0;
+  // Frames rendered ahead by the previous call's trailing partial pass.
+  if (m_fifo_frames > 0) {
+    const int frames = std::min(m_fifo_frames, num_frames);
+    const int start = kFloatsPerDSPVector - m_fifo_frames;
+    for (size_t c = 0; c < num_channels; ++c) {
+      std::memcpy(outputs[c], m_fifo[c].getConstBuffer() + start, frames * sizeof(float));
     }
-    case OpCode::AUDIO_OUT: {
-      uint32_t num_inputs = m_bytecode[pc + 1];
-      if (outputs) { // Only process if we have output buffers
-          for (uint32_t i = 0; i < num_inputs; ++i) {
-              if (outputs[i]) { // Check if the specific output channel is valid
-                  uint32_t reg_idx = m_bytecode[pc + 2 + i];
-                  std::memcpy(outputs[i], m_registers[reg_idx].getConstBuffer(), num_frames * sizeof(float));
-              }
-          }
-      }
-      pc += 2 + num_inputs;
-      break;
+    m_fifo_frames -= frames;
+    done += frames;
+  }
+  if (!has_program) {
+    // Nothing to deliver to.
+    m_num_scheduled = 0;
+    for (size_t c = 0; c < num_channels; ++c) {
+      std::fill(outputs[c] + done, outputs[c] + num_frames, 0.f);
     }
-    case OpCode::END: {
-      return; // End of program for this block
+    return;
+  }
+  WorkerPool* pool = m_worker_pool.load(std::memory_order_acquire);
+  const Schedule schedule = m_schedule.load(std::memory_order_relaxed);
+  std::array<float*, Program::kMaxOutputChannels> pass_outputs{};
+  // Whole vectors are rendered straight into the host buffers.
+  while (num_frames - done >= kFloatsPerDSPVector) {
+    for (size_t c = 0; c < num_channels; ++c) {
+      pass_outputs[c] = outputs[c] + done;
     }
-    default: {
-      MADRONA_VM_LOG_ERROR("Unknown opcode: 0x%02X at PC=%u", 
-                           m_bytecode[pc], (uint32_t)pc);
-      return;
+    deliver_events();
+    program->run(pass_outputs.data(), pool, schedule);
+    m_frames_rendered += kFloatsPerDSPVector;
+    done += kFloatsPerDSPVector;
+  }
+  // A trailing partial block renders one more vector into the FIFO, hands
+  // out its head and keeps the rest for the start of the next call. This
+  // adds no latency: the extra frames are produced early, not late.
+  if (done < num_frames) {
+    for (size_t c = 0; c < num_channels; ++c) {
+      pass_outputs[c] = m_fifo[c].getBuffer();
     }
+    deliver_events();
+    program->run(pass_outputs.data(), pool, schedule);
+    m_frames_rendered += kFloatsPerDSPVector;
+    const int frames = num_frames - done;
+    for (size_t c = 0; c < num_channels; ++c) {
+      std::memcpy(outputs[c] + done, m_fifo[c].getConstBuffer(), frames * sizeof(float));
     }
+    m_fifo_frames = kFloatsPerDSPVector - frames;
   }
 }
 } // namespace madronavm
@@ -0,0 +1,111 @@
+#include "vm/worker_pool.h"
+#include "common/cpu_relax.h"
+#include <algorithm>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+namespace madronavm {
+namespace {
+// Spins this many times before also yielding the time slice, so idle
+// workers between blocks do not starve other threads completely.
+constexpr int kSpinsBeforeYield = 1 << 14;
+constexpr uint32_t generation_of(uint64_t work) {
+  return static_cast<uint32_t>(work >> 32);
+}
+} // namespace
+WorkerPool::WorkerPool(size_t num_workers, bool pin_threads) {
+  m_threads.reserve(num_workers);
+  const size_t num_cores = std::max(1u, std::thread::hardware_concurrency());
+  for (size_t i = 0; i < num_workers; ++i) {
+    m_threads.emplace_back([this] { worker_loop(); });
+    if (pin_threads) {
+      pin_to_core(m_threads.back(), (i + 1) % num_cores);
+    }
+  }
+}
+WorkerPool::~WorkerPool() {
+  m_stop.store(true, std::memory_order_release);
+  for (auto& thread : m_threads) {
+    thread.join();
+  }
+}
+void WorkerPool::pin_to_core(std::thread& thread, size_t core) {
+#if defined(__linux__)
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(core, &cpus);
+  // Best effort: in a restricted cpuset this fails and the thread floats.
+  pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+#else
+  // No portable hard affinity elsewhere (macOS only offers hints).
+  (void)thread;
+  (void)core;
+#endif
+}
+void WorkerPool::parallel_for(Task task, void* context, uint32_t count) {
+  if (count == 0) {
+    return;
+  }
+  if (m_threads.empty()) {
+    for (uint32_t i = 0; i < count; ++i) {
+      task(context, i);
+    }
+    return;
+  }
+  const uint32_t previous = generation_of(m_work.load(std::memory_order_relaxed));
+  // Closes the previous job before its fields change. A worker that has
+  // just claimed its last index still holds that generation; were the word
+  // left as it is, it could read this job's count, find its stale index in
+  // range and claim it with a compare-exchange that nothing has invalidated.
+  m_work.store((uint64_t(previous) << 32) | UINT32_MAX, std::memory_order_release);
+  const uint32_t generation = previous + 1;
+  m_task.store(task, std::memory_order_relaxed);
+  m_context.store(context, std::memory_order_relaxed);
+  m_count.store(count, std::memory_order_relaxed);
+  m_done.store(0, std::memory_order_relaxed);
+  // Publishes the job: everything above happens-before a worker's claim.
+  m_work.store(uint64_t(generation) << 32, std::memory_order_release);
+  run_tasks(generation);
+  while (m_done.load(std::memory_order_acquire) != count) {
+    cpu_relax();
+  }
+}
+void WorkerPool::run_tasks(uint32_t generation) {
+  uint64_t work = m_work.load(std::memory_order_acquire);
+  while (generation_of(work) == generation) {
+    const Task task = m_task.load(std::memory_order_relaxed);
+    void* context = m_context.load(std::memory_order_relaxed);
+    const uint32_t count = m_count.load(std::memory_order_relaxed);
+    const uint32_t index = static_cast<uint32_t>(work);
+    if (index >= count) {
+      return;
+    }
+    if (m_work.compare_exchange_weak(work, work + 1, std::memory_order_acq_rel,
+                                     std::memory_order_acquire)) {
+      task(context, index);
+      m_done.fetch_add(1, std::memory_order_release);
+      work = m_work.load(std::memory_order_acquire);
+    }
+  }
+}
+void WorkerPool::worker_loop() {
+  uint32_t seen = generation_of(m_work.load(std::memory_order_acquire));
+  int spins = 0;
+  while (!m_stop.load(std::memory_order_acquire)) {
+    const uint32_t generation = generation_of(m_work.load(std::memory_order_acquire));
+    if (generation == seen) {
+      if (++spins < kSpinsBeforeYield) {
+        cpu_relax();
+      } else {
+        spins = 0;
+        std::this_thread::yield();
+      }
+      continue;
+    }
+    seen = generation;
+    spins = 0;
+    run_tasks(generation);
+  }
+}
+} // namespace madronavm
@@ -0,0 +1,82 @@
+#include "catch.hpp"
+#include "realtime_guard.h"
+#include "vm/vm.h"
+#include "compiler/compiler.h"
+#include "parser/parser.h"
+#include "compiler/module_registry.h"
+#include <algorithm>
+#include <vector>
+#ifndef MODULE_DEFS_PATH
+#define MODULE_DEFS_PATH "data/modules.json"
+#endif
+using namespace madronavm;
+namespace {
+constexpr float kSampleRate = 48000.0f;
+const char* kStereoPatch = R"({
+  "modules": [
+    {"id": 1, "name": "sine_gen", "data": {"freq": 330.0}},
+    {"id": 2, "name": "saw_gen", "data": {"freq": 110.0}},
+    {"id": 3, "name": "audio_out", "data": {}}
+  ],
+  "connections": [
+    {"from": "1:out", "to": "3:in_l"},
+    {"from": "2:out", "to": "3:in_r"}
+  ]
+})";
+// Renders total_frames frames in host buffers of the given sizes, cycling
+// through them, and returns both channels back to back.
+std::vector<float> render(VM& vm, const std::vector<int>& buffer_sizes, int total_frames) {
+  std::vector<float> left(total_frames), right(total_frames);
+  int done = 0;
+  for (size_t i = 0; done < total_frames; ++i) {
+    const int frames = std::min(buffer_sizes[i % buffer_sizes.size()], total_frames - done);
+    float* outputs[] = { left.data() + done, right.data() + done };
+    vm.process(nullptr, outputs, frames);
+    done += frames;
+  }
+  left.insert(left.end(), right.begin(), right.end());
+  return left;
+}
+} // namespace
+TEST_CASE("VM renders any host buffer size identically", "[vm]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  const auto bytecode = Compiler::compile(parse_json(kStereoPatch), registry);
+  constexpr int kTotalFrames = 64 * 60;
+  VM reference_vm(registry, kSampleRate, true);
+  reference_vm.load_program(bytecode);
+  const std::vector<float> reference = render(reference_vm, {kFloatsPerDSPVector}, kTotalFrames);
+  const std::vector<std::vector<int>> schedules = {
+    {128}, {256}, {480}, {512}, {1}, {63}, {65}, {37, 100, 1, 512, 64, 7}
+  };
+  for (const auto& schedule : schedules) {
+    VM vm(registry, kSampleRate, true);
+    vm.load_program(bytecode);
+    INFO("first buffer size " << schedule.front());
+    REQUIRE(render(vm, schedule, kTotalFrames) == reference);
+  }
+}
+TEST_CASE("VM sub-blocking is allocation free", "[vm][realtime]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  VM vm(registry, kSampleRate, true);
+  vm.load_program(Compiler::compile(parse_json(kStereoPatch), registry));
+  std::vector<float> out_l(512), out_r(512);
+  float* outputs[] = { out_l.data(), out_r.data() };
+  size_t count = test::count_audio_thread_allocations([&] {
+    for (int frames : {480, 512, 37, 1, 256}) {
+      vm.process(nullptr, outputs, frames);
+    }
+  });
+  REQUIRE(count == 0);
+}
+TEST_CASE("VM stops at the first null output channel", "[vm]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  VM vm(registry, kSampleRate, true);
+  vm.load_program(Compiler::compile(parse_json(kStereoPatch), registry));
+  // A mono host: the null second entry ends the channel list.
+  std::vector<float> out_l(256, 2.0f);
+  float* outputs[] = { out_l.data(), nullptr };
+  vm.process(nullptr, outputs, 256);
+  REQUIRE(out_l[255] != 2.0f);
+  outputs[0] = nullptr;
+  vm.process(nullptr, outputs, 100);
+}
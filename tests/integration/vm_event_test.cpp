@@ -0,0 +1,133 @@
+#include "catch.hpp"
+#include "realtime_guard.h"
+#include "vm/vm.h"
+#include "compiler/compiler.h"
+#include "parser/parser.h"
+#include "compiler/module_registry.h"
+#include "MLEventsToSignals.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#ifndef MODULE_DEFS_PATH
+#define MODULE_DEFS_PATH "data/modules.json"
+#endif
+using namespace madronavm;
+namespace {
+constexpr float kSampleRate = 48000.0f;
+// A four-voice controller: the summed gates on the left, the summed
+// pitches on the right.
+const char* kVoicesPatch = R"({
+  "modules": [
+    {"id": 1, "name": "voice_controller", "voices": 4, "data": {}},
+    {"id": 2, "name": "voice_mix", "data": {}},
+    {"id": 3, "name": "voice_mix", "data": {}},
+    {"id": 4, "name": "audio_out", "data": {}}
+  ],
+  "connections": [
+    {"from": "1:gate", "to": "2:in"},
+    {"from": "1:pitch", "to": "3:in"},
+    {"from": "2:out", "to": "4:in_l"},
+    {"from": "3:out", "to": "4:in_r"}
+  ]
+})";
+ml::Event note(int type, int pitch) {
+  ml::Event e;
+  e.type = type;
+  e.value1 = static_cast<float>(pitch);
+  e.value2 = 1.0f;
+  return e;
+}
+struct Block {
+  std::vector<float> left = std::vector<float>(kFloatsPerDSPVector);
+  std::vector<float> right = std::vector<float>(kFloatsPerDSPVector);
+  float* outputs[2] = { left.data(), right.data() };
+};
+} // namespace
+TEST_CASE("VM routes posted events to modules by node id", "[vm]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  VM vm(registry, kSampleRate, true);
+  vm.load_program(Compiler::compile(parse_json(kVoicesPatch), registry));
+  Block block;
+  vm.process(nullptr, block.outputs, kFloatsPerDSPVector);
+  REQUIRE(block.left.back() == 0.0f);
+  REQUIRE(vm.post_event(1, note(ml::kNoteOn, 60)));
+  REQUIRE(vm.post_event(1, note(ml::kNoteOn, 64)));
+  // Nodes without a module, or without events, ignore them.
+  REQUIRE(vm.post_event(2, note(ml::kNoteOn, 67)));
+  REQUIRE(vm.post_event(99, note(ml::kNoteOn, 67)));
+  vm.process(nullptr, block.outputs, kFloatsPerDSPVector);
+  REQUIRE(block.left.back() == 2.0f);
+  REQUIRE(block.right.back() == 124.0f);
+  REQUIRE(vm.post_event(1, note(ml::kNoteOff, 60)));
+  vm.process(nullptr, block.outputs, kFloatsPerDSPVector);
+  REQUIRE(block.left.back() == 1.0f);
+  REQUIRE(block.right.back() == 64.0f);
+}
+TEST_CASE("VM applies events at their frame", "[vm]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  // Whatever the host buffer size, a note from frame 100 to frame 300 of
+  // the stream opens the gate for exactly those frames.
+  for (int buffer_size : {512, 64, 37, 100}) {
+    VM vm(registry, kSampleRate, true);
+    vm.load_program(Compiler::compile(parse_json(kVoicesPatch), registry));
+    ml::Event on = note(ml::kNoteOn, 60);
+    on.time = 100;
+    ml::Event off = note(ml::kNoteOff, 60);
+    off.time = 300;
+    REQUIRE(vm.post_event(1, on));
+    REQUIRE(vm.post_event(1, off));
+    std::vector<float> left(512), right(512);
+    for (int done = 0; done < 512; done += buffer_size) {
+      const int frames = std::min(buffer_size, 512 - done);
+      float* outputs[] = { left.data() + done, right.data() + done };
+      vm.process(nullptr, outputs, frames);
+    }
+    INFO("buffer size " << buffer_size);
+    for (int frame = 0; frame < 512; ++frame) {
+      INFO("frame " << frame);
+      REQUIRE(left[frame] == (frame >= 100 && frame < 300 ? 1.0f : 0.0f));
+    }
+  }
+}
+TEST_CASE("VM event queue reports when it is full", "[vm]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  VM vm(registry, kSampleRate, true);
+  for (size_t i = 0; i < VM::kEventQueueSize - 1; ++i) {
+    REQUIRE(vm.post_event(1, note(ml::kNoteOn, 60)));
+  }
+  REQUIRE_FALSE(vm.post_event(1, note(ml::kNoteOn, 60)));
+  // A block drains it, even with no program to deliver to.
+  Block block;
+  vm.process(nullptr, block.outputs, kFloatsPerDSPVector);
+  REQUIRE(vm.post_event(1, note(ml::kNoteOn, 60)));
+}
+TEST_CASE("VM takes events from a control thread without allocating", "[vm][realtime]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  VM vm(registry, kSampleRate, true);
+  vm.load_program(Compiler::compile(parse_json(kVoicesPatch), registry));
+  constexpr int kNotes = 20000;
+  std::atomic<bool> done{false};
+  std::thread sequencer([&] {
+    for (int i = 0; i < kNotes; ++i) {
+      for (int type : {ml::kNoteOn, ml::kNoteOff}) {
+        while (!vm.post_event(1, note(type, 36 + i % 48))) {
+          std::this_thread::yield();
+        }
+      }
+    }
+    done.store(true, std::memory_order_release);
+  });
+  Block block;
+  size_t count = test::count_audio_thread_allocations([&] {
+    while (!done.load(std::memory_order_acquire)) {
+      vm.process(nullptr, block.outputs, kFloatsPerDSPVector);
+    }
+    // Whatever was still queued.
+    vm.process(nullptr, block.outputs, kFloatsPerDSPVector);
+  });
+  sequencer.join();
+  REQUIRE(count == 0);
+  // Every note was released again.
+  REQUIRE(block.left.back() == 0.0f);
+}
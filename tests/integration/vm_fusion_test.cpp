@@ -0,0 +1,140 @@
+#include "catch.hpp"
+#include "vm/vm.h"
+#include "vm/opcodes.h"
+#include "compiler/compiler.h"
+#include "parser/parser.h"
+#include "compiler/module_registry.h"
+#include <algorithm>
+#include <vector>
+#ifndef MODULE_DEFS_PATH
+#define MODULE_DEFS_PATH "data/modules.json"
+#endif
+using namespace madronavm;
+namespace {
+constexpr float kSampleRate = 48000.0f;
+// (sine * saw + 0.25 > 0.1) * 0.5 on the left, a tree of four nodes that
+// fuses into one EXPR; the sine also feeds a gain on the right.
+const char* kTreePatch = R"({
+  "modules": [
+    {"id": 1, "name": "sine_gen", "data": {"freq": 220.0}},
+    {"id": 2, "name": "saw_gen", "data": {"freq": 110.0}},
+    {"id": 3, "name": "mul", "data": {}},
+    {"id": 4, "name": "add", "data": {"in2": 0.25}},
+    {"id": 5, "name": "threshold", "data": {"threshold": 0.1}},
+    {"id": 6, "name": "gain", "data": {"gain": 0.5}},
+    {"id": 7, "name": "gain", "data": {"gain": 0.3}},
+    {"id": 8, "name": "audio_out", "data": {}}
+  ],
+  "connections": [
+    {"from": "1:out", "to": "3:in1"},
+    {"from": "2:out", "to": "3:in2"},
+    {"from": "3:out", "to": "4:in1"},
+    {"from": "4:out", "to": "5:signal"},
+    {"from": "5:out", "to": "6:in"},
+    {"from": "1:out", "to": "7:in"},
+    {"from": "6:out", "to": "8:in_l"},
+    {"from": "7:out", "to": "8:in_r"}
+  ]
+})";
+// A phasor swept into a sine's frequency through phasor * 200 + 300, a
+// tree the phasor feeds, and the sine into its gain.
+const char* kModulatorPatch = R"({
+  "modules": [
+    {"id": 1, "name": "phasor_gen", "data": {"freq": 3.0}},
+    {"id": 2, "name": "mul", "data": {"in2": 200.0}},
+    {"id": 3, "name": "add", "data": {"in2": 300.0}},
+    {"id": 4, "name": "sine_gen", "data": {}},
+    {"id": 5, "name": "gain", "data": {"gain": 0.5}},
+    {"id": 6, "name": "audio_out", "data": {}}
+  ],
+  "connections": [
+    {"from": "1:out", "to": "2:in1"},
+    {"from": "2:out", "to": "3:in1"},
+    {"from": "3:out", "to": "4:freq"},
+    {"from": "4:out", "to": "5:in"},
+    {"from": "5:out", "to": "6:in_l"}
+  ]
+})";
+std::vector<float> render(VM& vm, int num_blocks) {
+  std::vector<float> left(kFloatsPerDSPVector), right(kFloatsPerDSPVector), result;
+  float* outputs[] = { left.data(), right.data() };
+  for (int block = 0; block < num_blocks; ++block) {
+    vm.process(nullptr, outputs, kFloatsPerDSPVector);
+    result.insert(result.end(), left.begin(), left.end());
+    result.insert(result.end(), right.begin(), right.end());
+  }
+  return result;
+}
+} // namespace
+TEST_CASE("Fused expressions render exactly like the unfused nodes", "[vm]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  const PatchGraph graph = parse_json(kTreePatch);
+  CompileOptions unfused;
+  unfused.fuse_expressions = false;
+  VM fused_vm(registry, kSampleRate, true);
+  VM reference_vm(registry, kSampleRate, true);
+  const auto fused = Compiler::compile(graph, registry);
+  REQUIRE(std::count(fused.begin() + 4, fused.end(), static_cast<uint32_t>(OpCode::EXPR)) == 1);
+  fused_vm.load_program(fused);
+  reference_vm.load_program(Compiler::compile(graph, registry, {}, nullptr, unfused));
+  REQUIRE(render(fused_vm, 20) == render(reference_vm, 20));
+  // Nodes inside the tree keep their parameters.
+  REQUIRE(fused_vm.set_parameter(4, "in2", -0.5f, 2));
+  REQUIRE(reference_vm.set_parameter(4, "in2", -0.5f, 2));
+  REQUIRE(fused_vm.set_parameter(6, "gain", 2.0f));
+  REQUIRE(reference_vm.set_parameter(6, "gain", 2.0f));
+  REQUIRE(render(fused_vm, 20) == render(reference_vm, 20));
+}
+TEST_CASE("Superinstructions render exactly like separate instructions", "[vm]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  const PatchGraph graph = parse_json(kTreePatch);
+  CompileOptions separate;
+  separate.superinstructions = false;
+  VM paired_vm(registry, kSampleRate, true);
+  VM reference_vm(registry, kSampleRate, true);
+  // The sine and its gain on the right run as one PROC_MUL.
+  const auto paired = Compiler::compile(graph, registry);
+  REQUIRE(std::count(paired.begin() + 4, paired.end(), static_cast<uint32_t>(OpCode::PROC_MUL)) == 1);
+  paired_vm.load_program(paired);
+  reference_vm.load_program(Compiler::compile(graph, registry, {}, nullptr, separate));
+  REQUIRE(render(paired_vm, 20) == render(reference_vm, 20));
+  REQUIRE(paired_vm.set_parameter(7, "gain", 0.8f, 2));
+  REQUIRE(reference_vm.set_parameter(7, "gain", 0.8f, 2));
+  REQUIRE(render(paired_vm, 20) == render(reference_vm, 20));
+}
+TEST_CASE("A module and the tree it feeds render exactly like separate instructions", "[vm]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  const PatchGraph graph = parse_json(kModulatorPatch);
+  CompileOptions separate;
+  separate.superinstructions = false;
+  separate.arity_forms = false;
+  VM paired_vm(registry, kSampleRate, true);
+  VM reference_vm(registry, kSampleRate, true);
+  // The phasor runs with its tree as one PROC_EXPR, the sine with its gain
+  // as one PROC_MUL.
+  const auto paired = Compiler::compile(graph, registry);
+  REQUIRE(std::count(paired.begin() + 4, paired.end(), static_cast<uint32_t>(OpCode::PROC_EXPR)) == 1);
+  REQUIRE(std::count(paired.begin() + 4, paired.end(), static_cast<uint32_t>(OpCode::PROC_MUL)) == 1);
+  paired_vm.load_program(paired);
+  reference_vm.load_program(Compiler::compile(graph, registry, {}, nullptr, separate));
+  REQUIRE(render(paired_vm, 20) == render(reference_vm, 20));
+  // Nodes inside the tree keep their parameters.
+  REQUIRE(paired_vm.set_parameter(2, "in2", 400.0f, 2));
+  REQUIRE(reference_vm.set_parameter(2, "in2", 400.0f, 2));
+  REQUIRE(render(paired_vm, 20) == render(reference_vm, 20));
+}
+TEST_CASE("Fixed-arity PROC forms render exactly like counted PROCs", "[vm]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  const PatchGraph graph = parse_json(kModulatorPatch);
+  CompileOptions fixed;
+  fixed.superinstructions = false;
+  CompileOptions counted = fixed;
+  counted.arity_forms = false;
+  VM fixed_vm(registry, kSampleRate, true);
+  VM counted_vm(registry, kSampleRate, true);
+  const auto bytecode = Compiler::compile(graph, registry, {}, nullptr, fixed);
+  REQUIRE(std::count(bytecode.begin() + 4, bytecode.end(), static_cast<uint32_t>(OpCode::PROC_1x1)) == 2);
+  fixed_vm.load_program(bytecode);
+  counted_vm.load_program(Compiler::compile(graph, registry, {}, nullptr, counted));
+  REQUIRE(render(fixed_vm, 20) == render(counted_vm, 20));
+}
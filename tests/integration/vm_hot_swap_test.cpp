@@ -0,0 +1,147 @@
+#include "catch.hpp"
+#include "realtime_guard.h"
+#include "vm/vm.h"
+#include "compiler/compiler.h"
+#include "parser/parser.h"
+#include "compiler/module_registry.h"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef MODULE_DEFS_PATH
+#define MODULE_DEFS_PATH "data/modules.json"
+#endif
+using namespace madronavm;
+namespace {
+// A patch that writes `value` to both output channels every sample.
+std::vector<uint32_t> compile_constant_patch(float value, const ModuleRegistry& registry) {
+  std::string json_patch = R"({
+    "modules": [
+      {"id": 1, "name": "float", "data": {"in": )" + std::to_string(value) + R"(}},
+      {"id": 2, "name": "audio_out", "data": {}}
+    ],
+    "connections": [
+      {"from": "1:out", "to": "2:in_l"},
+      {"from": "1:out", "to": "2:in_r"}
+    ]
+  })";
+  return Compiler::compile(parse_json(json_patch), registry);
+}
+// oscillator -> gain -> stereo out, with node IDs 1, 2, 3.
+std::vector<uint32_t> compile_osc_patch(const char* osc, float gain, const ModuleRegistry& registry) {
+  std::string json_patch = std::string(R"({
+    "modules": [
+      {"id": 1, "name": ")") + osc + R"(", "data": {"freq": 220.0}},
+      {"id": 2, "name": "gain", "data": {"gain": )" + std::to_string(gain) + R"(}},
+      {"id": 3, "name": "audio_out", "data": {}}
+    ],
+    "connections": [
+      {"from": "1:out", "to": "2:in"},
+      {"from": "2:out", "to": "3:in_l"},
+      {"from": "2:out", "to": "3:in_r"}
+    ]
+  })";
+  return Compiler::compile(parse_json(json_patch), registry);
+}
+} // namespace
+TEST_CASE("VM switches programs at the next block boundary", "[vm]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  VM vm(registry, 48000.0f, true);
+  std::vector<float> out_l(kFloatsPerDSPVector), out_r(kFloatsPerDSPVector);
+  float* outputs[] = { out_l.data(), out_r.data() };
+  vm.load_program(compile_constant_patch(0.25f, registry));
+  vm.process(nullptr, outputs, kFloatsPerDSPVector);
+  REQUIRE(out_l[0] == 0.25f);
+  // Loading twice before the audio thread runs: only the latest program is
+  // ever adopted.
+  vm.load_program(compile_constant_patch(0.5f, registry));
+  vm.load_program(compile_constant_patch(0.75f, registry));
+  vm.process(nullptr, outputs, kFloatsPerDSPVector);
+  REQUIRE(out_l[0] == 0.75f);
+  REQUIRE(out_r[kFloatsPerDSPVector - 1] == 0.75f);
+  // The replaced program is reclaimed off the audio thread.
+  vm.collect_retired_programs();
+  vm.process(nullptr, outputs, kFloatsPerDSPVector);
+  REQUIRE(out_l[0] == 0.75f);
+}
+TEST_CASE("VM hot swaps programs while processing", "[vm][realtime]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  VM vm(registry, 48000.0f, true);
+  const std::vector<uint32_t> program_a = compile_constant_patch(0.25f, registry);
+  const std::vector<uint32_t> program_b = compile_constant_patch(0.75f, registry);
+  vm.load_program(program_a);
+  std::vector<float> out_l(kFloatsPerDSPVector), out_r(kFloatsPerDSPVector);
+  float* outputs[] = { out_l.data(), out_r.data() };
+  std::atomic<bool> loading_done{false};
+  std::thread loader([&] {
+    for (int i = 0; i < 200; ++i) {
+      vm.load_program((i % 2) ? program_a : program_b);
+      std::this_thread::yield();
+    }
+    loading_done.store(true);
+  });
+  int torn_blocks = 0;
+  int unexpected_blocks = 0;
+  size_t allocations = test::count_audio_thread_allocations([&] {
+    while (!loading_done.load()) {
+      vm.process(nullptr, outputs, kFloatsPerDSPVector);
+      // Every block must come entirely from one program.
+      for (int i = 1; i < kFloatsPerDSPVector; ++i) {
+        if (out_l[i] != out_l[0] || out_r[i] != out_l[0]) {
+          ++torn_blocks;
+          break;
+        }
+      }
+      if (out_l[0] != 0.25f && out_l[0] != 0.75f) {
+        ++unexpected_blocks;
+      }
+    }
+  });
+  loader.join();
+  REQUIRE(allocations == 0);
+  REQUIRE(torn_blocks == 0);
+  REQUIRE(unexpected_blocks == 0);
+  // The last load (i == 199) published program_a.
+  vm.process(nullptr, outputs, kFloatsPerDSPVector);
+  REQUIRE(out_l[0] == 0.25f);
+}
+TEST_CASE("VM carries module state across reloads by node id", "[vm]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  constexpr float sampleRate = 48000.0f;
+  std::vector<float> ref_l(kFloatsPerDSPVector), ref_r(kFloatsPerDSPVector);
+  std::vector<float> out_l(kFloatsPerDSPVector), out_r(kFloatsPerDSPVector);
+  float* ref_outputs[] = { ref_l.data(), ref_r.data() };
+  float* outputs[] = { out_l.data(), out_r.data() };
+  // The reference VM never reloads.
+  VM reference(registry, sampleRate, true);
+  reference.load_program(compile_osc_patch("sine_gen", 0.5f, registry));
+  VM vm(registry, sampleRate, true);
+  vm.load_program(compile_osc_patch("sine_gen", 0.5f, registry));
+  for (int block = 0; block < 10; ++block) {
+    reference.process(nullptr, ref_outputs, kFloatsPerDSPVector);
+    vm.process(nullptr, outputs, kFloatsPerDSPVector);
+  }
+  SECTION("An edited patch keeps the oscillator phase") {
+    // Same nodes, different gain: the oscillator continues where it was.
+    vm.load_program(compile_osc_patch("sine_gen", 0.25f, registry));
+    for (int block = 0; block < 4; ++block) {
+      reference.process(nullptr, ref_outputs, kFloatsPerDSPVector);
+      vm.process(nullptr, outputs, kFloatsPerDSPVector);
+      for (int i = 0; i < kFloatsPerDSPVector; ++i) {
+        REQUIRE(out_l[i] * 2.0f == ref_l[i]);
+      }
+    }
+  }
+  SECTION("A node whose module changed starts fresh") {
+    vm.load_program(compile_osc_patch("saw_gen", 0.5f, registry));
+    VM fresh(registry, sampleRate, true);
+    fresh.load_program(compile_osc_patch("saw_gen", 0.5f, registry));
+    for (int block = 0; block < 4; ++block) {
+      fresh.process(nullptr, ref_outputs, kFloatsPerDSPVector);
+      vm.process(nullptr, outputs, kFloatsPerDSPVector);
+      for (int i = 0; i < kFloatsPerDSPVector; ++i) {
+        REQUIRE(out_l[i] == ref_l[i]);
+      }
+    }
+  }
+}
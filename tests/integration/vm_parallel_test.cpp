@@ -0,0 +1,74 @@
+#include "catch.hpp"
+#include "realtime_guard.h"
+#include "vm/vm.h"
+#include "vm/worker_pool.h"
+#include "compiler/compiler.h"
+#include "parser/parser.h"
+#include "compiler/module_registry.h"
+#include <string>
+#include <vector>
+#ifndef MODULE_DEFS_PATH
+#define MODULE_DEFS_PATH "data/modules.json"
+#endif
+using namespace madronavm;
+namespace {
+// Eight oscillators, each through its own filter, summed pairwise into the
+// left channel: levels of width 8, 8, 4, 2 and 1.
+std::string wide_patch() {
+  std::string modules, connections;
+  const char* oscillators[] = {"sine_gen", "saw_gen", "pulse_gen", "phasor_gen"};
+  for (int i = 0; i < 8; ++i) {
+    const int osc = 1 + i, filter = 11 + i;
+    modules += R"({"id": )" + std::to_string(osc) + R"(, "name": ")" + oscillators[i % 4] +
+               R"(", "data": {"freq": )" + std::to_string(110 * (i + 1)) + "}},\n";
+    modules += R"({"id": )" + std::to_string(filter) +
+               R"(, "name": "lopass", "data": {"cutoff": 2000.0, "q": 0.7}},)" "\n";
+    connections += R"({"from": ")" + std::to_string(osc) + R"(:out", "to": ")" +
+                   std::to_string(filter) + R"(:in"},)" "\n";
+  }
+  // Mixer tree: 21..24 sum filters, 25..26 sum those, 27 sums the rest.
+  int inputs[] = {11, 12, 13, 14, 15, 16, 17, 18, 21, 22, 23, 24, 25, 26};
+  for (int i = 0; i < 7; ++i) {
+    const int mixer = 21 + i;
+    modules += R"({"id": )" + std::to_string(mixer) + R"(, "name": "add", "data": {}},)" "\n";
+    connections += R"({"from": ")" + std::to_string(inputs[2 * i]) + R"(:out", "to": ")" +
+                   std::to_string(mixer) + R"(:in1"},)" "\n";
+    connections += R"({"from": ")" + std::to_string(inputs[2 * i + 1]) + R"(:out", "to": ")" +
+                   std::to_string(mixer) + R"(:in2"},)" "\n";
+  }
+  modules += R"({"id": 30, "name": "audio_out", "data": {}})";
+  connections += R"({"from": "27:out", "to": "30:in_l"}, {"from": "27:out", "to": "30:in_r"})";
+  return "{\"modules\": [" + modules + "], \"connections\": [" + connections + "]}";
+}
+} // namespace
+TEST_CASE("VM parallel execution matches serial output", "[vm][realtime]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  const auto bytecode = Compiler::compile(parse_json(wide_patch()), registry);
+  VM serial(registry, 48000.0f, true);
+  VM parallel(registry, 48000.0f, true);
+  serial.load_program(bytecode);
+  parallel.load_program(bytecode);
+  WorkerPool pool(3, false);
+  SECTION("level by level") {
+    parallel.set_worker_pool(&pool, Schedule::kLevels);
+  }
+  SECTION("work-stealing task graph") {
+    parallel.set_worker_pool(&pool, Schedule::kTaskGraph);
+  }
+  std::vector<float> serial_l(256), serial_r(256), parallel_l(256), parallel_r(256);
+  float* serial_outputs[] = { serial_l.data(), serial_r.data() };
+  float* parallel_outputs[] = { parallel_l.data(), parallel_r.data() };
+  // Enough blocks for the task graph to re-profile its costs a few times.
+  for (int block = 0; block < 200; ++block) {
+    serial.process(nullptr, serial_outputs, 256);
+    parallel.process(nullptr, parallel_outputs, 256);
+    REQUIRE(parallel_l == serial_l);
+    REQUIRE(parallel_r == serial_r);
+  }
+  size_t count = test::count_audio_thread_allocations([&] {
+    for (int block = 0; block < 50; ++block) {
+      parallel.process(nullptr, parallel_outputs, 256);
+    }
+  });
+  REQUIRE(count == 0);
+}
@@ -0,0 +1,92 @@
+#include "catch.hpp"
+#include "realtime_guard.h"
+#include "vm/vm.h"
+#include "compiler/compiler.h"
+#include "parser/parser.h"
+#include "compiler/module_registry.h"
+#include <vector>
+#ifndef MODULE_DEFS_PATH
+#define MODULE_DEFS_PATH "data/modules.json"
+#endif
+using namespace madronavm;
+namespace {
+constexpr float kSampleRate = 48000.0f;
+// A constant 1 through a gain node, so the output is the gain itself.
+const char* kGainPatch = R"({
+  "modules": [
+    {"id": 1, "name": "float", "data": {"in": 1.0}},
+    {"id": 2, "name": "gain", "data": {"gain": 0.5}},
+    {"id": 3, "name": "audio_out", "data": {}}
+  ],
+  "connections": [
+    {"from": "1:out", "to": "2:in"},
+    {"from": "2:out", "to": "3:in_l"},
+    {"from": "2:out", "to": "3:in_r"}
+  ]
+})";
+struct Block {
+  std::vector<float> left = std::vector<float>(kFloatsPerDSPVector);
+  std::vector<float> right = std::vector<float>(kFloatsPerDSPVector);
+  float* outputs[2] = { left.data(), right.data() };
+};
+} // namespace
+TEST_CASE("VM applies parameter changes at the next block", "[vm]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  VM vm(registry, kSampleRate, true);
+  Block block;
+  REQUIRE_FALSE(vm.set_parameter(2, "gain", 1.0f));
+  vm.load_program(Compiler::compile(parse_json(kGainPatch), registry));
+  vm.process(nullptr, block.outputs, kFloatsPerDSPVector);
+  REQUIRE(block.left.back() == 0.5f);
+  SECTION("A jump takes effect on the next block") {
+    REQUIRE(vm.set_parameter(2, "gain", 2.0f));
+    vm.process(nullptr, block.outputs, kFloatsPerDSPVector);
+    REQUIRE(block.left.front() == 2.0f);
+    REQUIRE(block.right.back() == 2.0f);
+  }
+  SECTION("A ramp is linear and ends on the target") {
+    REQUIRE(vm.set_parameter(2, "gain", 2.5f, 2));
+    vm.process(nullptr, block.outputs, kFloatsPerDSPVector);
+    const float step = 2.0f / (2 * kFloatsPerDSPVector);
+    REQUIRE(block.left.front() == Approx(0.5f + step));
+    REQUIRE(block.left.back() == Approx(1.5f));
+    vm.process(nullptr, block.outputs, kFloatsPerDSPVector);
+    REQUIRE(block.left[0] == Approx(1.5f + step));
+    REQUIRE(block.left.back() == 2.5f);
+    vm.process(nullptr, block.outputs, kFloatsPerDSPVector);
+    REQUIRE(block.left.front() == 2.5f);
+    REQUIRE(block.left.back() == 2.5f);
+  }
+  SECTION("A jump cancels a ramp in progress") {
+    REQUIRE(vm.set_parameter(2, "gain", 2.5f, 4));
+    vm.process(nullptr, block.outputs, kFloatsPerDSPVector);
+    REQUIRE(vm.set_parameter(2, "gain", 0.25f));
+    vm.process(nullptr, block.outputs, kFloatsPerDSPVector);
+    vm.process(nullptr, block.outputs, kFloatsPerDSPVector);
+    REQUIRE(block.left.front() == 0.25f);
+    REQUIRE(block.left.back() == 0.25f);
+  }
+  SECTION("Unknown nodes and ports are rejected") {
+    REQUIRE_FALSE(vm.set_parameter(99, "gain", 1.0f));
+    REQUIRE_FALSE(vm.set_parameter(2, "freq", 1.0f));
+    // "in" is fed by a cable, not a constant: accepted, but ignored.
+    REQUIRE(vm.set_parameter(2, "in", 3.0f));
+    vm.process(nullptr, block.outputs, kFloatsPerDSPVector);
+    REQUIRE(block.left.back() == 0.5f);
+  }
+}
+TEST_CASE("VM parameter changes are allocation free", "[vm][realtime]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  VM vm(registry, kSampleRate, true);
+  vm.load_program(Compiler::compile(parse_json(kGainPatch), registry));
+  Block block;
+  vm.process(nullptr, block.outputs, kFloatsPerDSPVector);
+  REQUIRE(vm.set_parameter(2, "gain", 1.0f, 4));
+  size_t count = test::count_audio_thread_allocations([&] {
+    for (int i = 0; i < 8; ++i) {
+      vm.process(nullptr, block.outputs, kFloatsPerDSPVector);
+    }
+  });
+  REQUIRE(count == 0);
+  REQUIRE(block.left.back() == 1.0f);
+}
@@ -0,0 +1,254 @@
+#include "catch.hpp"
+#include "realtime_guard.h"
+#include "vm/partitioned_vm.h"
+#include "vm/vm.h"
+#include "vm/worker_pool.h"
+#include "compiler/compiler.h"
+#include "parser/parser.h"
+#include "compiler/module_registry.h"
+#include "MLEventsToSignals.h"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef MODULE_DEFS_PATH
+#define MODULE_DEFS_PATH "data/modules.json"
+#endif
+using namespace madronavm;
+namespace {
+// Three layers mixed into the left channel, one of them also sent right.
+const char* kLayeredPatch = R"({
+  "modules": [
+    {"id": 1, "name": "saw_gen", "data": {"freq": 110.0}},
+    {"id": 2, "name": "lopass", "data": {"cutoff": 800.0, "q": 0.7}},
+    {"id": 3, "name": "pulse_gen", "data": {"freq": 220.0}},
+    {"id": 4, "name": "hipass", "data": {"cutoff": 400.0, "q": 0.7}},
+    {"id": 5, "name": "sine_gen", "data": {"freq": 330.0}},
+    {"id": 6, "name": "gain", "data": {"gain": 0.5}},
+    {"id": 7, "name": "add", "data": {}},
+    {"id": 8, "name": "add", "data": {}},
+    {"id": 9, "name": "audio_out", "data": {}}
+  ],
+  "connections": [
+    {"from": "1:out", "to": "2:in"},
+    {"from": "3:out", "to": "4:in"},
+    {"from": "5:out", "to": "6:in"},
+    {"from": "2:out", "to": "7:in1"},
+    {"from": "4:out", "to": "7:in2"},
+    {"from": "7:out", "to": "8:in1"},
+    {"from": "6:out", "to": "8:in2"},
+    {"from": "8:out", "to": "9:in_l"},
+    {"from": "6:out", "to": "9:in_r"}
+  ]
+})";
+// A voice controller's gates on the left, a sine on the right: two
+// partitions.
+const char* kVoicesAndSinePatch = R"({
+  "modules": [
+    {"id": 1, "name": "voice_controller", "voices": 4, "data": {}},
+    {"id": 2, "name": "voice_mix", "data": {}},
+    {"id": 3, "name": "sine_gen", "data": {"freq": 440.0}},
+    {"id": 4, "name": "audio_out", "data": {}}
+  ],
+  "connections": [
+    {"from": "1:gate", "to": "2:in"},
+    {"from": "2:out", "to": "4:in_l"},
+    {"from": "3:out", "to": "4:in_r"}
+  ]
+})";
+std::vector<std::vector<uint32_t>> compile_partitions(const PatchGraph& graph,
+                                                      const ModuleRegistry& registry) {
+  std::vector<std::vector<uint32_t>> programs;
+  for (const auto& part : Compiler::partition(graph)) {
+    programs.push_back(Compiler::compile(part, registry));
+  }
+  return programs;
+}
+// Two constants summed into the left channel, one partition each.
+std::vector<std::vector<uint32_t>> compile_constant_partitions(float a, float b, const ModuleRegistry& registry) {
+  const std::string json_patch = R"({
+    "modules": [
+      {"id": 1, "name": "float", "data": {"in": )" + std::to_string(a) + R"(}},
+      {"id": 2, "name": "float", "data": {"in": )" + std::to_string(b) + R"(}},
+      {"id": 3, "name": "add", "data": {}},
+      {"id": 4, "name": "audio_out", "data": {}}
+    ],
+    "connections": [
+      {"from": "1:out", "to": "3:in1"},
+      {"from": "2:out", "to": "3:in2"},
+      {"from": "3:out", "to": "4:in_l"}
+    ]
+  })";
+  return compile_partitions(parse_json(json_patch), registry);
+}
+} // namespace
+TEST_CASE("Partitioned VM matches the unpartitioned patch", "[vm][realtime]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  const PatchGraph graph = parse_json(kLayeredPatch);
+  VM whole(registry, 48000.0f, true);
+  whole.load_program(Compiler::compile(graph, registry));
+  PartitionedVM partitioned(registry, 48000.0f, true);
+  partitioned.load_partitions(compile_partitions(graph, registry));
+  REQUIRE(partitioned.num_partitions() == 3);
+  WorkerPool pool(2, false);
+  SECTION("serially") {}
+  SECTION("on a worker pool") {
+    partitioned.set_worker_pool(&pool);
+  }
+  // Includes a buffer longer than one partition pass.
+  std::vector<float> whole_l(1000), whole_r(1000), part_l(1000), part_r(1000);
+  float* whole_outputs[] = { whole_l.data(), whole_r.data() };
+  float* part_outputs[] = { part_l.data(), part_r.data() };
+  for (int frames : {256, 37, 1000, 64}) {
+    whole.process(nullptr, whole_outputs, frames);
+    partitioned.process(nullptr, part_outputs, frames);
+    for (int i = 0; i < frames; ++i) {
+      REQUIRE(part_l[i] == Approx(whole_l[i]).margin(1e-6));
+      REQUIRE(part_r[i] == whole_r[i]);
+    }
+  }
+  size_t count = test::count_audio_thread_allocations([&] {
+    for (int block = 0; block < 20; ++block) {
+      partitioned.process(nullptr, part_outputs, 256);
+    }
+  });
+  REQUIRE(count == 0);
+}
+TEST_CASE("Partitioned VM plays a constant output once", "[vm]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  // Two partitions into the left channel, a constant on the right.
+  const PatchGraph graph = parse_json(R"({
+    "modules": [
+      {"id": 1, "name": "saw_gen", "data": {"freq": 110.0}},
+      {"id": 2, "name": "sine_gen", "data": {"freq": 330.0}},
+      {"id": 3, "name": "add", "data": {}},
+      {"id": 4, "name": "audio_out", "data": {"in_r": 0.25}}
+    ],
+    "connections": [
+      {"from": "1:out", "to": "3:in1"},
+      {"from": "2:out", "to": "3:in2"},
+      {"from": "3:out", "to": "4:in_l"}
+    ]
+  })");
+  VM whole(registry, 48000.0f, true);
+  whole.load_program(Compiler::compile(graph, registry));
+  PartitionedVM partitioned(registry, 48000.0f, true);
+  partitioned.load_partitions(compile_partitions(graph, registry));
+  REQUIRE(partitioned.num_partitions() == 2);
+  std::vector<float> whole_l(256), whole_r(256), part_l(256), part_r(256);
+  float* whole_outputs[] = { whole_l.data(), whole_r.data() };
+  float* part_outputs[] = { part_l.data(), part_r.data() };
+  for (int block = 0; block < 4; ++block) {
+    whole.process(nullptr, whole_outputs, 256);
+    partitioned.process(nullptr, part_outputs, 256);
+    for (int i = 0; i < 256; ++i) {
+      REQUIRE(part_l[i] == Approx(whole_l[i]).margin(1e-6));
+      REQUIRE(part_r[i] == 0.25f);
+    }
+  }
+}
+TEST_CASE("Partitioned VM switches every partition in the same block", "[vm][realtime]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  // Sums 0.75 and 1.75; a block mixing the two patches would sum 1.25.
+  const auto patch_a = compile_constant_partitions(0.25f, 0.5f, registry);
+  const auto patch_b = compile_constant_partitions(0.75f, 1.0f, registry);
+  REQUIRE(patch_a.size() == 2);
+  PartitionedVM partitioned(registry, 48000.0f, true);
+  partitioned.load_partitions(patch_a);
+  std::vector<float> out_l(kFloatsPerDSPVector), out_r(kFloatsPerDSPVector);
+  float* outputs[] = { out_l.data(), out_r.data() };
+  std::atomic<bool> loading_done{false};
+  std::thread loader([&] {
+    for (int i = 0; i < 200; ++i) {
+      partitioned.load_partitions((i % 2) ? patch_a : patch_b);
+      std::this_thread::yield();
+    }
+    loading_done.store(true);
+  });
+  int torn_blocks = 0;
+  int mixed_blocks = 0;
+  size_t allocations = test::count_audio_thread_allocations([&] {
+    while (!loading_done.load()) {
+      partitioned.process(nullptr, outputs, kFloatsPerDSPVector);
+      for (int i = 1; i < kFloatsPerDSPVector; ++i) {
+        if (out_l[i] != out_l[0]) {
+          ++torn_blocks;
+          break;
+        }
+      }
+      if (out_l[0] != 0.75f && out_l[0] != 1.75f) {
+        ++mixed_blocks;
+      }
+    }
+  });
+  loader.join();
+  REQUIRE(allocations == 0);
+  REQUIRE(torn_blocks == 0);
+  REQUIRE(mixed_blocks == 0);
+  // The last load (i == 199) published patch_a.
+  partitioned.process(nullptr, outputs, kFloatsPerDSPVector);
+  REQUIRE(out_l[0] == 0.75f);
+}
+TEST_CASE("Partitioned VM carries module state across reloads", "[vm]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  const auto programs = compile_partitions(parse_json(kLayeredPatch), registry);
+  // The reference never reloads.
+  PartitionedVM reference(registry, 48000.0f, true);
+  reference.load_partitions(programs);
+  PartitionedVM partitioned(registry, 48000.0f, true);
+  partitioned.load_partitions(programs);
+  std::vector<float> ref_l(256), ref_r(256), out_l(256), out_r(256);
+  float* ref_outputs[] = { ref_l.data(), ref_r.data() };
+  float* outputs[] = { out_l.data(), out_r.data() };
+  for (int block = 0; block < 4; ++block) {
+    reference.process(nullptr, ref_outputs, 256);
+    partitioned.process(nullptr, outputs, 256);
+  }
+  // The oscillators and filters carry on where they were.
+  partitioned.load_partitions(programs);
+  for (int block = 0; block < 4; ++block) {
+    reference.process(nullptr, ref_outputs, 256);
+    partitioned.process(nullptr, outputs, 256);
+    REQUIRE(out_l == ref_l);
+    REQUIRE(out_r == ref_r);
+  }
+}
+TEST_CASE("Partitioned VM routes events and parameters to the owning partition", "[vm]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  PartitionedVM partitioned(registry, 48000.0f, true);
+  std::vector<float> out_l(kFloatsPerDSPVector), out_r(kFloatsPerDSPVector);
+  float* outputs[] = { out_l.data(), out_r.data() };
+  SECTION("events") {
+    partitioned.load_partitions(compile_partitions(parse_json(kVoicesAndSinePatch), registry));
+    REQUIRE(partitioned.num_partitions() == 2);
+    partitioned.process(nullptr, outputs, kFloatsPerDSPVector);
+    REQUIRE(out_l.back() == 0.0f);
+    ml::Event note_on;
+    note_on.type = ml::kNoteOn;
+    note_on.value1 = 60.0f;
+    note_on.value2 = 1.0f;
+    REQUIRE(partitioned.post_event(1, note_on));
+    REQUIRE_FALSE(partitioned.post_event(99, note_on));
+    partitioned.process(nullptr, outputs, kFloatsPerDSPVector);
+    REQUIRE(out_l.back() == 1.0f);
+  }
+  SECTION("parameters") {
+    const PatchGraph graph = parse_json(kLayeredPatch);
+    VM whole(registry, 48000.0f, true);
+    whole.load_program(Compiler::compile(graph, registry));
+    partitioned.load_partitions(compile_partitions(graph, registry));
+    std::vector<float> whole_l(kFloatsPerDSPVector), whole_r(kFloatsPerDSPVector);
+    float* whole_outputs[] = { whole_l.data(), whole_r.data() };
+    // The gain sits in the third partition.
+    REQUIRE(whole.set_parameter(6, "gain", 0.25f));
+    REQUIRE(partitioned.set_parameter(6, "gain", 0.25f));
+    REQUIRE_FALSE(partitioned.set_parameter(99, "gain", 0.25f));
+    for (int block = 0; block < 4; ++block) {
+      whole.process(nullptr, whole_outputs, kFloatsPerDSPVector);
+      partitioned.process(nullptr, outputs, kFloatsPerDSPVector);
+      for (int i = 0; i < kFloatsPerDSPVector; ++i) {
+        REQUIRE(out_r[i] == whole_r[i]);
+      }
+    }
+  }
+}
@@ -0,0 +1,142 @@
+#include "catch.hpp"
+#include "realtime_guard.h"
+#include "vm/vm.h"
+#include "compiler/compiler.h"
+#include "parser/patch_graph.h"
+#include "compiler/module_registry.h"
+#include "MLEventsToSignals.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#ifndef MODULE_DEFS_PATH
+#define MODULE_DEFS_PATH "data/modules.json"
+#endif
+using namespace madronavm;
+namespace {
+constexpr float kSampleRate = 48000.0f;
+constexpr int kVoices = 16;
+constexpr int kBlocks = 200;
+float voice_freq(int v) { return 55.0f * (v + 1); }
+float voice_gate(int v) { return v % 4 == 3 ? 0.0f : 1.0f; }
+std::vector<ConstantInput> envelope_constants(std::vector<float> gates) {
+  const float gate = gates.empty() ? 0.0f : gates[0];
+  return {{"gate", gate, gates}, {"attack", 0.01f, {}}, {"decay", 0.1f, {}},
+          {"sustain", 0.5f, {}}, {"release", 0.2f, {}}};
+}
+// saw -> lopass -> gain, with an ADSR on the gain, for 16 voices on
+// polyphonic cables, folded into the left channel by voice_mix.
+PatchGraph poly_patch() {
+  std::vector<float> freqs, gates;
+  for (int v = 0; v < kVoices; ++v) {
+    freqs.push_back(voice_freq(v));
+    gates.push_back(voice_gate(v));
+  }
+  PatchGraph graph;
+  graph.nodes = {
+    {1, "saw_gen", {{"freq", freqs[0], freqs}}},
+    {2, "lopass", {{"cutoff", 2000.0f, {}}, {"q", 0.7f, {}}}},
+    {3, "adsr", envelope_constants(gates)},
+    {4, "gain", {}},
+    {5, "voice_mix", {}},
+    {6, "audio_out", {}},
+  };
+  graph.connections = {
+    {1, "out", 2, "in"}, {2, "out", 4, "in"}, {3, "out", 4, "gain"},
+    {4, "out", 5, "in"}, {5, "out", 6, "in_l"},
+  };
+  return graph;
+}
+// The same voices as 16 mono copies of the chain, summed by a chain of adds.
+PatchGraph mono_patch() {
+  PatchGraph graph;
+  uint32_t mix = 0;
+  for (int v = 0; v < kVoices; ++v) {
+    const uint32_t base = 10 * (v + 1);
+    graph.nodes.push_back({base + 1, "saw_gen", {{"freq", voice_freq(v), {}}}});
+    graph.nodes.push_back({base + 2, "lopass", {{"cutoff", 2000.0f, {}}, {"q", 0.7f, {}}}});
+    graph.nodes.push_back({base + 3, "adsr", envelope_constants({})});
+    graph.nodes.back().constants[0].value = voice_gate(v);
+    graph.nodes.push_back({base + 4, "gain", {}});
+    graph.connections.push_back({base + 1, "out", base + 2, "in"});
+    graph.connections.push_back({base + 2, "out", base + 4, "in"});
+    graph.connections.push_back({base + 3, "out", base + 4, "gain"});
+    if (v == 0) {
+      mix = base + 4;
+    } else {
+      const uint32_t add = 1000 + v;
+      graph.nodes.push_back({add, "add", {}});
+      graph.connections.push_back({mix, "out", add, "in1"});
+      graph.connections.push_back({base + 4, "out", add, "in2"});
+      mix = add;
+    }
+  }
+  graph.nodes.push_back({2000, "audio_out", {}});
+  graph.connections.push_back({mix, "out", 2000, "in_l"});
+  return graph;
+}
+std::vector<float> render(VM& vm) {
+  std::vector<float> result;
+  std::vector<float> left(kFloatsPerDSPVector), right(kFloatsPerDSPVector);
+  float* outputs[] = { left.data(), right.data() };
+  for (int block = 0; block < kBlocks; ++block) {
+    vm.process(nullptr, outputs, kFloatsPerDSPVector);
+    result.insert(result.end(), left.begin(), left.end());
+  }
+  return result;
+}
+} // namespace
+TEST_CASE("Polyphonic cables match mono copies of the voice", "[vm]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  VM poly(registry, kSampleRate, true);
+  poly.load_program(Compiler::compile(poly_patch(), registry));
+  VM mono(registry, kSampleRate, true);
+  mono.load_program(Compiler::compile(mono_patch(), registry));
+  const std::vector<float> expected = render(mono);
+  REQUIRE(render(poly) == expected);
+  float peak = 0.0f;
+  for (float sample : expected) {
+    peak = std::max(peak, std::abs(sample));
+  }
+  REQUIRE(peak > 0.0f);
+}
+TEST_CASE("Polyphonic processing is allocation free", "[vm][realtime]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  VM vm(registry, kSampleRate, true);
+  vm.load_program(Compiler::compile(poly_patch(), registry));
+  std::vector<float> out_l(512), out_r(512);
+  float* outputs[] = { out_l.data(), out_r.data() };
+  size_t count = test::count_audio_thread_allocations([&] {
+    for (int i = 0; i < 10; ++i) {
+      vm.process(nullptr, outputs, 512);
+    }
+  });
+  REQUIRE(count == 0);
+}
+TEST_CASE("Poly modules fed by a voice_controller run only its busy voices", "[vm]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  // Eight voices, each a saw at its note's pitch in Hz.
+  PatchGraph graph;
+  graph.nodes = {{1, "voice_controller", {}, 8}, {2, "saw_gen", {}}, {3, "voice_mix", {}}, {4, "audio_out", {}}};
+  graph.connections = {{1, "pitch", 2, "freq"}, {2, "out", 3, "in"}, {3, "out", 4, "in_l"}};
+  VM poly(registry, kSampleRate, true);
+  poly.load_program(Compiler::compile(graph, registry));
+  PatchGraph reference;
+  reference.nodes = {{1, "saw_gen", {{"freq", 60.0f, {}}}}, {2, "audio_out", {}}};
+  reference.connections = {{1, "out", 2, "in_l"}};
+  VM mono(registry, kSampleRate, true);
+  mono.load_program(Compiler::compile(reference, registry));
+  ml::Event on;
+  on.type = ml::kNoteOn;
+  on.value1 = 60.0f;
+  on.value2 = 1.0f;
+  REQUIRE(poly.post_event(1, on));
+  // The seven idle saws, left at pitch 0, would add a constant each.
+  REQUIRE(render(poly) == render(mono));
+  ml::Event off = on;
+  off.type = ml::kNoteOff;
+  REQUIRE(poly.post_event(1, off));
+  std::vector<float> left(kFloatsPerDSPVector, 1.0f), right(kFloatsPerDSPVector);
+  float* outputs[] = { left.data(), right.data() };
+  poly.process(nullptr, outputs, kFloatsPerDSPVector);
+  REQUIRE(std::all_of(left.begin(), left.end(), [](float sample) { return sample == 0.0f; }));
+}
@@ -0,0 +1,108 @@
+#include "catch.hpp"
+#include "realtime_guard.h"
+#include "vm/vm.h"
+#include "compiler/compiler.h"
+#include "parser/parser.h"
+#include "compiler/module_registry.h"
+#include "dsp/audio_out.h"
+#include "MLEventsToSignals.h"
+#include <fstream>
+#include <string>
+#include <vector>
+#ifndef TEST_DATA_DIR
+#define TEST_DATA_DIR "examples"
+#endif
+#ifndef MODULE_DEFS_PATH
+#define MODULE_DEFS_PATH "data/modules.json"
+#endif
+using namespace madronavm;
+namespace {
+std::string load_patch(const std::string& name) {
+  std::string path(TEST_DATA_DIR);
+  path += "/" + name;
+  std::ifstream t(path);
+  if (!t.is_open()) {
+    throw std::runtime_error("Could not open test patch file: " + path);
+  }
+  return std::string((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
+}
+} // namespace
+TEST_CASE("Allocation guard detects audio thread allocations", "[realtime]") {
+  size_t count = test::count_audio_thread_allocations([] {
+    std::vector<float> scratch(64);
+    scratch[0] = 1.0f;
+  });
+  REQUIRE(count > 0);
+}
+TEST_CASE("VM block processing is allocation free", "[vm][realtime]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  constexpr float sampleRate = 48000.0f;
+  std::vector<float> out_l(kFloatsPerDSPVector), out_r(kFloatsPerDSPVector);
+  float* outputs[] = { out_l.data(), out_r.data() };
+  SECTION("subtractive_synth.json") {
+    VM vm(registry, sampleRate, true);
+    vm.load_program(Compiler::compile(parse_json(load_patch("subtractive_synth.json")), registry));
+    // Modules are constructed by load_program, so even the first block
+    // after a load must not allocate.
+    size_t count = test::count_audio_thread_allocations([&] {
+      for (int block = 0; block < 100; ++block) {
+        vm.process(nullptr, outputs, kFloatsPerDSPVector);
+      }
+    });
+    REQUIRE(count == 0);
+  }
+  SECTION("Every registered module, mono and poly") {
+    for (const std::string& name : registry.get_names()) {
+      if (name == "audio_out") {
+        continue;
+      }
+      const ModuleInfo& info = registry.get_info(name);
+      std::vector<uint32_t> voice_counts{1};
+      if (info.poly) {
+        voice_counts.push_back(4);
+      }
+      for (uint32_t voices : voice_counts) {
+        INFO(name << " with " << voices << " voice(s)");
+        // A saw on every input, so nothing is folded away, and the first
+        // output mixed down to the left channel.
+        PatchGraph graph;
+        graph.nodes = {
+          {1, "saw_gen", {{"freq", 110.0f, {}}}, voices},
+          {2, name, {}, voices},
+          {3, "voice_mix", {}},
+          {4, "audio_out", {}},
+        };
+        for (const auto& port : info.inputs) {
+          graph.connections.push_back({1, "out", 2, port});
+        }
+        graph.connections.push_back({2, info.outputs[0], 3, "in"});
+        graph.connections.push_back({3, "out", 4, "in_l"});
+        VM vm(registry, sampleRate, true);
+        vm.load_program(Compiler::compile(graph, registry));
+        ml::Event note_on;
+        note_on.type = ml::kNoteOn;
+        note_on.value1 = 60.0f;
+        note_on.value2 = 1.0f;
+        vm.post_event(2, note_on);
+        size_t count = test::count_audio_thread_allocations([&] {
+          for (int block = 0; block < 100; ++block) {
+            vm.process(nullptr, outputs, kFloatsPerDSPVector);
+          }
+        });
+        REQUIRE(count == 0);
+      }
+    }
+  }
+}
+TEST_CASE("AudioOut test-mode process is allocation free", "[dsp][realtime]") {
+  AudioOut audio_out(48000.0f, true);
+  std::vector<float> in_l(kFloatsPerDSPVector, 0.5f), in_r(kFloatsPerDSPVector, -0.5f);
+  std::vector<float> out_l(kFloatsPerDSPVector), out_r(kFloatsPerDSPVector);
+  const float* inputs[] = { in_l.data(), in_r.data() };
+  float* outputs[] = { out_l.data(), out_r.data() };
+  size_t count = test::count_audio_thread_allocations([&] {
+    audio_out.process(inputs, 2, outputs, 2);
+  });
+  REQUIRE(count == 0);
+  REQUIRE(out_r[0] == -0.5f);
+}
@@ -1,6 +1,7 @@
 // Basic unit test for VM
 #include "catch.hpp"
 #include "vm/vm.h"
+#include "vm/program.h"
 #include "vm/opcodes.h"
 #include "compiler/module_registry.h"
 #include <cstring>
@@ -68,21 +69,86 @@ TEST_CASE("VM LOAD_K Instruction", "[vm]") {
   vm.process(&inputs, &outputs, 64);
   REQUIRE(true); // If we get here, no crash occurred
 }
+TEST_CASE("LOAD_K constants are materialised at program load", "[vm]") {
+  // LOAD_K 0, 0.5f; LOAD_K 1, 2.0f; PROC 1, 1027 (gain), 0, 2, 1, 0, 1, 2; END
+  auto bytecode = create_bytecode_header(20, 3);
+  bytecode.insert(bytecode.end(), {static_cast<uint32_t>(OpCode::LOAD_K), 0, float_to_uint32(0.5f)});
+  bytecode.insert(bytecode.end(), {static_cast<uint32_t>(OpCode::LOAD_K), 1, float_to_uint32(2.0f)});
+  bytecode.insert(bytecode.end(), {static_cast<uint32_t>(OpCode::PROC), 1, 1027, 0, 2, 1, 0, 1, 2});
+  bytecode.push_back(static_cast<uint32_t>(OpCode::END));
+  SECTION("Constant registers are filled before the first block") {
+    Program program(bytecode, 44100.0f);
+    REQUIRE(program.num_constants() == 2);
+    REQUIRE(program.get_register(0)[0] == 0.5f);
+    REQUIRE(program.get_register(1)[kFloatsPerDSPVector - 1] == 2.0f);
+    program.run(nullptr);
+    REQUIRE(program.get_register(2)[0] == 1.0f);
+    // A parameter change rewrites the register once, not every block.
+    REQUIRE(program.set_constant(1, 4.0f));
+    program.run(nullptr);
+    REQUIRE(program.get_register(2)[0] == 2.0f);
+    REQUIRE_FALSE(program.set_constant(2, 1.0f));
+  }
+  SECTION("A register also written by a module keeps its per-block LOAD_K") {
+    bytecode[18] = 1; // gain now writes register 1
+    Program program(bytecode, 44100.0f);
+    REQUIRE(program.num_constants() == 1);
+    program.run(nullptr);
+    REQUIRE(program.get_register(1)[0] == 1.0f);
+    program.run(nullptr);
+    REQUIRE(program.get_register(1)[0] == 1.0f);
+  }
+}
+TEST_CASE("Program places registers and modules in one aligned arena", "[vm]") {
+  // LOAD_K 0, 0.5f; LOAD_K 1, 2.0f; PROC 1, 1027 (gain), 0, 2, 1, 0, 1, 2; END
+  auto bytecode = create_bytecode_header(20, 3);
+  bytecode.insert(bytecode.end(), {static_cast<uint32_t>(OpCode::LOAD_K), 0, float_to_uint32(0.5f)});
+  bytecode.insert(bytecode.end(), {static_cast<uint32_t>(OpCode::LOAD_K), 1, float_to_uint32(2.0f)});
+  bytecode.insert(bytecode.end(), {static_cast<uint32_t>(OpCode::PROC), 1, 1027, 0, 2, 1, 0, 1, 2});
+  bytecode.push_back(static_cast<uint32_t>(OpCode::END));
+  MemoryOptions memory;
+  SECTION("default pages") {}
+  SECTION("huge pages, locked") {
+    memory.huge_pages = true;
+    memory.lock = true;
+  }
+  Program program(bytecode, 44100.0f, nullptr, memory);
+  const auto* begin = static_cast<const char*>(program.arena().data());
+  const auto* end = begin + program.arena().size();
+  auto in_arena = [&](const void* p) {
+    return static_cast<const char*>(p) >= begin && static_cast<const char*>(p) < end;
+  };
+  for (size_t reg = 0; reg < program.num_registers(); ++reg) {
+    const void* buffer = program.get_register(reg).getConstBuffer();
+    REQUIRE(in_arena(buffer));
+    REQUIRE(reinterpret_cast<uintptr_t>(buffer) % MemoryArena::kCacheLineSize == 0);
+  }
+  const void* module = program.module_for_node(1);
+  REQUIRE(in_arena(module));
+  REQUIRE(reinterpret_cast<uintptr_t>(module) % MemoryArena::kCacheLineSize == 0);
+  if (program.arena().huge_pages()) {
+    REQUIRE(program.arena().size() % MemoryArena::kHugePageSize == 0);
+  }
+  program.run(nullptr);
+  REQUIRE(program.get_register(2)[0] == 1.0f);
+}
 TEST_CASE("VM PROC Instruction - Sine Oscillator", "[vm]") {
   ModuleRegistry registry(MODULE_DEFS_PATH);
   VM vm(registry, 44100.0f, true); // testMode = true
   // Create bytecode that sets up a sine oscillator:
   // LOAD_K 0, 440.0f    (load frequency into register 0)
-  // PROC 256, 1, 1, 0, 1 (sine_gen: 1 input from reg 0, 1 output to reg 1)
+  // PROC 1, 256, 0, 1, 1, 0, 1 (sine_gen: 1 input from reg 0, 1 output to reg 1)
   // END
-  auto bytecode = create_bytecode_header(11, 2); // 4 header + 7 instruction words
+  auto bytecode = create_bytecode_header(13, 2); // 4 header + 9 instruction words
   // LOAD_K 0, 440.0f
   bytecode.push_back(static_cast<uint32_t>(OpCode::LOAD_K));
   bytecode.push_back(0); // dest_reg = 0
   bytecode.push_back(float_to_uint32(440.0f)); // value = 440.0f
-  // PROC 256, 1, 1, 0, 1 (sine_gen module)
+  // PROC 1, 256, 0, 1, 1, 0, 1 (sine_gen module)
   bytecode.push_back(static_cast<uint32_t>(OpCode::PROC));
+  bytecode.push_back(1);   // node_id = 1
   bytecode.push_back(256); // module_id = sine_gen
+  bytecode.push_back(0);   // slot = 0
   bytecode.push_back(1);   // num_inputs = 1
   bytecode.push_back(1);   // num_outputs = 1
   bytecode.push_back(0);   // input from register 0
@@ -102,9 +168,9 @@ TEST_CASE("VM PROC Instruction - Gain Module", "[vm]") {
   // Create bytecode that sets up signal processing chain:
   // LOAD_K 0, 1.0f      (load signal into register 0)
   // LOAD_K 1, 0.5f      (load gain into register 1)  
-  // PROC 1025, 2, 1, 0, 1, 2 (gain: 2 inputs from reg 0,1, 1 output to reg 2)
+  // PROC 2, 1027, 0, 2, 1, 0, 1, 2 (gain: 2 inputs from reg 0,1, 1 output to reg 2)
   // END
-  auto bytecode = create_bytecode_header(14, 3); // 4 header + 10 instruction words
+  auto bytecode = create_bytecode_header(16, 3); // 4 header + 12 instruction words
   // LOAD_K 0, 1.0f (signal)
   bytecode.push_back(static_cast<uint32_t>(OpCode::LOAD_K));
   bytecode.push_back(0);
@@ -113,9 +179,11 @@ TEST_CASE("VM PROC Instruction - Gain Module", "[vm]") {
   bytecode.push_back(static_cast<uint32_t>(OpCode::LOAD_K));
   bytecode.push_back(1);
   bytecode.push_back(float_to_uint32(0.5f));
-  // PROC 1025, 2, 1, 0, 1, 2 (gain module)
+  // PROC 2, 1027, 0, 2, 1, 0, 1, 2 (gain module)
   bytecode.push_back(static_cast<uint32_t>(OpCode::PROC));
-  bytecode.push_back(1025); // module_id = gain
+  bytecode.push_back(2);    // node_id = 2
+  bytecode.push_back(1027); // module_id = gain
+  bytecode.push_back(0);    // slot = 0
   bytecode.push_back(2);    // num_inputs = 2
   bytecode.push_back(1);    // num_outputs = 1
   bytecode.push_back(0);    // input from register 0 (signal)
@@ -134,14 +202,16 @@ TEST_CASE("VM Unknown Module ID", "[vm]") {
   ModuleRegistry registry(MODULE_DEFS_PATH);
   VM vm(registry, 44100.0f, true); // testMode = true
   // Create bytecode with unknown module ID
-  auto bytecode = create_bytecode_header(9, 2);
+  auto bytecode = create_bytecode_header(11, 2);
   // LOAD_K 0, 1.0f
   bytecode.push_back(static_cast<uint32_t>(OpCode::LOAD_K));
   bytecode.push_back(0);
   bytecode.push_back(float_to_uint32(1.0f));
   // PROC with unknown module ID 9999
   bytecode.push_back(static_cast<uint32_t>(OpCode::PROC));
+  bytecode.push_back(1);    // node_id = 1
   bytecode.push_back(9999); // Unknown module_id
+  bytecode.push_back(0);    // slot = 0
   bytecode.push_back(1);    // num_inputs = 1
   bytecode.push_back(1);    // num_outputs = 1
   bytecode.push_back(0);    // input from register 0
@@ -178,18 +248,20 @@ TEST_CASE("VM Complex Signal Chain - Sine -> Gain", "[vm]") {
   VM vm(registry, 44100.0f, true); // testMode = true
   // Create bytecode that chains sine oscillator -> gain:
   // LOAD_K 0, 440.0f       (load frequency into register 0)
-  // PROC 256, 1, 1, 0, 1   (sine_gen: freq from reg 0, output to reg 1)
+  // PROC 1, 256, 0, 1, 1, 0, 1   (sine_gen: freq from reg 0, output to reg 1)
   // LOAD_K 2, 0.5f         (load gain value into register 2)
-  // PROC 1025, 2, 1, 1, 2, 3 (gain: signal from reg 1, gain from reg 2, output to reg 3)
+  // PROC 2, 1027, 1, 2, 1, 1, 2, 3 (gain: signal from reg 1, gain from reg 2, output to reg 3)
   // END
-  auto bytecode = create_bytecode_header(17, 4); // 4 header + 13 instruction words
+  auto bytecode = create_bytecode_header(21, 4); // 4 header + 17 instruction words
   // LOAD_K 0, 440.0f (frequency)
   bytecode.push_back(static_cast<uint32_t>(OpCode::LOAD_K));
   bytecode.push_back(0);
   bytecode.push_back(float_to_uint32(440.0f));
-  // PROC 256, 1, 1, 0, 1 (sine_gen)
+  // PROC 1, 256, 0, 1, 1, 0, 1 (sine_gen)
   bytecode.push_back(static_cast<uint32_t>(OpCode::PROC));
+  bytecode.push_back(1);   // node_id = 1
   bytecode.push_back(256); // module_id = sine_gen
+  bytecode.push_back(0);   // slot = 0
   bytecode.push_back(1);   // num_inputs = 1
   bytecode.push_back(1);   // num_outputs = 1
   bytecode.push_back(0);   // input from register 0 (frequency)
@@ -198,9 +270,11 @@ TEST_CASE("VM Complex Signal Chain - Sine -> Gain", "[vm]") {
   bytecode.push_back(static_cast<uint32_t>(OpCode::LOAD_K));
   bytecode.push_back(2);
   bytecode.push_back(float_to_uint32(0.5f));
-  // PROC 1025, 2, 1, 1, 2, 3 (gain)
+  // PROC 2, 1027, 1, 2, 1, 1, 2, 3 (gain)
   bytecode.push_back(static_cast<uint32_t>(OpCode::PROC));
-  bytecode.push_back(1025); // module_id = gain
+  bytecode.push_back(2);    // node_id = 2
+  bytecode.push_back(1027); // module_id = gain
+  bytecode.push_back(1);    // slot = 1
   bytecode.push_back(2);    // num_inputs = 2
   bytecode.push_back(1);    // num_outputs = 1
   bytecode.push_back(1);    // input from register 1 (sine wave)
@@ -217,3 +291,66 @@ TEST_CASE("VM Complex Signal Chain - Sine -> Gain", "[vm]") {
   }
   REQUIRE(true); // If we get here, the signal chain processed successfully
 }
+TEST_CASE("VM rejects out-of-range registers at load time", "[vm]") {
+  ModuleRegistry registry(MODULE_DEFS_PATH);
+  VM vm(registry, 44100.0f, true); // testMode = true
+  // LOAD_K into register 0, then AUDIO_OUT from register 5 of a 1-register program.
+  auto bytecode = create_bytecode_header(11, 1);
+  bytecode.push_back(static_cast<uint32_t>(OpCode::LOAD_K));
+  bytecode.push_back(0);
+  bytecode.push_back(float_to_uint32(1.0f));
+  bytecode.push_back(static_cast<uint32_t>(OpCode::AUDIO_OUT));
+  bytecode.push_back(2);
+  bytecode.push_back(0);
+  bytecode.push_back(5); // out of range
+  bytecode.push_back(static_cast<uint32_t>(OpCode::END));
+  vm.load_program(std::move(bytecode));
+  // The program is discarded during decoding, so the VM outputs silence.
+  std::vector<float> out_l(64, 1.0f), out_r(64, 1.0f);
+  float* outputs[] = { out_l.data(), out_r.data() };
+  vm.process(nullptr, outputs, 64);
+  REQUIRE(out_l[0] == 0.0f);
+  REQUIRE(out_r[63] == 0.0f);
+}
+TEST_CASE("Native arithmetic opcodes match the modules they replace", "[vm]") {
+  struct Case {
+    OpCode opcode;
+    uint32_t module_id;
+    uint32_t num_inputs;
+  };
+  const Case cases[] = {
+    {OpCode::ADD, 1024, 2}, {OpCode::MUL, 1025, 2}, {OpCode::MUL, 1027, 2},
+    {OpCode::CMP_GT, 1280, 2}, {OpCode::SPLAT, 1028, 1}, {OpCode::SPLAT_INT, 1029, 1},
+  };
+  for (const Case& c : cases) {
+    INFO("module " << c.module_id);
+    // A saw into register 1 and 0.25 in register 2 feed the opcode (node
+    // 2, into register 3) and a PROC of the same module (node 3, into 4).
+    auto bytecode = create_bytecode_header(0, 5);
+    bytecode.insert(bytecode.end(), {static_cast<uint32_t>(OpCode::LOAD_K), 0, float_to_uint32(440.0f)});
+    bytecode.insert(bytecode.end(), {static_cast<uint32_t>(OpCode::PROC), 1, 257, 0, 1, 1, 0, 1});
+    bytecode.insert(bytecode.end(), {static_cast<uint32_t>(OpCode::LOAD_K), 2, float_to_uint32(0.25f)});
+    bytecode.insert(bytecode.end(), {static_cast<uint32_t>(c.opcode), 2, c.module_id, 1});
+    if (c.num_inputs == 2) bytecode.push_back(2);
+    bytecode.push_back(3);
+    bytecode.insert(bytecode.end(), {static_cast<uint32_t>(OpCode::PROC), 3, c.module_id, 1, c.num_inputs, 1, 1});
+    if (c.num_inputs == 2) bytecode.push_back(2);
+    bytecode.push_back(4);
+    bytecode.push_back(static_cast<uint32_t>(OpCode::END));
+    bytecode[2] = static_cast<uint32_t>(bytecode.size());
+    Program program(bytecode, 44100.0f);
+    REQUIRE_FALSE(program.empty());
+    REQUIRE(program.module_for_node(2) == nullptr);
+    REQUIRE(program.module_id_for_node(2) == c.module_id);
+    for (int block = 0; block < 4; ++block) {
+      if (block == 2 && c.num_inputs == 2) {
+        // The second input is still a parameter of the node.
+        REQUIRE(program.set_parameter(2, 1, -0.5f));
+      }
+      program.run(nullptr);
+      for (int i = 0; i < kFloatsPerDSPVector; ++i) {
+        REQUIRE(program.get_register(3)[i] == program.get_register(4)[i]);
+      }
+    }
+  }
+}
@@ -0,0 +1,68 @@
+#include "realtime_guard.h"
+#include <cstdlib>
+#include <new>
+#include <thread>
+namespace {
+thread_local bool t_armed = false;
+thread_local size_t t_allocations = 0;
+inline void note_allocation() {
+  if (t_armed) {
+    ++t_allocations;
+  }
+}
+void* checked_malloc(std::size_t size) {
+  note_allocation();
+  if (void* p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void* checked_aligned_alloc(std::size_t size, std::align_val_t align) {
+  note_allocation();
+  void* p = nullptr;
+  if (posix_memalign(&p, static_cast<std::size_t>(align), size ? size : 1) == 0) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void checked_free(void* p) {
+  if (p) {
+    note_allocation();
+    std::free(p);
+  }
+}
+} // namespace
+void* operator new(std::size_t size) { return checked_malloc(size); }
+void* operator new[](std::size_t size) { return checked_malloc(size); }
+void* operator new(std::size_t size, std::align_val_t align) { return checked_aligned_alloc(size, align); }
+void* operator new[](std::size_t size, std::align_val_t align) { return checked_aligned_alloc(size, align); }
+void operator delete(void* p) noexcept { checked_free(p); }
+void operator delete[](void* p) noexcept { checked_free(p); }
+void operator delete(void* p, std::size_t) noexcept { checked_free(p); }
+void operator delete[](void* p, std::size_t) noexcept { checked_free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { checked_free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { checked_free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { checked_free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { checked_free(p); }
+namespace madronavm::test {
+RealtimeAllocationGuard::RealtimeAllocationGuard() {
+  t_allocations = 0;
+  t_armed = true;
+}
+RealtimeAllocationGuard::~RealtimeAllocationGuard() {
+  t_armed = false;
+}
+size_t RealtimeAllocationGuard::allocations() const {
+  return t_allocations;
+}
+size_t count_audio_thread_allocations(const std::function<void()>& fn) {
+  size_t count = 0;
+  std::thread audio_thread([&fn, &count] {
+    RealtimeAllocationGuard guard;
+    fn();
+    count = guard.allocations();
+  });
+  audio_thread.join();
+  return count;
+}
+} // namespace madronavm::test
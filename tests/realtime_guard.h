@@ -0,0 +1,20 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+namespace madronavm::test {
+// Counts heap allocations (operator new/delete) made by the calling thread
+// while an instance is alive. The test binary replaces the global allocation
+// operators in realtime_guard.cpp so that every new/delete is seen here.
+class RealtimeAllocationGuard {
+public:
+  RealtimeAllocationGuard();
+  ~RealtimeAllocationGuard();
+  RealtimeAllocationGuard(const RealtimeAllocationGuard&) = delete;
+  RealtimeAllocationGuard& operator=(const RealtimeAllocationGuard&) = delete;
+  // Number of allocations and frees seen on this thread since construction.
+  size_t allocations() const;
+};
+// Runs fn on a freshly spawned thread standing in for the audio thread and
+// returns how many heap allocations and frees it made.
+size_t count_audio_thread_allocations(const std::function<void()>& fn);
+} // namespace madronavm::test
@@ -7,6 +7,8 @@
 #include <iostream>
 #include "vm/opcodes.h"
 #include <cstring>
+#include <algorithm>
+#include <map>
 #ifndef TEST_DATA_DIR
 #define TEST_DATA_DIR "examples"
 #endif
@@ -39,6 +41,238 @@ TEST_CASE("Compiler detects cycles in graph", "[compiler]") {
     };
     REQUIRE_THROWS(madronavm::Compiler::topological_sort(graph));
 }
+TEST_CASE("Compiler groups independent nodes into dependency levels", "[compiler]") {
+    madronavm::PatchGraph graph;
+    // 1 -> 3 -> 4 and 2 -> 4, with 5 feeding nothing.
+    graph.nodes = { {1, "sine_gen", {}}, {2, "saw_gen", {}}, {3, "lopass", {}},
+                    {4, "add", {}}, {5, "phasor_gen", {}} };
+    graph.connections = {
+        {1, "out", 3, "in"},
+        {3, "out", 4, "in1"},
+        {2, "out", 4, "in2"}
+    };
+    auto levels = madronavm::Compiler::dependency_levels(graph);
+    REQUIRE(levels.size() == 3);
+    REQUIRE(levels[0] == std::vector<uint32_t>{1, 2, 5});
+    REQUIRE(levels[1] == std::vector<uint32_t>{3});
+    REQUIRE(levels[2] == std::vector<uint32_t>{4});
+}
+TEST_CASE("Compiler partitions independent chains at the final mix", "[compiler]") {
+    madronavm::PatchGraph graph;
+    // Chains 1 -> 2 and 3 -> 4 meet in add 5; chain 6 -> 7 goes to the right
+    // channel alone. The lopass 7 also takes a modulator 8.
+    graph.nodes = { {1, "sine_gen", {}}, {2, "lopass", {}}, {3, "saw_gen", {}},
+                    {4, "lopass", {}}, {5, "add", {}}, {6, "pulse_gen", {}},
+                    {7, "lopass", {}}, {8, "sine_gen", {}}, {9, "audio_out", {}} };
+    graph.connections = {
+        {1, "out", 2, "in"}, {3, "out", 4, "in"},
+        {2, "out", 5, "in1"}, {4, "out", 5, "in2"},
+        {6, "out", 7, "in"}, {8, "out", 7, "cutoff"},
+        {5, "out", 9, "in_l"}, {7, "out", 9, "in_r"}
+    };
+    auto partitions = madronavm::Compiler::partition(graph);
+    REQUIRE(partitions.size() == 3);
+    auto ids = [](const madronavm::PatchGraph& part) {
+        std::vector<uint32_t> result;
+        for (const auto& node : part.nodes) result.push_back(node.id);
+        return result;
+    };
+    REQUIRE(ids(partitions[0]) == std::vector<uint32_t>{1, 2, 9});
+    REQUIRE(ids(partitions[1]) == std::vector<uint32_t>{3, 4, 9});
+    REQUIRE(ids(partitions[2]) == std::vector<uint32_t>{6, 7, 8, 9});
+    // The add is gone: each chain feeds its own audio_out directly.
+    const auto& last = partitions[0].connections.back();
+    REQUIRE(last.from_node_id == 2);
+    REQUIRE(last.to_node_id == 9);
+    REQUIRE(last.to_port_name == "in_l");
+    REQUIRE(partitions[2].connections.back().to_port_name == "in_r");
+    // A single chain is left whole.
+    madronavm::PatchGraph chain;
+    chain.nodes = { {1, "sine_gen", {}}, {2, "audio_out", {}} };
+    chain.connections = { {1, "out", 2, "in_l"} };
+    REQUIRE(madronavm::Compiler::partition(chain).size() == 1);
+}
+TEST_CASE("Compiler balances pipeline stages by node cost", "[compiler]") {
+    madronavm::PatchGraph graph;
+    // A chain 1 -> 2 -> 3 -> 4 -> 5.
+    graph.nodes = { {1, "saw_gen", {}}, {2, "lopass", {}}, {3, "lopass", {}},
+                    {4, "gain", {}}, {5, "audio_out", {}} };
+    graph.connections = {
+        {1, "out", 2, "in"}, {2, "out", 3, "in"}, {3, "out", 4, "in"}, {4, "out", 5, "in_l"}
+    };
+    // The two filters dominate, so each gets a stage of its own.
+    std::map<uint32_t, float> costs = { {1, 100.0f}, {2, 400.0f}, {3, 400.0f}, {4, 50.0f} };
+    REQUIRE(madronavm::Compiler::pipeline_cuts(graph, 3, costs) == std::vector<uint32_t>{2, 3});
+    REQUIRE(madronavm::Compiler::pipeline_cuts(graph, 1, costs).empty());
+    // The cuts come out of the compiler as STAGE instructions.
+    madronavm::ModuleRegistry registry(MODULE_DEFS_PATH);
+    auto bytecode = madronavm::Compiler::compile(graph, registry, {2, 3});
+    // No operand of this patch equals the opcode; the header is skipped
+    // because its version word might.
+    const size_t header_words = sizeof(madronavm::BytecodeHeader) / sizeof(uint32_t);
+    REQUIRE(std::count(bytecode.begin() + header_words, bytecode.end(),
+                       static_cast<uint32_t>(madronavm::OpCode::STAGE)) == 2);
+}
+TEST_CASE("Compiler removes nodes that never reach audio_out", "[compiler]") {
+    madronavm::ModuleRegistry registry(MODULE_DEFS_PATH);
+    // 1 -> 2 -> audio_out 3 is live. Gain 4 hangs off the live sine, and
+    // the saw 5 -> lopass 6 branch is not connected to anything.
+    madronavm::PatchGraph graph;
+    graph.nodes = {
+        {1, "sine_gen", {{"freq", 440.0f, {}}}},
+        {2, "gain", {{"gain", 0.5f, {}}}},
+        {3, "audio_out", {}},
+        {4, "gain", {{"gain", 2.0f, {}}}},
+        {5, "saw_gen", {{"freq", 110.0f, {}}}},
+        {6, "lopass", {{"cutoff", 800.0f, {}}}},
+    };
+    graph.connections = {
+        {1, "out", 2, "in"}, {2, "out", 3, "in_l"}, {1, "out", 4, "in"}, {5, "out", 6, "in"}
+    };
+    std::vector<uint32_t> removed;
+    auto live = madronavm::Compiler::eliminate_dead_nodes(graph, &removed);
+    REQUIRE(removed == std::vector<uint32_t>{4, 5, 6});
+    REQUIRE(live.nodes.size() == 3);
+    REQUIRE(live.connections.size() == 2);
+    madronavm::CompileReport report;
+    auto bytecode = madronavm::Compiler::compile(graph, registry, {}, &report);
+    REQUIRE(report.removed_nodes == removed);
+    // Same code as the patch without the junk: no PROC, LOAD_K or register.
+    REQUIRE(bytecode == madronavm::Compiler::compile(live, registry));
+    SECTION("A patch without audio_out is kept whole") {
+        graph.nodes.erase(graph.nodes.begin() + 2);
+        graph.connections.erase(graph.connections.begin() + 1);
+        removed.clear();
+        REQUIRE(madronavm::Compiler::eliminate_dead_nodes(graph, &removed).nodes.size() == 5);
+        REQUIRE(removed.empty());
+    }
+}
+TEST_CASE("Compiler folds stateless constant subgraphs", "[compiler]") {
+    madronavm::ModuleRegistry registry(MODULE_DEFS_PATH);
+    // The float 3, left at its default of 0, plus 0.5 sets the gain of 7 on
+    // a sine, a stateful source that keeps 6 and 7 live. The float 1 is a
+    // knob set by its data, so it and the mul reading it stay.
+    madronavm::PatchGraph graph;
+    graph.nodes = {
+        {1, "float", {{"in", 3.0f, {}}}},
+        {2, "mul", {{"in2", 2.0f, {}}}},
+        {3, "float", {}},
+        {4, "add", {{"in2", 0.5f, {}}}},
+        {5, "add", {}},
+        {6, "sine_gen", {{"freq", 440.0f, {}}}},
+        {7, "gain", {}},
+        {8, "audio_out", {}},
+    };
+    graph.connections = {
+        {1, "out", 2, "in1"}, {3, "out", 4, "in1"}, {4, "out", 7, "gain"},
+        {6, "out", 7, "in"}, {7, "out", 5, "in1"}, {2, "out", 5, "in2"},
+        {5, "out", 8, "in_l"}
+    };
+    std::vector<uint32_t> folded;
+    auto result = madronavm::Compiler::fold_constants(graph, registry, &folded);
+    REQUIRE(folded == std::vector<uint32_t>{3, 4});
+    REQUIRE(result.nodes.size() == 6);
+    REQUIRE(result.connections.size() == 5);
+    const auto& gain = result.nodes[4];
+    REQUIRE(gain.id == 7);
+    REQUIRE(gain.constants.size() == 1);
+    REQUIRE(gain.constants[0].port_name == "gain");
+    REQUIRE(gain.constants[0].value == 0.5f);
+    madronavm::CompileReport report;
+    auto bytecode = madronavm::Compiler::compile(graph, registry, {}, &report);
+    REQUIRE(report.folded_nodes == folded);
+    REQUIRE(bytecode == madronavm::Compiler::compile(result, registry));
+    SECTION("A node with a live input is not folded") {
+        graph.connections.push_back({6, "out", 3, "in"});
+        folded.clear();
+        madronavm::Compiler::fold_constants(graph, registry, &folded);
+        REQUIRE(folded.empty());
+    }
+    SECTION("Folding can be turned off") {
+        madronavm::CompileOptions options;
+        options.fold_constants = false;
+        madronavm::CompileReport unfolded;
+        madronavm::Compiler::compile(graph, registry, {}, &unfolded, options);
+        REQUIRE(unfolded.folded_nodes.empty());
+    }
+}
+TEST_CASE("Compiler merges identical stateless nodes", "[compiler]") {
+    madronavm::ModuleRegistry registry(MODULE_DEFS_PATH);
+    // Gains 2 and 3 both scale the sine 1 by 0.5, so the adds 4 and 5 see
+    // the same inputs once 3 is merged into 2. Gain 6 scales the sine 7
+    // instead, and the sines themselves are stateful, so they stay apart.
+    madronavm::PatchGraph graph;
+    graph.nodes = {
+        {1, "sine_gen", {{"freq", 440.0f, {}}}},
+        {2, "gain", {{"gain", 0.5f, {}}}},
+        {3, "gain", {{"gain", 0.5f, {}}}},
+        {4, "add", {}},
+        {5, "add", {}},
+        {6, "gain", {{"gain", 0.5f, {}}}},
+        {7, "sine_gen", {{"freq", 440.0f, {}}}},
+        {8, "audio_out", {}},
+        {9, "add", {}},
+    };
+    graph.connections = {
+        {1, "out", 2, "in"}, {1, "out", 3, "in"}, {7, "out", 6, "in"},
+        {2, "out", 4, "in1"}, {3, "out", 4, "in2"}, {2, "out", 5, "in1"}, {3, "out", 5, "in2"},
+        {5, "out", 9, "in1"}, {6, "out", 9, "in2"}, {4, "out", 8, "in_l"}, {9, "out", 8, "in_r"}
+    };
+    std::vector<uint32_t> merged;
+    auto result = madronavm::Compiler::merge_duplicates(graph, registry, &merged);
+    REQUIRE(merged == std::vector<uint32_t>{3, 5});
+    REQUIRE(result.nodes.size() == 7);
+    const auto reads = [&](uint32_t from, uint32_t to, const std::string& port) {
+        return std::any_of(result.connections.begin(), result.connections.end(), [&](const auto& c) {
+            return c.from_node_id == from && c.to_node_id == to && c.to_port_name == port;
+        });
+    };
+    REQUIRE(reads(2, 4, "in2"));
+    REQUIRE(reads(4, 9, "in1"));
+    madronavm::CompileReport report;
+    auto bytecode = madronavm::Compiler::compile(graph, registry, {}, &report);
+    REQUIRE(report.merged_nodes == merged);
+    REQUIRE(bytecode == madronavm::Compiler::compile(result, registry));
+    SECTION("Merging can be turned off") {
+        madronavm::CompileOptions options;
+        options.merge_duplicates = false;
+        madronavm::CompileReport unmerged;
+        madronavm::Compiler::compile(graph, registry, {}, &unmerged, options);
+        REQUIRE(unmerged.merged_nodes.empty());
+    }
+}
+TEST_CASE("Compiler reuses registers after their last reader", "[compiler]") {
+    madronavm::ModuleRegistry registry(MODULE_DEFS_PATH);
+    // A saw through a chain of eight gains, 2 to 9.
+    madronavm::PatchGraph graph;
+    graph.nodes = {{1, "saw_gen", {}}, {10, "audio_out", {}}};
+    graph.connections = {{9, "out", 10, "in_l"}};
+    for (uint32_t id = 2; id <= 9; ++id) {
+        graph.nodes.push_back({id, "gain", {{"gain", 0.5f, {}}}});
+        graph.connections.push_back({id - 1, "out", id, "in"});
+    }
+    // Unfused, or the chain would need no registers in between at all.
+    madronavm::CompileOptions options;
+    options.fuse_expressions = false;
+    auto num_registers = [&](const std::vector<uint32_t>& stage_starts) {
+        auto bytecode = madronavm::Compiler::compile(graph, registry, stage_starts, nullptr, options);
+        madronavm::BytecodeHeader header;
+        std::memcpy(&header, bytecode.data(), sizeof(header));
+        return header.num_registers;
+    };
+    // Eight constants, and the chain's outputs alternate between two
+    // registers instead of taking nine.
+    REQUIRE(num_registers({}) == 10);
+    // A register read in a later pipeline stage is never reused, and the
+    // stages do not share registers.
+    REQUIRE(num_registers({5}) == 12);
+    // A voice_controller writes only its active voices, so its forty
+    // registers are never handed to the gain after the mix.
+    graph.nodes = {{1, "voice_controller", {}, 4}, {2, "voice_mix", {}}, {3, "gain", {{"gain", 0.5f, {}}}},
+                   {4, "audio_out", {}}};
+    graph.connections = {{1, "gate", 2, "in"}, {2, "out", 3, "in"}, {3, "out", 4, "in_l"}};
+    REQUIRE(num_registers({}) == 43);
+}
 TEST_CASE("Compiler correctly generates bytecode", "[compiler]") {
     // 1. Load the module definitions
     madronavm::ModuleRegistry registry(MODULE_DEFS_PATH);
@@ -71,12 +305,13 @@ TEST_CASE("Compiler correctly generates bytecode", "[compiler]") {
     uint32_t gain_as_u32;
     std::memcpy(&gain_as_u32, &gain_val, sizeof(gain_val));
     std::vector<uint32_t> expected_instructions = {
-        // Node 1: sine_gen
+        // Node 1: sine_gen, with node 2's gain constant loaded first
         (uint32_t)madronavm::OpCode::LOAD_K, 0, freq_as_u32,
-        (uint32_t)madronavm::OpCode::PROC,    1, 256, 1, 1, 0, 1,
-        // Node 2: gain
         (uint32_t)madronavm::OpCode::LOAD_K, 2, gain_as_u32,
-        (uint32_t)madronavm::OpCode::PROC,    2, 1027, 2, 1, 1, 2, 3,
+        // Node 2: gain, run as a MUL in the same instruction
+        (uint32_t)madronavm::OpCode::PROC_MUL, 1, 256, 0, 1, 1, 0, 1,
+                                               2, 1027, 1, 2, 3,
+        (uint32_t)madronavm::OpCode::BARRIER,
         // Node 3: audio_out
         (uint32_t)madronavm::OpCode::AUDIO_OUT, 2, 3, 3,
         // End of program
@@ -87,3 +322,221 @@ TEST_CASE("Compiler correctly generates bytecode", "[compiler]") {
     std::vector<uint32_t> actual_instructions(bytecode.begin() + (sizeof(madronavm::BytecodeHeader) / sizeof(uint32_t)), bytecode.end());
     REQUIRE(actual_instructions == expected_instructions);
 }
+TEST_CASE("Compiler pairs a module with the mul reading it", "[compiler]") {
+    madronavm::ModuleRegistry registry(MODULE_DEFS_PATH);
+    // saw 1 into gain 2, whose gain comes from sine 3 in the saw's level.
+    madronavm::PatchGraph graph;
+    graph.nodes = {
+        {1, "saw_gen", {}},
+        {2, "gain", {}},
+        {3, "sine_gen", {}},
+        {4, "audio_out", {}},
+    };
+    graph.connections = {{1, "out", 2, "in"}, {3, "out", 2, "gain"}, {2, "out", 4, "in_l"}};
+    auto instructions = [](const std::vector<uint32_t>& bytecode) {
+        return std::vector<uint32_t>(bytecode.begin() + sizeof(madronavm::BytecodeHeader) / sizeof(uint32_t),
+                                     bytecode.end());
+    };
+    SECTION("The mul waits for an input produced alongside the module") {
+        auto bytecode = madronavm::Compiler::compile(graph, registry);
+        REQUIRE(instructions(bytecode) == std::vector<uint32_t>{
+            (uint32_t)madronavm::OpCode::PROC_1x1, 1, 257, 0, UINT32_MAX, 0,
+            (uint32_t)madronavm::OpCode::PROC_1x1, 3, 256, 1, UINT32_MAX, 1,
+            (uint32_t)madronavm::OpCode::BARRIER,
+            (uint32_t)madronavm::OpCode::MUL, 2, 1027, 0, 1, 2,
+            (uint32_t)madronavm::OpCode::BARRIER,
+            (uint32_t)madronavm::OpCode::AUDIO_OUT, 2, 2, UINT32_MAX,
+            (uint32_t)madronavm::OpCode::END
+        });
+    }
+    SECTION("A constant is ready in time") {
+        graph.connections.erase(graph.connections.begin() + 1);
+        graph.nodes[1].constants = {{"gain", 0.5f, {}}};
+        uint32_t half;
+        const float half_value = 0.5f;
+        std::memcpy(&half, &half_value, sizeof(half));
+        auto bytecode = madronavm::Compiler::compile(graph, registry);
+        // The gain leaves its level behind.
+        REQUIRE(instructions(bytecode) == std::vector<uint32_t>{
+            (uint32_t)madronavm::OpCode::LOAD_K, 1, half,
+            (uint32_t)madronavm::OpCode::PROC_MUL, 1, 257, 0, 1, 1, UINT32_MAX, 0,
+                                                   2, 1027, 0, 1, 2,
+            (uint32_t)madronavm::OpCode::BARRIER,
+            (uint32_t)madronavm::OpCode::AUDIO_OUT, 2, 2, UINT32_MAX,
+            (uint32_t)madronavm::OpCode::END
+        });
+        madronavm::CompileOptions options;
+        options.superinstructions = false;
+        bytecode = madronavm::Compiler::compile(graph, registry, {}, nullptr, options);
+        REQUIRE(instructions(bytecode) == std::vector<uint32_t>{
+            (uint32_t)madronavm::OpCode::PROC_1x1, 1, 257, 0, UINT32_MAX, 0,
+            (uint32_t)madronavm::OpCode::BARRIER,
+            (uint32_t)madronavm::OpCode::LOAD_K, 1, half,
+            (uint32_t)madronavm::OpCode::MUL, 2, 1027, 0, 1, 2,
+            (uint32_t)madronavm::OpCode::BARRIER,
+            (uint32_t)madronavm::OpCode::AUDIO_OUT, 2, 2, UINT32_MAX,
+            (uint32_t)madronavm::OpCode::END
+        });
+    }
+}
+TEST_CASE("Compiler emits the fixed-arity PROC forms", "[compiler]") {
+    madronavm::ModuleRegistry registry(MODULE_DEFS_PATH);
+    // Five inputs, three, two and one, each with one output.
+    madronavm::PatchGraph graph;
+    graph.nodes = {
+        {1, "adsr", {}},
+        {2, "lopass", {}},
+        {3, "pulse_gen", {}},
+        {4, "sine_gen", {}},
+        {5, "audio_out", {}},
+    };
+    graph.connections = {{1, "out", 2, "in"}, {2, "out", 3, "freq"}, {3, "out", 4, "freq"}, {4, "out", 5, "in_l"}};
+    const uint32_t adsr = registry.get_id("adsr");
+    const uint32_t lopass = registry.get_id("lopass");
+    const uint32_t pulse = registry.get_id("pulse_gen");
+    const uint32_t sine = registry.get_id("sine_gen");
+    const uint32_t null = UINT32_MAX;
+    auto bytecode = madronavm::Compiler::compile(graph, registry);
+    REQUIRE(std::vector<uint32_t>(bytecode.begin() + 4, bytecode.end()) == std::vector<uint32_t>{
+        (uint32_t)madronavm::OpCode::PROC_5x1, 1, adsr, 0, null, null, null, null, null, 0,
+        (uint32_t)madronavm::OpCode::BARRIER,
+        (uint32_t)madronavm::OpCode::PROC_3x1, 2, lopass, 1, 0, null, null, 1,
+        (uint32_t)madronavm::OpCode::BARRIER,
+        (uint32_t)madronavm::OpCode::PROC_2x1, 3, pulse, 2, 1, null, 0,
+        (uint32_t)madronavm::OpCode::BARRIER,
+        (uint32_t)madronavm::OpCode::PROC_1x1, 4, sine, 3, 0, 1,
+        (uint32_t)madronavm::OpCode::BARRIER,
+        (uint32_t)madronavm::OpCode::AUDIO_OUT, 2, 1, null,
+        (uint32_t)madronavm::OpCode::END
+    });
+    madronavm::CompileOptions options;
+    options.arity_forms = false;
+    bytecode = madronavm::Compiler::compile(graph, registry, {}, nullptr, options);
+    REQUIRE(std::vector<uint32_t>(bytecode.begin() + 4, bytecode.begin() + 14) == std::vector<uint32_t>{
+        (uint32_t)madronavm::OpCode::PROC, 1, adsr, 0, 5, 1, null, null, null, null,
+    });
+}
+TEST_CASE("Compiler fuses arithmetic chains into one EXPR", "[compiler]") {
+    madronavm::ModuleRegistry registry(MODULE_DEFS_PATH);
+    // saw * 2 - 1: the mul's only reader is the add, so the add runs both.
+    madronavm::PatchGraph graph;
+    graph.nodes = {
+        {1, "saw_gen", {}},
+        {2, "mul", {{"in2", 2.0f, {}}}},
+        {3, "add", {{"in2", -1.0f, {}}}},
+        {4, "audio_out", {}},
+    };
+    graph.connections = {{1, "out", 2, "in1"}, {2, "out", 3, "in1"}, {3, "out", 4, "in_l"}};
+    auto bits = [](float value) {
+        uint32_t u;
+        std::memcpy(&u, &value, sizeof(u));
+        return u;
+    };
+    auto push = [](uint32_t input) {
+        return (uint32_t)madronavm::ExprOp::PUSH | input << madronavm::kExprOperandShift;
+    };
+    // Two nodes, three inputs, five operations, into register 3.
+    const std::vector<uint32_t> tree = {
+        2, 3, 5, 3, 0, 1, 2,
+        push(0), push(1), (uint32_t)madronavm::ExprOp::MUL, push(2), (uint32_t)madronavm::ExprOp::ADD,
+        // The node table: the mul's ports, then the add's.
+        2, 1025, 2, 0, 1,
+        3, 1024, 2, UINT32_MAX, 2,
+    };
+    std::vector<uint32_t> expected = {
+        (uint32_t)madronavm::OpCode::PROC_1x1, 1, 257, 0, UINT32_MAX, 0,
+        (uint32_t)madronavm::OpCode::BARRIER,
+        (uint32_t)madronavm::OpCode::LOAD_K, 1, bits(2.0f),
+        (uint32_t)madronavm::OpCode::BARRIER,
+        (uint32_t)madronavm::OpCode::LOAD_K, 2, bits(-1.0f),
+        (uint32_t)madronavm::OpCode::EXPR,
+    };
+    expected.insert(expected.end(), tree.begin(), tree.end());
+    expected.insert(expected.end(), {
+        (uint32_t)madronavm::OpCode::BARRIER,
+        (uint32_t)madronavm::OpCode::AUDIO_OUT, 2, 3, UINT32_MAX,
+        (uint32_t)madronavm::OpCode::END
+    });
+    madronavm::CompileOptions options;
+    options.superinstructions = false;
+    auto bytecode = madronavm::Compiler::compile(graph, registry, {}, nullptr, options);
+    REQUIRE(std::vector<uint32_t>(bytecode.begin() + 4, bytecode.end()) == expected);
+    SECTION("The saw joins the tree it feeds") {
+        // The whole tree moves up into the saw's level, its constants
+        // ahead of the PROC_EXPR.
+        expected = {
+            (uint32_t)madronavm::OpCode::LOAD_K, 1, bits(2.0f),
+            (uint32_t)madronavm::OpCode::LOAD_K, 2, bits(-1.0f),
+            (uint32_t)madronavm::OpCode::PROC_EXPR, 1, 257, 0, 1, 1, UINT32_MAX, 0,
+        };
+        expected.insert(expected.end(), tree.begin(), tree.end());
+        expected.insert(expected.end(), {
+            (uint32_t)madronavm::OpCode::BARRIER,
+            (uint32_t)madronavm::OpCode::AUDIO_OUT, 2, 3, UINT32_MAX,
+            (uint32_t)madronavm::OpCode::END
+        });
+        bytecode = madronavm::Compiler::compile(graph, registry);
+        REQUIRE(std::vector<uint32_t>(bytecode.begin() + 4, bytecode.end()) == expected);
+    }
+    SECTION("A value with a second reader stays in a register") {
+        graph.connections.push_back({2, "out", 4, "in_r"});
+        bytecode = madronavm::Compiler::compile(graph, registry);
+        REQUIRE(std::count(bytecode.begin(), bytecode.end(), (uint32_t)madronavm::OpCode::EXPR) == 0);
+    }
+}
+TEST_CASE("Compiler emits PROC_POLY for polyphonic cables", "[compiler]") {
+    madronavm::ModuleRegistry registry(MODULE_DEFS_PATH);
+    auto bits = [](float value) {
+        uint32_t u;
+        std::memcpy(&u, &value, sizeof(u));
+        return u;
+    };
+    const uint32_t poly = madronavm::kPolyRegister;
+    madronavm::PatchGraph graph;
+    graph.nodes = {
+        {1, "saw_gen", {{"freq", 100.0f, {100.0f, 200.0f, 300.0f}}}},
+        {2, "gain", {{"gain", 0.5f, {}}}},
+        {3, "voice_mix", {}},
+        {4, "audio_out", {}},
+    };
+    graph.connections = {{1, "out", 2, "in"}, {2, "out", 3, "in"}, {3, "out", 4, "in_l"}};
+    SECTION("three voices") {
+        auto bytecode = madronavm::Compiler::compile(graph, registry);
+        madronavm::BytecodeHeader header;
+        std::memcpy(&header, bytecode.data(), sizeof(header));
+        REQUIRE(header.num_registers == 10);
+        std::vector<uint32_t> expected_instructions = {
+            // Node 1: one LOAD_K per voice, three output lanes from register 3
+            (uint32_t)madronavm::OpCode::LOAD_K, 0, bits(100.0f),
+            (uint32_t)madronavm::OpCode::LOAD_K, 1, bits(200.0f),
+            (uint32_t)madronavm::OpCode::LOAD_K, 2, bits(300.0f),
+            (uint32_t)madronavm::OpCode::PROC_POLY, 1, 257, 0, 3, 1, 1, 0 | poly, 3,
+            (uint32_t)madronavm::OpCode::BARRIER,
+            // Node 2: the mono gain is shared by every voice
+            (uint32_t)madronavm::OpCode::LOAD_K, 6, bits(0.5f),
+            (uint32_t)madronavm::OpCode::PROC_POLY, 2, 1027, 1, 3, 2, 1, 3 | poly, 6, 7,
+            (uint32_t)madronavm::OpCode::BARRIER,
+            // Node 3: voice_mix takes every lane as its own input, and
+            // reuses the saw's lanes for its output
+            (uint32_t)madronavm::OpCode::PROC_3x1, 3, 1030, 2, 7, 8, 9, 3,
+            (uint32_t)madronavm::OpCode::BARRIER,
+            (uint32_t)madronavm::OpCode::AUDIO_OUT, 2, 3, UINT32_MAX,
+            (uint32_t)madronavm::OpCode::END
+        };
+        std::vector<uint32_t> actual_instructions(bytecode.begin() + (sizeof(madronavm::BytecodeHeader) / sizeof(uint32_t)), bytecode.end());
+        REQUIRE(actual_instructions == expected_instructions);
+    }
+    SECTION("mismatched voice counts") {
+        graph.nodes[1].constants[0].voice_values = {0.5f, 0.25f};
+        REQUIRE_THROWS_AS(madronavm::Compiler::compile(graph, registry), std::runtime_error);
+    }
+    SECTION("voices into a mono-only module") {
+        graph.nodes[2] = {3, "threshold", {}};
+        graph.connections[1].to_port_name = "signal";
+        REQUIRE_THROWS_AS(madronavm::Compiler::compile(graph, registry), std::runtime_error);
+    }
+    SECTION("voices into audio_out") {
+        graph.connections[2] = {2, "out", 4, "in_l"};
+        REQUIRE_THROWS_AS(madronavm::Compiler::compile(graph, registry), std::runtime_error);
+    }
+}
@@ -40,4 +40,237 @@ TEST_CASE("VoiceController Test", "[dsp]") {
     currentSample += blockSize;
     // The gate should now be zero.
     REQUIRE(gateOut[blockSize - 1] == 0.0f);
-} 
\ No newline at end of file
+}
+
+TEST_CASE("VoiceController tracks active voices at runtime polyphony", "[dsp]") {
+    constexpr float sampleRate = 48000.0f;
+    constexpr int blockSize = kFloatsPerDSPVector;
+    const int numOutputs = VoiceController::kMaxVoices * VoiceController::kNumOutputsPerVoice;
+    VoiceController controller(sampleRate);
+    std::vector<std::vector<float>> outputData(numOutputs, std::vector<float>(blockSize));
+    std::vector<float*> outputs(numOutputs);
+    for (int i = 0; i < numOutputs; ++i) {
+        outputs[i] = outputData[i].data();
+    }
+    auto gate = [&](size_t voice) {
+        return outputs[voice * VoiceController::kNumOutputsPerVoice + ml::kGate][blockSize - 1];
+    };
+    auto pitch = [&](size_t voice) {
+        return outputs[voice * VoiceController::kNumOutputsPerVoice + ml::kPitch][blockSize - 1];
+    };
+    controller.setPolyphony(100);
+    REQUIRE(controller.getPolyphony() == 100);
+    controller.process(nullptr, 0, outputs.data(), numOutputs);
+    REQUIRE(controller.numActiveVoices() == 0);
+    SECTION("idle voices are not written") {
+        outputs[50 * VoiceController::kNumOutputsPerVoice + ml::kGate][blockSize - 1] = 7.0f;
+        controller.noteOn(60, 100);
+        controller.process(nullptr, 0, outputs.data(), numOutputs);
+        REQUIRE(controller.numActiveVoices() == 1);
+        REQUIRE(gate(0) > 0.0f);
+        REQUIRE(gate(50) == 7.0f);
+    }
+    SECTION("many voices") {
+        for (int note = 0; note < 100; ++note) {
+            controller.noteOn(note, 100);
+        }
+        controller.process(nullptr, 0, outputs.data(), numOutputs);
+        REQUIRE(controller.numActiveVoices() == 100);
+        REQUIRE(pitch(99) == Approx(99.0f));
+        // Note offs free their voices and silence them.
+        for (int note = 0; note < 100; note += 2) {
+            controller.noteOff(note, 0);
+        }
+        controller.process(nullptr, 0, outputs.data(), numOutputs);
+        REQUIRE(controller.numActiveVoices() == 50);
+        REQUIRE(gate(0) == 0.0f);
+        REQUIRE(gate(1) > 0.0f);
+        for (size_t i = 0; i < controller.numActiveVoices(); ++i) {
+            REQUIRE(controller.activeVoices()[i] % 2 == 1);
+        }
+        // Lowering the polyphony drops the voices above it.
+        controller.setPolyphony(10);
+        controller.process(nullptr, 0, outputs.data(), numOutputs);
+        REQUIRE(controller.numActiveVoices() == 5);
+        REQUIRE(gate(11) == 0.0f);
+    }
+    SECTION("stealing takes the oldest voice") {
+        controller.setPolyphony(2);
+        controller.noteOn(60, 100);
+        controller.process(nullptr, 0, outputs.data(), numOutputs);
+        controller.noteOn(62, 100);
+        controller.process(nullptr, 0, outputs.data(), numOutputs);
+        controller.noteOn(64, 100);
+        controller.process(nullptr, 0, outputs.data(), numOutputs);
+        REQUIRE(controller.numActiveVoices() == 2);
+        REQUIRE(pitch(0) == Approx(64.0f));
+        REQUIRE(pitch(1) == Approx(62.0f));
+    }
+    SECTION("released voices stay active for the release time") {
+        controller.setReleaseTime(4 * blockSize / sampleRate);
+        controller.noteOn(60, 100);
+        controller.process(nullptr, 0, outputs.data(), numOutputs);
+        controller.noteOff(60, 0);
+        for (int block = 0; block < 3; ++block) {
+            controller.process(nullptr, 0, outputs.data(), numOutputs);
+            REQUIRE(controller.isActive(0));
+            REQUIRE(gate(0) == 0.0f);
+            REQUIRE(pitch(0) == Approx(60.0f));
+        }
+        controller.process(nullptr, 0, outputs.data(), numOutputs);
+        REQUIRE_FALSE(controller.isActive(0));
+        controller.process(nullptr, 0, outputs.data(), numOutputs);
+        REQUIRE(pitch(0) == 0.0f);
+    }
+}
+TEST_CASE("VoiceController applies notes at their sample", "[dsp]") {
+    constexpr int blockSize = kFloatsPerDSPVector;
+    const int numOutputs = VoiceController::kNumOutputsPerVoice;
+    VoiceController controller(48000.0f);
+    std::vector<std::vector<float>> outputData(numOutputs, std::vector<float>(blockSize));
+    std::vector<float*> outputs(numOutputs);
+    for (int i = 0; i < numOutputs; ++i) {
+        outputs[i] = outputData[i].data();
+    }
+    const float* gateOut = outputs[ml::kGate];
+    // Events arrive out of order; the later one must not cut the earlier.
+    controller.noteOff(60, 0, 0, 40);
+    controller.noteOn(60, 127, 0, 10);
+    controller.process(nullptr, 0, outputs.data(), numOutputs);
+    for (int s = 0; s < blockSize; ++s) {
+        INFO("sample " << s);
+        REQUIRE(gateOut[s] == (s >= 10 && s < 40 ? 1.0f : 0.0f));
+    }
+    REQUIRE(outputs[ml::kElapsedTime][10] == 0.0f);
+}
+TEST_CASE("VoiceController publishes its busy voices as active lanes", "[dsp]") {
+    constexpr int blockSize = kFloatsPerDSPVector;
+    const int numOutputs = 4 * VoiceController::kNumOutputsPerVoice;
+    VoiceController controller(48000.0f);
+    controller.setPolyphony(4);
+    std::vector<std::vector<float>> outputData(numOutputs, std::vector<float>(blockSize));
+    std::vector<float*> outputs(numOutputs);
+    for (int i = 0; i < numOutputs; ++i) {
+        outputs[i] = outputData[i].data();
+    }
+    // A release of two blocks, through the input.
+    std::vector<float> release(blockSize, 2 * blockSize / 48000.0f);
+    const float* inputs[] = { release.data() };
+    const ActiveLanes& lanes = *controller.active_lanes();
+    controller.noteOn(60, 100);
+    controller.noteOn(64, 100);
+    controller.process(inputs, 1, outputs.data(), numOutputs);
+    REQUIRE(lanes.contains(0));
+    REQUIRE(lanes.contains(1));
+    REQUIRE_FALSE(lanes.contains(2));
+    // A voice is busy through its release, then idle.
+    controller.noteOff(60, 0);
+    controller.process(inputs, 1, outputs.data(), numOutputs);
+    controller.process(inputs, 1, outputs.data(), numOutputs);
+    REQUIRE(lanes.contains(0));
+    controller.process(inputs, 1, outputs.data(), numOutputs);
+    REQUIRE_FALSE(lanes.contains(0));
+    REQUIRE(lanes.contains(1));
+    // One freed part way through a block still sounds in it.
+    controller.process(nullptr, 0, outputs.data(), numOutputs);
+    controller.noteOff(64, 0, 0, 20);
+    controller.setReleaseTime(0.0f);
+    controller.process(nullptr, 0, outputs.data(), numOutputs);
+    REQUIRE(lanes.contains(1));
+    controller.process(nullptr, 0, outputs.data(), numOutputs);
+    REQUIRE_FALSE(lanes.contains(1));
+}
+TEST_CASE("VoiceController applies performance events", "[dsp]") {
+    constexpr int blockSize = kFloatsPerDSPVector;
+    const int numOutputs = 2 * VoiceController::kNumOutputsPerVoice;
+    VoiceController controller(48000.0f);
+    controller.setPolyphony(2);
+    std::vector<std::vector<float>> outputData(numOutputs, std::vector<float>(blockSize));
+    std::vector<float*> outputs(numOutputs);
+    for (int i = 0; i < numOutputs; ++i) {
+        outputs[i] = outputData[i].data();
+    }
+    auto row = [&](size_t voice, int r, int sample = kFloatsPerDSPVector - 1) {
+        return outputs[voice * VoiceController::kNumOutputsPerVoice + r][sample];
+    };
+    auto send = [&](int type, float value1, float value2 = 0.0f, int time = 0) {
+        ml::Event e;
+        e.type = type;
+        e.value1 = value1;
+        e.value2 = value2;
+        e.time = time;
+        controller.handle_event(e);
+    };
+    auto process = [&] { controller.process(nullptr, 0, outputs.data(), numOutputs); };
+    controller.noteOn(60, 127);
+    controller.noteOn(64, 127);
+    process();
+    SECTION("pitch wheel bends every voice from its sample") {
+        controller.setPitchBendRange(12.0f);
+        send(ml::kPitchWheel, 0.5f, 0.0f, 32);
+        process();
+        REQUIRE(row(0, ml::kPitch, 31) == 60.0f);
+        REQUIRE(row(0, ml::kPitch, 32) == 66.0f);
+        REQUIRE(row(1, ml::kPitch) == 70.0f);
+        REQUIRE(row(1, ml::kX) == 0.5f);
+    }
+    SECTION("note pressure reaches the voice playing the note") {
+        send(ml::kNotePressure, 64.0f, 0.75f);
+        process();
+        REQUIRE(row(0, ml::kAftertouch) == 0.0f);
+        REQUIRE(row(1, ml::kAftertouch) == 0.75f);
+        REQUIRE(row(1, ml::kZ) == 0.75f);
+    }
+    SECTION("channel pressure reaches every voice, and new ones") {
+        send(ml::kChannelPressure, 0.25f);
+        process();
+        REQUIRE(row(0, ml::kAftertouch) == 0.25f);
+        REQUIRE(row(1, ml::kZ) == 0.25f);
+        controller.noteOff(60, 0);
+        controller.noteOn(67, 127);
+        process();
+        REQUIRE(row(0, ml::kPitch) == 67.0f);
+        REQUIRE(row(0, ml::kAftertouch) == 0.25f);
+    }
+    SECTION("mod wheel and timbre controllers") {
+        send(ml::kController, 1.0f, 0.5f);
+        send(ml::kController, 74.0f, 0.25f);
+        process();
+        REQUIRE(row(0, ml::kModulation) == 0.5f);
+        REQUIRE(row(1, ml::kModulation) == 0.5f);
+        REQUIRE(row(0, ml::kY) == 0.25f);
+        REQUIRE(controller.numIgnoredEvents() == 0);
+    }
+    SECTION("sustain controller holds released notes") {
+        send(ml::kController, 64.0f, 1.0f);
+        controller.noteOff(60, 0);
+        process();
+        REQUIRE(row(0, ml::kGate) > 0.0f);
+        REQUIRE(controller.isActive(0));
+        send(ml::kController, 64.0f, 0.0f, 16);
+        process();
+        REQUIRE(row(0, ml::kGate, 15) > 0.0f);
+        REQUIRE(row(0, ml::kGate, 16) == 0.0f);
+        REQUIRE_FALSE(controller.isActive(0));
+        // Notes still held stay on.
+        REQUIRE(row(1, ml::kGate) > 0.0f);
+    }
+    SECTION("sustain pedal holds released notes") {
+        send(ml::kSustainPedal, 1.0f);
+        controller.noteOff(64, 0);
+        process();
+        REQUIRE(row(1, ml::kGate) > 0.0f);
+        send(ml::kSustainPedal, 0.0f);
+        process();
+        REQUIRE(row(1, ml::kGate) == 0.0f);
+        REQUIRE(row(0, ml::kGate) > 0.0f);
+    }
+    SECTION("other events are counted and dropped") {
+        send(ml::kProgramChange, 5.0f);
+        send(ml::kController, 7.0f, 1.0f);
+        process();
+        REQUIRE(controller.numIgnoredEvents() == 2);
+        REQUIRE(row(0, ml::kPitch) == 60.0f);
+        REQUIRE(row(0, ml::kModulation) == 0.0f);
+    }
+}
@@ -53,3 +53,18 @@ TEST_CASE("Parser correctly parses a simple patch", "[parser]") {
     REQUIRE(conn3.to_node_id == 3);
     REQUIRE(conn3.to_port_name == "in_r");
 }
+TEST_CASE("Parser reads voices and per-voice constants", "[parser]") {
+    auto graph = madronavm::parse_json(R"({
+      "modules": [
+        {"id": 1, "name": "saw_gen", "voices": 4, "data": {"freq": [110.0, 220.0]}},
+        {"id": 2, "name": "gain", "data": {"gain": 0.5}}
+      ],
+      "connections": []
+    })");
+    REQUIRE(graph.nodes.size() == 2);
+    REQUIRE(graph.nodes[0].voices == 4);
+    REQUIRE(graph.nodes[0].constants[0].value == 110.0f);
+    REQUIRE(graph.nodes[0].constants[0].voice_values == std::vector<float>{110.0f, 220.0f});
+    REQUIRE(graph.nodes[1].voices == 1);
+    REQUIRE(graph.nodes[1].constants[0].voice_values.empty());
+}
@@ -0,0 +1,37 @@
+#include "catch.hpp"
+#include "vm/memory_arena.h"
+#include <cstdint>
+using namespace madronavm;
+TEST_CASE("MemoryArena hands out zeroed, cache-line aligned memory", "[vm]") {
+  MemoryArena arena;
+  MemoryOptions options;
+  SECTION("default pages") {}
+  SECTION("huge pages") {
+    options.huge_pages = true;
+  }
+  SECTION("locked") {
+    options.lock = true;
+  }
+  arena.allocate(1000, options);
+  REQUIRE(arena.data() != nullptr);
+  REQUIRE(arena.size() >= 1000);
+  REQUIRE(reinterpret_cast<uintptr_t>(arena.data()) % MemoryArena::kCacheLineSize == 0);
+  const auto* bytes = static_cast<const unsigned char*>(arena.data());
+  bool zeroed = true;
+  for (size_t i = 0; i < arena.size(); ++i) {
+    zeroed = zeroed && bytes[i] == 0;
+  }
+  REQUIRE(zeroed);
+  if (arena.huge_pages()) {
+    REQUIRE(reinterpret_cast<uintptr_t>(arena.data()) % MemoryArena::kHugePageSize == 0);
+    REQUIRE(arena.size() % MemoryArena::kHugePageSize == 0);
+  }
+  // Locking is best effort, but never happens unasked.
+  if (!options.lock) {
+    REQUIRE_FALSE(arena.locked());
+  }
+  arena.release();
+  REQUIRE(arena.data() == nullptr);
+  REQUIRE(arena.size() == 0);
+  REQUIRE_FALSE(arena.locked());
+}
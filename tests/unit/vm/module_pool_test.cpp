@@ -0,0 +1,72 @@
+#include "catch.hpp"
+#include "vm/memory_arena.h"
+#include "vm/module_pool.h"
+#include "dsp/poly.h"
+#include <cstdint>
+#include <vector>
+using namespace madronavm;
+TEST_CASE("ModulePool places modules contiguously in slot order", "[vm]") {
+  // The storage outlives the modules in it.
+  MemoryArena arena;
+  ModulePool pool;
+  // sine_gen, lopass, gain, adsr
+  arena.allocate(pool.plan({256, 512, 1027, 1536}));
+  pool.build(arena.data(), 48000.0f);
+  REQUIRE(pool.size() == 4);
+  for (size_t slot = 0; slot < pool.size(); ++slot) {
+    auto address = reinterpret_cast<uintptr_t>(pool.get(slot));
+    REQUIRE(address % ModulePool::kCacheLineSize == 0);
+    if (slot > 0) {
+      REQUIRE(address > reinterpret_cast<uintptr_t>(pool.get(slot - 1)));
+    }
+  }
+  SECTION("Deferred slots are filled by relocation") {
+    MemoryArena next_arena;
+    ModulePool next;
+    next_arena.allocate(next.plan({1027, 256}));
+    next.build(next_arena.data(), 48000.0f, {false, true});
+    REQUIRE(next.get(0) != nullptr);
+    REQUIRE(next.get(1) == nullptr);
+    next.relocate(1, *pool.get(0));
+    REQUIRE(next.get(1) != nullptr);
+    REQUIRE(next.get(1) != pool.get(0));
+    REQUIRE(next.descriptor(1).id == 256);
+  }
+  SECTION("Polyphonic variants keep state for the lanes they run") {
+    const uint32_t poly_saw = 257 | dsp::kPolyVariant;
+    const auto& descriptor = dsp::get_module_descriptor(poly_saw);
+    REQUIRE(descriptor.lane_size > 0);
+    MemoryArena four_arena;
+    ModulePool four;
+    const size_t four_bytes = four.plan({poly_saw}, {4});
+    REQUIRE(four_bytes < descriptor.storage_size(dsp::kMaxPolyLanes));
+    REQUIRE(four_bytes >= descriptor.storage_size(4));
+    four_arena.allocate(four_bytes);
+    four.build(four_arena.data(), 48000.0f);
+    std::vector<float> freq(kFloatsPerDSPVector, 440.0f);
+    std::vector<std::vector<float>> lanes(5, std::vector<float>(kFloatsPerDSPVector, 1.0f));
+    const float* inputs[5];
+    float* outputs[5];
+    for (int lane = 0; lane < 5; ++lane) {
+      inputs[lane] = freq.data();
+      outputs[lane] = lanes[lane].data();
+    }
+    four.get(0)->process(inputs, 4, outputs, 4);
+    REQUIRE(lanes[3][kFloatsPerDSPVector - 1] != 0.0f);
+    // More lanes than it has state for: refused, and silenced.
+    four.get(0)->process(inputs, 5, outputs, 5);
+    REQUIRE(lanes[3][kFloatsPerDSPVector - 1] == 0.0f);
+    // A relocated module brings its lanes along.
+    MemoryArena next_arena;
+    ModulePool next;
+    next_arena.allocate(next.plan({poly_saw}, {4}));
+    next.build(next_arena.data(), 48000.0f, {true});
+    next.relocate(0, *four.get(0));
+    next.get(0)->process(inputs, 4, outputs, 4);
+    REQUIRE(lanes[3][kFloatsPerDSPVector - 1] != 0.0f);
+  }
+  SECTION("Unknown module IDs leave the pool empty") {
+    REQUIRE_THROWS(pool.plan({256, 9999}));
+    REQUIRE(pool.size() == 0);
+  }
+}
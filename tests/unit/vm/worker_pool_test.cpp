@@ -0,0 +1,75 @@
+#include "catch.hpp"
+#include "vm/worker_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+using namespace madronavm;
+namespace {
+struct Counts {
+  std::vector<std::atomic<int>> hits;
+  explicit Counts(size_t n) : hits(n) {}
+};
+void count_hit(void* context, uint32_t index) {
+  static_cast<Counts*>(context)->hits[index].fetch_add(1, std::memory_order_relaxed);
+}
+// Records, for one job, how often each index started and finished.
+struct Job {
+  std::vector<std::atomic<int>> started;
+  std::vector<std::atomic<int>> finished;
+  explicit Job(size_t n) : started(n), finished(n) {}
+};
+void run_job_index(void* context, uint32_t index) {
+  auto* job = static_cast<Job*>(context);
+  job->started[index].fetch_add(1, std::memory_order_relaxed);
+  // Gives other workers the chance to race past the end of the job.
+  std::this_thread::yield();
+  job->finished[index].fetch_add(1, std::memory_order_release);
+}
+} // namespace
+TEST_CASE("WorkerPool runs every index exactly once", "[vm]") {
+  constexpr uint32_t kCount = 37;
+  constexpr int kJobs = 2000;
+  for (size_t num_workers : {0, 1, 3}) {
+    WorkerPool pool(num_workers, false);
+    REQUIRE(pool.num_workers() == num_workers);
+    Counts counts(kCount);
+    // Back-to-back jobs exercise workers that are still leaving the last one.
+    for (int job = 0; job < kJobs; ++job) {
+      pool.parallel_for(&count_hit, &counts, (job % 2) ? kCount : kCount / 2);
+    }
+    for (uint32_t i = 0; i < kCount; ++i) {
+      const int expected = kJobs / 2 + ((i < kCount / 2) ? kJobs / 2 : 0);
+      REQUIRE(counts.hits[i].load() == expected);
+    }
+  }
+}
+TEST_CASE("WorkerPool finishes each job before the next reuses its indices", "[vm]") {
+  // A short job followed by a longer one: a worker that claimed the short
+  // job's last index must not go on to take an index of the long one.
+  constexpr uint32_t kShort = 1;
+  constexpr uint32_t kLong = 8;
+  constexpr int kJobs = 2000;
+  // More workers than cores, so workers are preempted mid-claim.
+  const size_t num_workers = std::max(4u, 2 * std::thread::hardware_concurrency());
+  WorkerPool pool(num_workers, false);
+  Job job(kLong);
+  int bad_jobs = 0;
+  for (int n = 0; n < kJobs; ++n) {
+    const uint32_t count = (n % 2) ? kLong : kShort;
+    pool.parallel_for(&run_job_index, &job, count);
+    // Every index ran exactly once and had finished when parallel_for
+    // returned.
+    bool ok = true;
+    for (uint32_t i = 0; i < kLong; ++i) {
+      const int expected = (i < count) ? 1 : 0;
+      ok = ok && job.started[i].load(std::memory_order_relaxed) == expected;
+      ok = ok && job.finished[i].load(std::memory_order_acquire) == expected;
+      job.started[i].store(0, std::memory_order_relaxed);
+      job.finished[i].store(0, std::memory_order_relaxed);
+    }
+    bad_jobs += ok ? 0 : 1;
+  }
+  REQUIRE(bad_jobs == 0);
+}